@@ -7,7 +7,7 @@ echo "Chat ID        : $3"
 echo "User ID        : $4"
 echo "Message ID     : $5"
 echo "Text           : $6"
-echo "Raw JSON       : $7"
+echo "Raw JSON       : on stdin"
 
 CFG=$TG_CONFIG_FILE
 
@@ -28,6 +28,6 @@ sleep 3
 "$TG_API" "$CFG" "$1" delete_message "{ 'chat_id': $3, 'message_id': $MSG_ID }"
 
 
-echo "$7" | jq
+jq . <&0
 
 echo "---------------------------------------------------------------"
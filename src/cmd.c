@@ -1,17 +1,24 @@
 #include <assert.h>
+#include <dirent.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <math.h>
 #include <string.h>
+#include <threads.h>
+#include <unistd.h>
 
 #include "cmd.h"
 
 #include "common.h"
+#include "rpc.h"
 #include "sched.h"
 #include "tg.h"
 #include "util.h"
 
 
-#define _CMD_EXTERN_ARGS_SIZE (16)
+#define _CMD_EXTERN_ARGS_SIZE   (16)
+#define _CMD_BUILTIN_HASH_SIZE  (256)	/* power of 2 */
+#define _CMD_BUILTIN_HASH_TRIES (1 << 16)
 
 
 static CmdBuiltin _cmd_builtin_list[] = {
@@ -21,28 +28,146 @@ static CmdBuiltin _cmd_builtin_list[] = {
 	CMD_BUILTIN_LIST_TEST,
 };
 
-static int _register_builtin(void);
+#define _CMD_LIST_SIZE (LEN(_cmd_builtin_list) + CFG_CMD_PLUGIN_CMDS_SIZE)
+
+static_assert((_CMD_LIST_SIZE * 2) <= _CMD_BUILTIN_HASH_SIZE, "_CMD_BUILTIN_HASH_SIZE is too small");
+
+
+typedef struct cmd_plugin_item {
+	void            *handle;
+	const CmdPlugin *plugin;
+} CmdPluginItem;
+
+/*
+ * Builtin and plugin commands. _exec_builtin() holds a reader while a callback is running,
+ * cmd_reload_plugins() waits for them before unloading anything.
+ *
+ * A pending reload blocks new readers too, or it could starve: from SIGHUP until the
+ * slowest running callback returns, every builtin command waits, plugin or not.
+ * Not RCU: dlopen() of a path that is still loaded returns the old handle, the new table
+ * can't be built before the old plugins are closed.
+ */
+typedef struct cmd_table {
+	mtx_t         mutex;
+	cnd_t         cond;
+	int           readers;
+	int           is_reloading;
+	int           list_len;
+	int           plugins_len;
+	uint32_t      hash_seed;
+	int16_t       hash[_CMD_BUILTIN_HASH_SIZE];	/* perfect hash over the lowercase names: slot -> list index, -1: empty */
+	CmdBuiltin    list[_CMD_LIST_SIZE];
+	CmdPluginItem plugins[CFG_CMD_PLUGINS_SIZE];
+	char          plugin_dir[CFG_CMD_PLUGIN_DIR_SIZE];
+} CmdTable;
+
+static CmdTable _cmd_table;
+
+static int      _cmd_table_build(void);
+static void     _cmd_table_enter(CmdTable *t);
+static void     _cmd_table_leave(CmdTable *t);
+static int      _register_builtin(void);
+static uint32_t _builtin_hash(const char name[], uint32_t seed);
+static int      _builtin_hash_build(void);
+static int      _builtin_hash_find(const char name[]);
+static void     _plugin_load_all(CmdTable *t);
+static void     _plugin_unload_all(CmdTable *t);
+static int      _plugin_filter(const struct dirent *d);
+static int      _plugin_load(CmdTable *t, const char file_name[]);
+static int      _plugin_verify_cmd(const CmdTable *t, const CmdBuiltin *p, const char path[]);
 static int _parse_cmd(CmdParam *param, const char req[]);
 static int _session_acquire(const CmdParam *param);
 static int _session_release(const CmdParam *param);
-static int _exec_builtin(const CmdParam *c, int chat_flags);
-static int _exec_extern(const CmdParam *c, int chat_flags);
-static int _exec_cmd_message(const CmdParam *c);
+static int _exec_builtin(const CmdParam *c);
+static int _exec_extern(const CmdParam *c, const ModelCmdResolve *r);
+static int _exec_cmd_message(const CmdParam *c, const ModelCmdResolve *r);
 static int _verify(const CmdParam *c, int chat_flags, int flags);
-static int _spawn_child_process(const CmdParam *c, int chat_flags, const char file_name[]);
+static int _exec_extern_cached(const CmdParam *c, const char key[]);
+static int _spawn_child_process(const CmdParam *c, int chat_flags, const ModelCmdExtern *ce,
+				const char cache_key[]);
+static int _send_worker_request(const CmdParam *c, int chat_flags, const ModelCmdExtern *ce);
 
 
 /*
  * Public
  */
 int
-cmd_init(void)
+cmd_init(const char plugin_dir[])
 {
+	CmdTable *const t = &_cmd_table;
 	LOG_INFO("cmd", "_cmd_builtin_list size: %zu bytes", sizeof(_cmd_builtin_list));
-	if (model_cmd_builtin_clear() < 0)
+	if (mtx_init(&t->mutex, mtx_plain) != thrd_success) {
+		LOG_ERRN("cmd", "%s", "mtx_init: failed");
 		return -1;
+	}
+
+	if (cnd_init(&t->cond) != thrd_success) {
+		LOG_ERRN("cmd", "%s", "cnd_init: failed");
+		goto err0;
+	}
+
+	t->readers = 0;
+	t->is_reloading = 0;
+	t->plugins_len = 0;
+	t->list_len = (int)LEN(_cmd_builtin_list);
+	memcpy(t->list, _cmd_builtin_list, sizeof(_cmd_builtin_list));
+	cstr_copy_n(t->plugin_dir, LEN(t->plugin_dir), plugin_dir);
+
+	_plugin_load_all(t);
+	if (_cmd_table_build() < 0)
+		goto err1;
+
+	return 0;
 
-	return _register_builtin();
+err1:
+	_plugin_unload_all(t);
+	cnd_destroy(&t->cond);
+err0:
+	mtx_destroy(&t->mutex);
+	return -1;
+}
+
+
+void
+cmd_deinit(void)
+{
+	CmdTable *const t = &_cmd_table;
+	_plugin_unload_all(t);
+	cnd_destroy(&t->cond);
+	mtx_destroy(&t->mutex);
+}
+
+
+int
+cmd_reload_plugins(void)
+{
+	CmdTable *const t = &_cmd_table;
+	mtx_lock(&t->mutex);
+	while (t->is_reloading)
+		cnd_wait(&t->cond, &t->mutex);
+
+	t->is_reloading = 1;
+	while (t->readers > 0)
+		cnd_wait(&t->cond, &t->mutex);
+
+	mtx_unlock(&t->mutex);
+
+	LOG_INFO("cmd", "reloading plugins: '%s'", t->plugin_dir);
+	_plugin_unload_all(t);
+	_plugin_load_all(t);
+
+	const int ret = _cmd_table_build();
+	if (ret < 0) {
+		LOG_ERRN("cmd", "%s", "reload: failed, plugins are unloaded");
+		_plugin_unload_all(t);
+		_cmd_table_build();
+	}
+
+	mtx_lock(&t->mutex);
+	t->is_reloading = 0;
+	cnd_broadcast(&t->cond);
+	mtx_unlock(&t->mutex);
+	return ret;
 }
 
 
@@ -55,19 +180,20 @@ cmd_exec(CmdParam *c, const char req[])
 	if (_session_acquire(c) < 0)
 		return;
 
-	if (_exec_cmd_message(c))
+	/* a CMD Message can't shadow a builtin, see: admin.c */
+	if (_exec_builtin(c))
 		goto out0;
 
-	const int cflags = model_chat_get_flags(c->id_chat);
-	if (cflags < 0) {
-		SEND_ERROR_TEXT(c->msg, NULL, "%s", "Failed to get chat flags!");
+	ModelCmdResolve res;
+	if (model_cmd_resolve(&res, c->id_chat, c->name) < 0) {
+		SEND_ERROR_TEXT(c->msg, NULL, "%s", "Failed to get command data!");
 		goto out0;
 	}
 
-	if (_exec_builtin(c, cflags))
+	if (_exec_cmd_message(c, &res))
 		goto out0;
 
-	if (_exec_extern(c, cflags))
+	if (_exec_extern(c, &res))
 		goto out0;
 
 	if ((c->msg->chat.type != TG_CHAT_TYPE_PRIVATE) && (c->has_username == 0))
@@ -80,6 +206,22 @@ out0:
 }
 
 
+/* the extern commands that timed out in the chld queue: they were never run */
+void
+cmd_reply_dropped(void)
+{
+	ChldDropped list[16];
+	unsigned len;
+	do {
+		len = chld_dropped_take(list, LEN(list));
+		for (unsigned i = 0; i < len; i++) {
+			const TgMessage msg = { .id = list[i].msg_id, .chat = { .id = list[i].chat_id } };
+			send_error_text(&msg, NULL, list[i].name, "%s", "Too many commands are running, try again later!");
+		}
+	} while (len == LEN(list));
+}
+
+
 int
 cmd_get_list(ModelCmd cmd_list[], int len, PagerList *list, int flags, int is_private)
 {
@@ -101,12 +243,50 @@ cmd_get_list(ModelCmd cmd_list[], int len, PagerList *list, int flags, int is_pr
 /*
  * Private
  */
+static int
+_cmd_table_build(void)
+{
+	if (model_cmd_builtin_clear() < 0)
+		return -1;
+
+	if (_register_builtin() < 0)
+		return -1;
+
+	return _builtin_hash_build();
+}
+
+
+static void
+_cmd_table_enter(CmdTable *t)
+{
+	mtx_lock(&t->mutex);
+	while (t->is_reloading)
+		cnd_wait(&t->cond, &t->mutex);
+
+	t->readers++;
+	mtx_unlock(&t->mutex);
+}
+
+
+static void
+_cmd_table_leave(CmdTable *t)
+{
+	mtx_lock(&t->mutex);
+	t->readers--;
+	if ((t->readers == 0) && t->is_reloading)
+		cnd_broadcast(&t->cond);
+
+	mtx_unlock(&t->mutex);
+}
+
+
 static int
 _register_builtin(void)
 {
 	int count = 0;
-	for (int i = 0; i < (int)LEN(_cmd_builtin_list); i++) {
-		const CmdBuiltin *const p = &_cmd_builtin_list[i];
+	const CmdTable *const t = &_cmd_table;
+	for (int i = 0; i < t->list_len; i++) {
+		const CmdBuiltin *const p = &t->list[i];
 		if (CSTR_IS_EMPTY_OR(p->name, p->description) || (p->callback_fn == NULL))
 			continue;
 
@@ -154,6 +334,213 @@ _register_builtin(void)
 }
 
 
+static uint32_t
+_builtin_hash(const char name[], uint32_t seed)
+{
+	const uint64_t hash = fnv1a_cstr(FNV1A_INIT ^ seed, name, 1);
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+
+static int
+_builtin_hash_build(void)
+{
+	CmdTable *const t = &_cmd_table;
+	const uint32_t mask = _CMD_BUILTIN_HASH_SIZE - 1;
+	for (uint32_t seed = 0; seed < _CMD_BUILTIN_HASH_TRIES; seed++) {
+		memset(t->hash, 0xff, sizeof(t->hash));
+
+		int i = 0;
+		for (; i < t->list_len; i++) {
+			const CmdBuiltin *const p = &t->list[i];
+			if (CSTR_IS_EMPTY_OR(p->name, p->description) || (p->callback_fn == NULL))
+				continue;
+
+			const uint32_t slot = _builtin_hash(p->name, seed) & mask;
+			if (t->hash[slot] >= 0)
+				break;
+
+			t->hash[slot] = (int16_t)i;
+		}
+
+		if (i == t->list_len) {
+			LOG_INFO("cmd", "builtin hash: seed: %" PRIu32, seed);
+			t->hash_seed = seed;
+			return 0;
+		}
+	}
+
+	LOG_ERRN("cmd", "%s", "builtin hash: no collision-free seed found");
+	return -1;
+}
+
+
+/* ret: -1: not a builtin command */
+static int
+_builtin_hash_find(const char name[])
+{
+	const CmdTable *const t = &_cmd_table;
+	const uint32_t slot = _builtin_hash(name, t->hash_seed) & (_CMD_BUILTIN_HASH_SIZE - 1);
+	const int index = t->hash[slot];
+	if (index < 0)
+		return -1;
+
+	if (cstr_casecmp(t->list[index].name, name) == 0)
+		return -1;
+
+	return index;
+}
+
+
+static void
+_plugin_load_all(CmdTable *t)
+{
+	struct dirent **list;
+	const int len = scandir(t->plugin_dir, &list, _plugin_filter, alphasort);
+	if (len < 0) {
+		if (errno != ENOENT)
+			LOG_ERRP("cmd", "scandir: '%s'", t->plugin_dir);
+
+		return;
+	}
+
+	for (int i = 0; i < len; i++) {
+		_plugin_load(t, list[i]->d_name);
+		free(list[i]);
+	}
+
+	free(list);
+	LOG_INFO("cmd", "loaded %d plugin(s)", t->plugins_len);
+}
+
+
+static void
+_plugin_unload_all(CmdTable *t)
+{
+	for (int i = t->plugins_len - 1; i >= 0; i--) {
+		const CmdPluginItem *const item = &t->plugins[i];
+		if (item->plugin->deinit_fn != NULL)
+			item->plugin->deinit_fn();
+
+		dlclose(item->handle);
+	}
+
+	t->plugins_len = 0;
+	t->list_len = (int)LEN(_cmd_builtin_list);
+}
+
+
+static int
+_plugin_filter(const struct dirent *d)
+{
+	const char *const ext = strrchr(d->d_name, '.');
+	if (ext == NULL)
+		return 0;
+
+	return strcmp(ext, ".so") == 0;
+}
+
+
+/*
+ * A replaced plugin has to be a new file (mv), not overwritten in place: dlopen() maps it.
+ */
+static int
+_plugin_load(CmdTable *t, const char file_name[])
+{
+	char path[CFG_CMD_PLUGIN_DIR_SIZE + 256];
+	const int ret = snprintf(path, LEN(path), "%s/%s", t->plugin_dir, file_name);
+	if ((ret < 0) || ((size_t)ret >= LEN(path))) {
+		LOG_ERRN("cmd", "plugin: '%s': path is too long", file_name);
+		return -1;
+	}
+
+	if (t->plugins_len == CFG_CMD_PLUGINS_SIZE) {
+		LOG_ERRN("cmd", "plugin: '%s': too many plugins! Max: %d", path, CFG_CMD_PLUGINS_SIZE);
+		return -1;
+	}
+
+	void *const handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		LOG_ERRN("cmd", "plugin: dlopen: %s", dlerror());
+		return -1;
+	}
+
+	const int list_len = t->list_len;
+	const CmdPlugin *const p = dlsym(handle, CMD_PLUGIN_SYMBOL);
+	if (p == NULL) {
+		LOG_ERRN("cmd", "plugin: '%s': no '%s' symbol", path, CMD_PLUGIN_SYMBOL);
+		goto err0;
+	}
+
+	if ((p->version != CMD_PLUGIN_VERSION) || (p->param_size != sizeof(CmdParam))) {
+		LOG_ERRN("cmd", "plugin: '%s': incompatible version: %d", path, p->version);
+		goto err0;
+	}
+
+	if ((p->list == NULL) || (p->list_len <= 0)) {
+		LOG_ERRN("cmd", "plugin: '%s': empty command list", path);
+		goto err0;
+	}
+
+	if (p->list_len > ((int)LEN(t->list) - list_len)) {
+		LOG_ERRN("cmd", "plugin: '%s': too many commands! Max: %d", path, CFG_CMD_PLUGIN_CMDS_SIZE);
+		goto err0;
+	}
+
+	for (int i = 0; i < p->list_len; i++) {
+		if (_plugin_verify_cmd(t, &p->list[i], path) < 0)
+			goto err1;
+
+		t->list[t->list_len++] = p->list[i];
+	}
+
+	if ((p->init_fn != NULL) && (p->init_fn() < 0)) {
+		LOG_ERRN("cmd", "plugin: '%s': init_fn: failed", path);
+		goto err1;
+	}
+
+	t->plugins[t->plugins_len++] = (CmdPluginItem) { .handle = handle, .plugin = p };
+	LOG_INFO("cmd", "plugin: '%s': %s: %d cmd(s)", path, p->name, p->list_len);
+	return 0;
+
+err1:
+	t->list_len = list_len;
+err0:
+	dlclose(handle);
+	return -1;
+}
+
+
+static int
+_plugin_verify_cmd(const CmdTable *t, const CmdBuiltin *p, const char path[])
+{
+	if (CSTR_IS_EMPTY_OR(p->name, p->description) || (p->callback_fn == NULL)) {
+		LOG_ERRN("cmd", "plugin: '%s': invalid command", path);
+		return -1;
+	}
+
+	for (int i = 0; i < t->list_len; i++) {
+		const char *const name = t->list[i].name;
+		if ((name != NULL) && cstr_casecmp(name, p->name)) {
+			LOG_ERRN("cmd", "plugin: '%s': '%s': already registered", path, p->name);
+			return -1;
+		}
+	}
+
+	if (model_cmd_message_is_exists(p->name)) {
+		LOG_ERRN("cmd", "plugin: '%s': '%s': already registered as CMD Message", path, p->name);
+		return -1;
+	}
+
+	if (model_cmd_extern_is_exists(p->name)) {
+		LOG_ERRN("cmd", "plugin: '%s': '%s': already registered as Extern CMD", path, p->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+
 static int
 _parse_cmd(CmdParam *c, const char req[])
 {
@@ -233,52 +620,74 @@ _session_release(const CmdParam *param)
 
 
 static int
-_exec_builtin(const CmdParam *c, int chat_flags)
+_exec_builtin(const CmdParam *c)
 {
-	const int index = model_cmd_builtin_get_index(c->name);
-	if (index == -2)
-		return 0;
+	CmdTable *const t = &_cmd_table;
+	_cmd_table_enter(t);
 
-	if (is_index_valid(index, LEN(_cmd_builtin_list)) == 0) {
-		SEND_ERROR_TEXT(c->msg, NULL, "%s", "Failed to get builtin command data!");
-		return 1;
+	int ret = 0;
+	const int index = _builtin_hash_find(c->name);
+	if (index < 0)
+		goto out0;
+
+	ret = 1;
+	const CmdBuiltin *const handler = &t->list[index];
+	const int chat_flags = model_chat_get_flags(c->id_chat);
+	if (chat_flags < 0) {
+		SEND_ERROR_TEXT(c->msg, NULL, "%s", "Failed to get chat flags!");
+		goto out0;
 	}
 
-	const CmdBuiltin *const handler = &_cmd_builtin_list[index];
 	if (_verify(c, chat_flags, handler->flags) == 0)
-		return 1;
+		goto out0;
 
 	LOG_INFO("cmd", "[%" PRIi64 ":%" PRIi64 ":%" PRIi64 "]: %s: %p",
 		 c->id_chat, c->id_user, c->id_message, handler->name, handler->callback_fn);
 
 	handler->callback_fn(c);
-	return 1;
+
+out0:
+	_cmd_table_leave(t);
+	return ret;
 }
 
 
 static int
-_exec_extern(const CmdParam *c, int chat_flags)
+_exec_extern(const CmdParam *c, const ModelCmdResolve *r)
 {
-	ModelCmdExtern ce;
-	const int ret = model_cmd_extern_get(&ce, c->name);
-	if (ret < 0) {
-		SEND_ERROR_TEXT(c->msg, NULL, "%s", "Failed to get external command data!");
-		return 1;
-	}
-
-	if (ret == 0)
+	if (r->has_extern == 0)
 		return 0;
 
+	const int chat_flags = r->chat_flags;
 	if ((chat_flags & MODEL_CHAT_FLAG_ALLOW_CMD_EXTERN) == 0)
 		return 1;
 
-	if (_verify(c, chat_flags, ce.flags) == 0)
+	const ModelCmdExtern *const ce = &r->cmd_extern;
+	if (_verify(c, chat_flags, ce->flags) == 0)
 		return 1;
 
 	LOG_INFO("cmd", "[%" PRIi64 ":%" PRIi64 ":%" PRIi64 "]: %s: %s",
-		 c->id_chat, c->id_user, c->id_message, ce.name, ce.file_name);
+		 c->id_chat, c->id_user, c->id_message, ce->name, ce->file_name);
+
+	/* the same command and arguments from any chat: answered from the cache, nothing is spawned */
+	const char *cache_key = NULL;
+	char key[MODEL_CMD_EXTERN_RESULT_KEY_SIZE];
+	if ((ce->flags & MODEL_CMD_FLAG_EXTERN_CACHE) && (c->id_callback == NULL) &&
+	    ((ce->flags & MODEL_CMD_FLAG_EXTERN_WORKER) == 0) &&
+	    (model_cmd_extern_result_key(key, LEN(key), ce->name, c->args) == 0)) {
+		if (_exec_extern_cached(c, key) == 0)
+			return 1;
+
+		cache_key = key;
+	}
 
-	if (_spawn_child_process(c, chat_flags, ce.file_name) < 0) {
+	int ret;
+	if (ce->flags & MODEL_CMD_FLAG_EXTERN_WORKER)
+		ret = _send_worker_request(c, chat_flags, ce);
+	else
+		ret = _spawn_child_process(c, chat_flags, ce, cache_key);
+
+	if (ret < 0) {
 		SEND_ERROR_TEXT(c->msg, NULL, "%s", "Failed to execute external command!");
 		return 1;
 	}
@@ -288,25 +697,15 @@ _exec_extern(const CmdParam *c, int chat_flags)
 
 
 static int
-_exec_cmd_message(const CmdParam *c)
+_exec_cmd_message(const CmdParam *c, const ModelCmdResolve *r)
 {
-	if (c->id_callback != NULL)
-		return 0;
-
-	char value[MODEL_CMD_MESSAGE_VALUE_SIZE];
-	const int ret = model_cmd_message_get_value(c->id_chat, c->name, value, LEN(value));
-	if (ret < 0) {
-		SEND_ERROR_TEXT(c->msg, NULL, "%s", "Failed to get command message data!");
-		return 1;
-	}
-
-	if (ret == 0)
+	if ((c->id_callback != NULL) || (r->has_message == 0))
 		return 0;
 
 	LOG_INFO("cmd", "[%" PRIi64 ":%" PRIi64 ":%" PRIi64 "]: %s", c->id_chat, c->id_user,
 		 c->msg->id, c->name);
 
-	send_text_plain(c->msg, NULL, value);
+	send_text_plain(c->msg, NULL, r->message);
 	return 1;
 }
 
@@ -345,9 +744,52 @@ _verify(const CmdParam *c, int chat_flags, int flags)
 }
 
 
+/* ret: 0: answered, -1: miss or failed */
+static int
+_exec_extern_cached(const CmdParam *c, const char key[])
+{
+	char type[MODEL_CMD_EXTERN_RESULT_TYPE_SIZE];
+	char *const data_str = model_cmd_extern_result_get(key, type, LEN(type));
+	if (data_str == NULL)
+		return -1;
+
+	int ret = -1;
+	json_object *const data = json_tokener_parse(data_str);
+	json_object *const resp = json_object_new_object();
+	if ((data == NULL) || (resp == NULL))
+		goto out0;
+
+	/* the reply goes to this chat: the rest of the request is replayed as is */
+	json_object *obj;
+	json_object_object_add(data, "chat_id", json_object_new_int64(c->id_chat));
+	json_object_object_add(data, "user_id", json_object_new_int64(c->id_user));
+	if (json_object_object_get_ex(data, "message_id", &obj) && (json_object_get_int64(obj) != 0))
+		json_object_object_add(data, "message_id", json_object_new_int64(c->id_message));
+
+	const RpcReq req = {
+		.type = type,
+		.name = c->name,
+		.proc = "cache",
+		.data = data,
+		.resp = resp,
+	};
+
+	ret = rpc_exec(&req);
+	LOG_INFO("cmd", "[%" PRIi64 ":%" PRIi64 ":%" PRIi64 "]: %s: cached: %d", c->id_chat, c->id_user,
+		 c->id_message, key, ret);
+
+out0:
+	json_object_put(resp);
+	json_object_put(data);
+	free(data_str);
+	return (ret == 0)? 0 : -1;
+}
+
+
 static int
-_spawn_child_process(const CmdParam *c, int chat_flags, const char file_name[])
+_spawn_child_process(const CmdParam *c, int chat_flags, const ModelCmdExtern *ce, const char cache_key[])
 {
+	const char *const file_name = ce->file_name;
 	const int is_callback = (c->id_callback != NULL);
 
 	/* +4 = (executable file + command name + flag(CMD/CALLBACK) + NULL) */
@@ -382,7 +824,79 @@ _spawn_child_process(const CmdParam *c, int chat_flags, const char file_name[])
 		argv[i++] = (char *)c->msg->text.cstr;
 	}
 
-	argv[i] = (char *)json_object_to_json_string(c->json);
+	/* the raw update goes to stdin as is: no re-serialization, no ARG_MAX, not in /proc/<pid>/cmdline */
+	size_t raw_len = c->raw_len;
+	const char *raw = c->raw;
+	if (raw == NULL)
+		raw = json_object_to_json_string_length(c->json, JSON_C_TO_STRING_PLAIN, &raw_len);
+
+	const int fd = file_memfd_sealed("kvrt_update", raw, raw_len);
+	if (fd < 0) {
+		LOG_ERR(fd, "cmd", "%s", "file_memfd_sealed");
+		return -1;
+	}
+
+	argv[i] = "0";
+
+	const ChldParam param = {
+		.file = file_name,
+		.argv = argv,
+		.stdin_fd = fd,
+		.chat_id = c->id_chat,
+		.msg_id = c->id_message,
+		.timeout_s = ce->timeout_s,
+		.cpu_s = ce->cpu_s,
+		.mem_mb = ce->mem_mb,
+		.cgroup = ce->cgroup,
+		/* the server caches the reply sent from its process group, see: rpc_serve() */
+		.tag = cache_key,
+	};
+
+	const int ret = chld_spawn(&param);
+	close(fd);
+	return ret;
+}
+
+
+static int
+_send_worker_request(const CmdParam *c, int chat_flags, const ModelCmdExtern *ce)
+{
+	json_object *const req = json_object_new_object();
+	if (req == NULL)
+		return -1;
+
+	const int is_callback = (c->id_callback != NULL);
+	json_object_object_add(req, "type", json_object_new_string((is_callback)? "callback" : "cmd"));
+	json_object_object_add(req, "name", json_object_new_string(c->name));
+	json_object_object_add(req, "chat_flags", json_object_new_int(chat_flags));
+	json_object_object_add(req, "chat_id", json_object_new_int64(c->id_chat));
+	json_object_object_add(req, "user_id", json_object_new_int64(c->id_user));
+	json_object_object_add(req, "message_id", json_object_new_int64(c->id_message));
+	if (is_callback) {
+		json_object_object_add(req, "callback_id", json_object_new_string(c->id_callback));
+		json_object_object_add(req, "args", json_object_new_string(c->args));
+	} else {
+		json_object_object_add(req, "text", json_object_new_string(c->msg->text.cstr));
+	}
+
+	json_object_object_add(req, "update", json_object_get(c->json));
+
+	size_t len;
+	const char *const str = json_object_to_json_string_length(req, JSON_C_TO_STRING_PLAIN, &len);
+	const ChldParam param = {
+		.file = ce->file_name,
+		.chat_id = c->id_chat,
+		.msg_id = c->id_message,
+		.timeout_s = ce->timeout_s,
+		.cpu_s = ce->cpu_s,
+		.mem_mb = ce->mem_mb,
+		.cgroup = ce->cgroup,
+	};
+
+	int ret = -1;
+	if (str != NULL)
+		ret = chld_worker_send(&param, c->name, str, len);
 
-	return chld_spawn(file_name, argv);
+	json_object_put(req);
+	return ret;
 }
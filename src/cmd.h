@@ -17,9 +17,12 @@ typedef struct cmd_param {
 	int64_t          id_chat;
 	int64_t          id_message;
 	const char      *id_callback;	/* NULL: not a callback */
+	Arena           *arena;
 	const char      *bot_username;
 	const TgMessage *msg;
 	json_object     *json;
+	const char      *raw;		/* raw update JSON, NULL: serialized from 'json' */
+	size_t           raw_len;
 
 	/* filled by cmd_exec() */
 	int         has_username;
@@ -27,8 +30,11 @@ typedef struct cmd_param {
 	const char *args;
 } CmdParam;
 
-int  cmd_init(void);
+int  cmd_init(const char plugin_dir[]);
+void cmd_deinit(void);
+int  cmd_reload_plugins(void);
 void cmd_exec(CmdParam *c, const char req[]);
+void cmd_reply_dropped(void);
 int  cmd_get_list(ModelCmd cmd_list[], int len, PagerList *list, int flags, int is_private);
 
 
@@ -40,6 +46,35 @@ typedef struct cmd_builtin {
 } CmdBuiltin;
 
 
+/*
+ * CmdPlugin: a shared object (*.so) in Config.cmd_plugin_dir, loaded at startup and on SIGHUP
+ * A reload waits for the running builtin callbacks, new ones wait for the reload: keep them short.
+ *
+ * It exports CMD_PLUGIN_SYMBOL and may call the bot's own functions (cmd.h, common.h, tg_api.h, ...).
+ * e.g.
+ *	static const CmdBuiltin _list[] = { { .name = "/hot", .description = "...", .callback_fn = _hot } };
+ *	const CmdPlugin kvrt_cmd_plugin = {
+ *		.version = CMD_PLUGIN_VERSION,
+ *		.param_size = sizeof(CmdParam),
+ *		.name = "hot",
+ *		.list = _list,
+ *		.list_len = LEN(_list),
+ *	};
+ */
+#define CMD_PLUGIN_VERSION (1)
+#define CMD_PLUGIN_SYMBOL  "kvrt_cmd_plugin"
+
+typedef struct cmd_plugin {
+	int               version;		/* CMD_PLUGIN_VERSION */
+	size_t            param_size;		/* sizeof(CmdParam) */
+	const char       *name;
+	const CmdBuiltin *list;
+	int               list_len;
+	int              (*init_fn)(void);	/* optional, ret: 0: success */
+	void             (*deinit_fn)(void);	/* optional */
+} CmdPlugin;
+
+
 /*
  * Handlers
  */
@@ -23,11 +23,11 @@ static const char *const _anime_sched_filters[] = {
 
 static int   _anime_sched_prep_filter(const char filter[], const char *res[]);
 static int   _anime_sched_check_cache(const char filter[]);
-static int   _anime_sched_fetch(const char filter[], int show_nsfw, char *err_msg[]);
-static int   _anime_sched_parse(ModelAnimeSched *list[], const char filter[], json_object *obj,
-				char *err_msg[]);
+static int   _anime_sched_fetch(Arena *a, const char filter[], int show_nsfw, const char *err_msg[]);
+static int   _anime_sched_parse(Arena *a, ModelAnimeSched *list[], const char filter[],
+				json_object *obj, const char *err_msg[]);
 static void  _anime_sched_parse_list(json_object *list_obj, char *out[]);
-static char *_anime_sched_build_body(const ModelAnimeSched list[], int len, int start);
+static char *_anime_sched_build_body(Arena *a, const ModelAnimeSched list[], int len, int start);
 
 
 /*
@@ -49,7 +49,6 @@ cmd_extra_anime_sched(const CmdParam *cmd)
 	if (pager_init(&pager, cmd->args) < 0)
 		return;
 
-	int err_msg_mutable = 0;
 	const char *filter;
 	if (_anime_sched_prep_filter(pager.udata, &filter) < 0) {
 		SEND_ERROR_TEXT_NOPE(cmd->msg, NULL, "%s",
@@ -64,14 +63,10 @@ cmd_extra_anime_sched(const CmdParam *cmd)
 		const int cflags = model_chat_get_flags(cmd->id_chat);
 		const int show_nsfw = (cflags > 0)? (cflags & MODEL_CHAT_FLAG_ALLOW_CMD_NSFW) : 0;
 
-		char *_err_msg = NULL;
-		if (_anime_sched_fetch(filter, show_nsfw, &_err_msg) < 0) {
-			if (_err_msg != NULL) {
-				err_msg_mutable = 1;
-				err_msg = _err_msg;
-			} else {
+		err_msg = NULL;
+		if (_anime_sched_fetch(cmd->arena, filter, show_nsfw, &err_msg) < 0) {
+			if (err_msg == NULL)
 				err_msg = "Failed to fetch anime list from the source!";
-			}
 
 			goto err0;
 		}
@@ -92,7 +87,7 @@ cmd_extra_anime_sched(const CmdParam *cmd)
 	pager_list_set(&pag_list, pager.page, len, llen, total);
 
 	const int start = MIN(((pager.page * len) - len), pag_list.items_size);
-	char *const body = _anime_sched_build_body(ma_list, llen, start);
+	char *const body = _anime_sched_build_body(cmd->arena, ma_list, llen, start);
 	if (body == NULL) {
 		err_msg = "Failed to build the list!";
 		goto err0;
@@ -100,11 +95,10 @@ cmd_extra_anime_sched(const CmdParam *cmd)
 
 	char buff[256];
 	const char *const chc_str = epoch_to_cstr_default(buff, LEN(buff), ma_list[0].created_at);
-	pager.title = CSTR_CONCAT("Anime Schedule: ", "\\(", filter, "\\)\n`Cache: ", chc_str, "`\n");
+	pager.title = arena_fmt(cmd->arena, "Anime Schedule: \\(%s\\)\n`Cache: %s`\n", filter, chc_str);
 	pager.body = body;
 
-	const int ret = pager_send(&pager, &pag_list, NULL);
-	free((char *)pager.title);
+	const int ret = (pager.title != NULL)? pager_send(&pager, &pag_list, NULL) : -1;
 	free(body);
 
 	if (ret >= 0)
@@ -115,9 +109,6 @@ err0:
 		SEND_ERROR_TEXT_NOPE(cmd->msg, NULL, "%s", err_msg);
 	else
 		answer_callback_text(cmd->id_callback, err_msg, 1);
-
-	if (err_msg_mutable)
-		free((char *)err_msg);
 }
 
 
@@ -177,10 +168,10 @@ _anime_sched_check_cache(const char filter[])
 
 
 static int
-_anime_sched_fetch(const char filter[], int show_nsfw, char *err_msg[])
+_anime_sched_fetch(Arena *a, const char filter[], int show_nsfw, const char *err_msg[])
 {
-	char *const req = cstr_fmt("%s?filter=%s&sfw=%s", _ANIME_SCHED_BASE_URL, filter,
-				   bool_to_cstr(!show_nsfw));
+	const char *const req = arena_fmt(a, "%s?filter=%s&sfw=%s", _ANIME_SCHED_BASE_URL, filter,
+					  bool_to_cstr(!show_nsfw));
 	if (req == NULL)
 		return -1;
 
@@ -194,7 +185,7 @@ _anime_sched_fetch(const char filter[], int show_nsfw, char *err_msg[])
 		goto out1;
 
 	ModelAnimeSched *list;
-	const int len = _anime_sched_parse(&list, filter, obj, err_msg);
+	const int len = _anime_sched_parse(a, &list, filter, obj, err_msg);
 	if (len < 0)
 		goto out2;
 
@@ -206,21 +197,18 @@ _anime_sched_fetch(const char filter[], int show_nsfw, char *err_msg[])
 		free((char *)list[i].demographics_in);
 	}
 
-	free(list);
-
 out2:
 	json_object_put(obj);
 out1:
 	free(res);
 out0:
-	free(req);
 	return ret;
 }
 
 
 static int
-_anime_sched_parse(ModelAnimeSched *list[], const char filter[], json_object *obj,
-		   char *err_msg[])
+_anime_sched_parse(Arena *a, ModelAnimeSched *list[], const char filter[], json_object *obj,
+		   const char *err_msg[])
 {
 	json_object *tmp_obj;
 
@@ -233,7 +221,7 @@ _anime_sched_parse(ModelAnimeSched *list[], const char filter[], json_object *ob
 		if (json_object_object_get_ex(obj, "message", &tmp_obj))
 			msg = json_object_get_string(tmp_obj);
 
-		*err_msg = cstr_fmt("%d: %s", status, msg);
+		*err_msg = arena_fmt(a, "%d: %s", status, msg);
 		return -1;
 	}
 
@@ -248,7 +236,7 @@ _anime_sched_parse(ModelAnimeSched *list[], const char filter[], json_object *ob
 	if (data_list_len >= INT_MAX)
 		data_list_len = INT_MAX - 1;
 
-	ModelAnimeSched *const items = malloc(sizeof(ModelAnimeSched) * data_list_len);
+	ModelAnimeSched *const items = arena_calloc(a, data_list_len, sizeof(ModelAnimeSched));
 	if (items == NULL)
 		return -1;
 
@@ -337,7 +325,7 @@ out0:
 
 
 static char *
-_anime_sched_build_body(const ModelAnimeSched list[], int len, int start)
+_anime_sched_build_body(Arena *a, const ModelAnimeSched list[], int len, int start)
 {
 	Str str;
 	if (str_init_alloc(&str, 1024, NULL) < 0)
@@ -346,7 +334,7 @@ _anime_sched_build_body(const ModelAnimeSched list[], int len, int start)
 	start++;
 	for (int i = 0; i < len; i++, start++) {
 		const ModelAnimeSched *const item = &list[i];
-		char *const title = tg_escape(item->title);
+		const char *const title = tg_escape_arena(a, item->title);
 		str_append_fmt(&str, "*%d\\. [%s](%s)*\n", start, cstr_empty_if_null(title),
 			       cstr_empty_if_null(item->url));
 
@@ -365,8 +353,6 @@ _anime_sched_build_body(const ModelAnimeSched list[], int len, int start)
 		str_append_fmt(&str, "Themes   : %s\n", cstr_empty_if_null(item->themes));
 		str_append_fmt(&str, "Dgraphics: %s\n", cstr_empty_if_null(item->demographics));
 		str_append_n(&str, "```\n", 4);
-
-		free(title);
 	}
 
 	str_pop(&str, 1);
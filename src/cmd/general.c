@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <math.h>
+#include <threads.h>
 
 #include "../cmd.h"
 #include "../common.h"
@@ -15,8 +16,34 @@ static const char *const _icon_extra  = "🎲";
 static const char *const _icon_extern = "📦";
 
 
+/*
+ * HelpCache: rendered /help pages, keyed by the flags that change the listing
+ */
+#define _HELP_CACHE_CHAT_FLAGS (MODEL_CHAT_FLAG_ALLOW_CMD_NSFW | MODEL_CHAT_FLAG_ALLOW_CMD_EXTERN |\
+				MODEL_CHAT_FLAG_ALLOW_CMD_EXTRA)
+#define _HELP_CACHE_KEYS       ((_HELP_CACHE_CHAT_FLAGS + 1) * 2)
+
+typedef struct help_cache_set {
+	unsigned  items_size;
+	unsigned  page_size;
+	char     *pages[];
+} HelpCacheSet;
+
+typedef struct help_cache {
+	int           is_ready;
+	mtx_t         mutex;
+	int64_t       version;	/* Cmd_Version */
+	HelpCacheSet *sets[_HELP_CACHE_KEYS];
+} HelpCache;
+
+static HelpCache _help_cache;
+static once_flag _help_cache_once = ONCE_FLAG_INIT;
+
+
+static char *_cmd_list_page(PagerList *list, int flags, int is_private_chat);
 static char *_cmd_list_body(const ModelCmd list[], unsigned len, int flags,
 			    int is_private_chat);
+static char *_help_cache_get(PagerList *list, int flags, int is_private_chat);
 
 
 /*
@@ -58,16 +85,13 @@ cmd_general_help(const CmdParam *cmd)
 		return;
 	}
 
-	ModelCmd cmd_list[CFG_LIST_ITEMS_SIZE];
 	PagerList list = { .page_num = pager.page };
-	if (cmd_get_list(cmd_list, LEN(cmd_list), &list, cflags, is_private_chat) < 0) {
-		SEND_ERROR_TEXT(cmd->msg, NULL, "%s", "Failed to get 'cmd' list!");
-		return;
-	}
+	char *body = _help_cache_get(&list, cflags, is_private_chat);
+	if (body == NULL)
+		body = _cmd_list_page(&list, cflags, is_private_chat);
 
-	char *const body = _cmd_list_body(cmd_list, list.items_len, cflags, is_private_chat);
 	if (body == NULL) {
-		SEND_ERROR_TEXT(cmd->msg, NULL, "%s", "Failed to allocate memory!");
+		SEND_ERROR_TEXT(cmd->msg, NULL, "%s", "Failed to get 'cmd' list!");
 		return;
 	}
 
@@ -108,16 +132,16 @@ cmd_general_list_admin(const CmdParam *cmd)
 
 	for (unsigned i = 0; i < list.len; i++) {
 		const TgChatAdmin *const adm = &list.list[i];
-		str_append_fmt(&str, "%d. %s %s\n", i + 1, adm->user->first_name,
-			       cstr_empty_if_null(adm->user->last_name));
-		str_append_fmt(&str, "    Id        : %" PRIi64 "\n", adm->user->id);
-		str_append_fmt(&str, "    First name: %s\n", adm->user->first_name);
+		str_append_fmt(&str, "%d. %s %s\n", i + 1, adm->user.first_name,
+			       cstr_empty_if_null(adm->user.last_name));
+		str_append_fmt(&str, "    Id        : %" PRIi64 "\n", adm->user.id);
+		str_append_fmt(&str, "    First name: %s\n", adm->user.first_name);
 
-		if (adm->user->username != NULL)
-			str_append_fmt(&str, "    Username  : @%s\n", adm->user->username);
+		if (adm->user.username != NULL)
+			str_append_fmt(&str, "    Username  : @%s\n", adm->user.username);
 
-		str_append_fmt(&str, "    Is bot    : %s\n", bool_to_cstr(adm->user->is_bot));
-		str_append_fmt(&str, "    Is premium: %s\n", bool_to_cstr(adm->user->is_premium));
+		str_append_fmt(&str, "    Is bot    : %s\n", bool_to_cstr(adm->user.is_bot));
+		str_append_fmt(&str, "    Is premium: %s\n", bool_to_cstr(adm->user.is_premium));
 		str_append_fmt(&str, "    Is anon   : %s\n", bool_to_cstr(adm->is_anonymous));
 		if (adm->custom_title != NULL)
 			str_append_fmt(&str, "    Title     : %s\n\n", adm->custom_title);
@@ -253,7 +277,7 @@ cmd_general_report(const CmdParam *cmd)
 	}
 
 	Str str;
-	char *const reason = tg_escape(st.value);
+	const char *const reason = tg_escape_arena(cmd->arena, st.value);
 	if (reason == NULL) {
 		SEND_ERROR_TEXT(msg, NULL, "%s", "Internal error!");
 		return;
@@ -261,35 +285,29 @@ cmd_general_report(const CmdParam *cmd)
 
 	if (str_init_alloc(&str, 1024, "Report: \"%s\"\n", reason) < 0) {
 		SEND_ERROR_TEXT(msg, NULL, "%s", "Internal error!");
-		free(reason);
 		return;
 	}
 
-	free(reason);
-
 	int j = 1;
 	for (int i = 0; i < ret; i++) {
 		const ModelAdmin *const adm = &list[i];
 		if (adm->is_bot)
 			continue;
 
-		char *const fname = tg_escape(adm->first_name);
+		const char *const fname = tg_escape_arena(cmd->arena, adm->first_name);
 		if (fname == NULL)
 			continue;
 
 		str_append_fmt(&str, "%d\\. [%s](tg://user?id=%" PRIi64 ")\n", j, fname, adm->user_id);
-
-		free(fname);
 		j++;
 	}
 
 	str_pop(&str, 1);
 
 	{
-		char *const fname = tg_escape(msg->from->first_name);
+		const char *const fname = tg_escape_arena(cmd->arena, msg->from->first_name);
 		str_append_fmt(&str, "\n\n\\-\\-\\-\nReported by: [%s](tg://user?id=%" PRIi64 ")",
 			       fname, msg->from->id);
-		free(fname);
 	}
 
 
@@ -350,6 +368,17 @@ cmd_general_deleter(const CmdParam *cmd)
 /*
  * Private
  */
+static char *
+_cmd_list_page(PagerList *list, int flags, int is_private_chat)
+{
+	ModelCmd cmd_list[CFG_LIST_ITEMS_SIZE];
+	if (cmd_get_list(cmd_list, LEN(cmd_list), list, flags, is_private_chat) < 0)
+		return NULL;
+
+	return _cmd_list_body(cmd_list, list->items_len, flags, is_private_chat);
+}
+
+
 static char *
 _cmd_list_body(const ModelCmd list[], unsigned len, int flags, int is_private_chat)
 {
@@ -410,3 +439,146 @@ err0:
 	str_deinit(&str);
 	return NULL;
 }
+
+
+static void
+_help_cache_init(void)
+{
+	if (mtx_init(&_help_cache.mutex, mtx_plain) != thrd_success) {
+		LOG_ERRN("general", "%s", "mtx_init: failed");
+		return;
+	}
+
+	_help_cache.version = -1;
+	_help_cache.is_ready = 1;
+}
+
+
+static void
+_help_cache_set_free(HelpCacheSet *set)
+{
+	if (set == NULL)
+		return;
+
+	for (unsigned i = 0; i < set->page_size; i++)
+		free(set->pages[i]);
+
+	free(set);
+}
+
+
+/* renders every page of one listing: one query per page */
+static HelpCacheSet *
+_help_cache_set_build(int flags, int is_private_chat)
+{
+	PagerList list = { .page_num = 1 };
+	char *const first = _cmd_list_page(&list, flags, is_private_chat);
+	if (first == NULL)
+		return NULL;
+
+	/* nothing to list: not cached */
+	if (list.page_size == 0) {
+		free(first);
+		return NULL;
+	}
+
+	HelpCacheSet *const set = calloc(1, sizeof(HelpCacheSet) + (sizeof(char *) * list.page_size));
+	if (set == NULL) {
+		free(first);
+		return NULL;
+	}
+
+	set->items_size = list.items_size;
+	set->page_size = list.page_size;
+	set->pages[0] = first;
+	for (unsigned i = 1; i < set->page_size; i++) {
+		list = (PagerList) { .page_num = i + 1 };
+		set->pages[i] = _cmd_list_page(&list, flags, is_private_chat);
+		if (set->pages[i] == NULL)
+			goto err0;
+
+		/* the registry changed in the middle */
+		if (list.items_size != set->items_size)
+			goto err0;
+	}
+
+	return set;
+
+err0:
+	_help_cache_set_free(set);
+	return NULL;
+}
+
+
+static char *
+_help_cache_page(const HelpCacheSet *set, PagerList *list)
+{
+	const unsigned page = list->page_num;
+	if ((page == 0) || (page > set->page_size))
+		return NULL;
+
+	char *const body = strdup(set->pages[page - 1]);
+	if (body == NULL)
+		return NULL;
+
+	const unsigned offt = (page - 1) * CFG_LIST_ITEMS_SIZE;
+	pager_list_set(list, page, CFG_LIST_ITEMS_SIZE, MIN(CFG_LIST_ITEMS_SIZE, set->items_size - offt),
+		       set->items_size);
+	return body;
+}
+
+
+/* ret: NULL: not cached, fall back to _cmd_list_page() */
+static char *
+_help_cache_get(PagerList *list, int flags, int is_private_chat)
+{
+	call_once(&_help_cache_once, _help_cache_init);
+	if (_help_cache.is_ready == 0)
+		return NULL;
+
+	int64_t version;
+	if (model_cmd_get_version(&version) < 0)
+		return NULL;
+
+	const int index = ((flags & _HELP_CACHE_CHAT_FLAGS) << 1) | (is_private_chat != 0);
+	char *body = NULL;
+
+	mtx_lock(&_help_cache.mutex);
+
+	if (_help_cache.version != version) {
+		for (int i = 0; i < _HELP_CACHE_KEYS; i++) {
+			_help_cache_set_free(_help_cache.sets[i]);
+			_help_cache.sets[i] = NULL;
+		}
+
+		_help_cache.version = version;
+	}
+
+	if (_help_cache.sets[index] != NULL) {
+		body = _help_cache_page(_help_cache.sets[index], list);
+		mtx_unlock(&_help_cache.mutex);
+		return body;
+	}
+
+	mtx_unlock(&_help_cache.mutex);
+
+	/* outside the mutex: /help in the other chats doesn't wait for the queries */
+	HelpCacheSet *set = _help_cache_set_build(flags, is_private_chat);
+	if (set == NULL)
+		return NULL;
+
+	body = _help_cache_page(set, list);
+
+	mtx_lock(&_help_cache.mutex);
+
+	/* another reader was first, or the registry changed meanwhile: only good for this reply */
+	if ((_help_cache.version == version) && (_help_cache.sets[index] == NULL)) {
+		_help_cache.sets[index] = set;
+		set = NULL;
+	}
+
+	mtx_unlock(&_help_cache.mutex);
+
+	_help_cache_set_free(set);
+	return body;
+}
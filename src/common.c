@@ -10,6 +10,7 @@
 
 #include "config.h"
 #include "model.h"
+#include "session.h"
 #include "tg_api.h"
 #include "util.h"
 
@@ -20,6 +21,8 @@ static int   _pager_delete(const Pager *p, int64_t user_id);
 static char *_pager_add_body(const Pager *p, const PagerList *list);
 static int   _pager_send(const Pager *p, const TgApiMarkupKbd *kbd, const char body[], int64_t *ret_id);
 
+static const char *const _tg_escape_chars = "_*[]()~`>#+-|{}.!";
+
 
 /*
  * tg_api wrappers
@@ -277,7 +280,14 @@ is_admin(int64_t user_id, int64_t chat_id, int64_t owner_id)
 char *
 tg_escape(const char src[])
 {
-	return cstr_escape("_*[]()~`>#+-|{}.!", '\\', src);
+	return cstr_escape(_tg_escape_chars, '\\', src);
+}
+
+
+char *
+tg_escape_arena(Arena *a, const char src[])
+{
+	return arena_cstr_escape(a, _tg_escape_chars, '\\', src);
 }
 
 
@@ -299,9 +309,9 @@ admin_reload(const TgMessage *msg)
 		const TgChatAdmin *const adm = &admin_list.list[i];
 		db_admin_list[i] = (ModelAdmin) {
 			.chat_id = chat_id,
-			.user_id = adm->user->id,
-			.first_name_in = adm->user->first_name,
-			.is_bot = adm->user->is_bot,
+			.user_id = adm->user.id,
+			.first_name_in = adm->user.first_name,
+			.is_bot = adm->user.is_bot,
 			.is_anonymous = adm->is_anonymous,
 			.privileges = adm->privileges,
 		};
@@ -339,13 +349,12 @@ session_acquire(int64_t chat_id, int64_t user_id, const char ctx[])
 		return -1;
 	}
 
-	const ModelSessionCmd sess = {
-		.chat_id = chat_id,
-		.user_id = user_id,
-		.ctx = ctx,
-	};
+	if (session_table_is_ready() == 0) {
+		LOG_ERRN("common", "%s", "session table is not ready");
+		return -1;
+	}
 
-	return model_session_cmd_add(&sess);
+	return session_table_acquire(chat_id, user_id, ctx, MODEL_SESSION_CMD_DEF_EXP_S);
 }
 
 
@@ -367,13 +376,12 @@ session_release(int64_t chat_id, int64_t user_id, const char ctx[])
 		return -1;
 	}
 
-	const ModelSessionCmd sess = {
-		.chat_id = chat_id,
-		.user_id = user_id,
-		.ctx = ctx,
-	};
+	if (session_table_is_ready() == 0) {
+		LOG_ERRN("common", "%s", "session table is not ready");
+		return -1;
+	}
 
-	return model_session_cmd_delete(&sess);
+	return session_table_release(chat_id, user_id, ctx);
 }
 
 
@@ -38,6 +38,7 @@ char *new_deleter(int64_t user_id);
  */
 int   is_admin(int64_t user_id, int64_t chat_id, int64_t owner_id);
 char *tg_escape(const char src[]);
+char *tg_escape_arena(Arena *a, const char src[]);
 int   admin_reload(const TgMessage *msg);
 
 /* ret: 0: success, -1: error: -2: locked */
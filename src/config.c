@@ -22,6 +22,7 @@ static int  _parse_json_tg(Config *c, json_object *root_obj);
 static void _parse_json_sys(Config *c, json_object *root_obj);
 static void _parse_json_listen(Config *c, json_object *root_obj);
 static void _parse_json_cmd_extern(Config *c, json_object *root_obj);
+static void _parse_json_cmd_plugin(Config *c, json_object *root_obj);
 
 
 /*
@@ -88,6 +89,7 @@ config_dump(const Config *c)
 	printf("External cmd api           : %s\n", c->cmd_extern_api);
 	printf("External cmd root dir      : %s\n", c->cmd_extern_root_dir);
 	printf("External cmd log file      : %s\n", c->cmd_extern_log_file);
+	printf("Plugin cmd dir             : %s\n", c->cmd_plugin_dir);
 	puts("---[CONFIG]---");
 }
 
@@ -150,6 +152,7 @@ _parse_json(char buffer[], size_t size, const char path[])
 	_parse_json_sys(cfg, root_obj);
 	_parse_json_listen(cfg, root_obj);
 	_parse_json_cmd_extern(cfg, root_obj);
+	_parse_json_cmd_plugin(cfg, root_obj);
 
 	ret = file_write_all(path, buffer, &cfg_len);
 	if ((ret == 0) && (cfg_len != sizeof(*cfg))) {
@@ -443,3 +446,24 @@ out0:
 	cstr_copy_n(c->cmd_extern_root_dir, LEN(c->cmd_extern_root_dir), cmd_extern_root_dir);
 	cstr_copy_n(c->cmd_extern_log_file, LEN(c->cmd_extern_log_file), cmd_extern_log_file);
 }
+
+
+static void
+_parse_json_cmd_plugin(Config *c, json_object *root_obj)
+{
+	const char *cmd_plugin_dir = CFG_DEF_CMD_PLUGIN_DIR;
+
+	json_object *cmd_plugin_obj;
+	if (json_object_object_get_ex(root_obj, "cmd_plugin", &cmd_plugin_obj) == 0)
+		goto out0;
+
+	json_object *tmp_obj;
+	if (json_object_object_get_ex(cmd_plugin_obj, "dir", &tmp_obj) != 0) {
+		const char *const _dir = json_object_get_string(tmp_obj);
+		if (cstr_is_empty(_dir) == 0)
+			cmd_plugin_dir = _dir;
+	}
+
+out0:
+	cstr_copy_n(c->cmd_plugin_dir, LEN(c->cmd_plugin_dir), cmd_plugin_dir);
+}
@@ -17,6 +17,7 @@
 #define CFG_DEF_CMD_EXTERN_API            "./extern/api"
 #define CFG_DEF_CMD_EXTERN_ROOT_DIR       "./extern"
 #define CFG_DEF_CMD_EXTERN_LOG_FILE       "./extern/log.txt"
+#define CFG_DEF_CMD_PLUGIN_DIR            "./plugins"
 #define CFG_DEF_DB_MAIN_CONN_POOL_SIZE    (4)
 #define CFG_DEF_DB_SESSION_CONN_POOL_SIZE (2)
 #define CFG_DEF_DB_SCHED_CONN_POOL_SIZE   (2)
@@ -33,14 +34,79 @@
 #define CFG_LIST_TIMEOUT_S       (3600)
 #define CFG_CONNECTION_TIMEOUT_S (3)
 #define CFG_DB_WAIT              (1000)
+#define CFG_UPDATE_DEADLINE_MS   (10000)
+#define CFG_UPDATE_ARENA_SIZE    (1024 * 16)
+#define CFG_UPDATE_DEDUP_SIZE    (4096) /* must be a multiple of 64 */
+#define CFG_CMD_CACHE_SIZE       (512)
+#define CFG_CMD_CACHE_BUCKETS    (256)
+#define CFG_CMD_CACHE_CHECK_MS   (1000)
+#define CFG_CHAT_CACHE_SHARDS    (16)
+#define CFG_CHAT_CACHE_SIZE      (256) /* per shard */
+#define CFG_ADMIN_CACHE_SIZE     (256) /* chats */
+#define CFG_ADMIN_CACHE_TTL_S    (600)
+#define CFG_RESULT_CACHE_SIZE    (256)
+#define CFG_RESULT_CACHE_TTL_S   (300)
+#define CFG_SCHED_HEAP_SIZE      (64) /* initial, grows */
+#define CFG_SCHED_LOAD_SIZE      (256) /* rows per page on startup */
+#define CFG_SCHED_BATCH_SIZE     (64) /* due tasks per lock hold */
+#define CFG_SCHED_PURGE_SIZE     (256) /* expired rows per delete */
+#define CFG_SCHED_PURGE_BATCHES  (8) /* deletes per timer tick */
 #define CFG_CHLD_ITEMS_SIZE      (256)
 #define CFG_CHLD_ENVP_SIZE       (128)
+#define CFG_CHLD_WORKERS_SIZE    (32)
+#define CFG_CHLD_WORKER_PROCS    (2) /* per command */
+#define CFG_CHLD_WORKER_INFLIGHT (2) /* unacknowledged requests per process, then queued */
+#define CFG_CHLD_WORKER_WRITE_MS (1000)
+
+/* extern cmd scheduler: jobs over the limits wait in a FIFO queue */
+#define CFG_CHLD_RUNNING_MAX      (32)
+#define CFG_CHLD_RUNNING_PER_CMD  (8)
+#define CFG_CHLD_RUNNING_PER_CHAT (4)
+#define CFG_CHLD_QUEUE_SIZE       (128)
+#define CFG_CHLD_QUEUE_PER_CHAT   (16)
+#define CFG_CHLD_QUEUE_TIMEOUT_MS (30000)
+#define CFG_CHLD_NICE             (5) /* 0: disabled */
+#define CFG_CHLD_TIMEOUT_S        (120) /* Cmd_Extern_Limit.timeout_s: 0 */
+#define CFG_CHLD_KILL_GRACE_MS    (5000) /* SIGTERM -> SIGKILL */
+#define CFG_CHLD_WAIT_ALL_S       (10) /* on shutdown */
+#define CFG_CHLD_OUTPUT_SIZE      (8192) /* per invocation, the tail is kept */
+#define CFG_CHLD_OUTPUT_NAME_SIZE (64)
+#define CFG_CHLD_OUTPUT_HISTORY   (64) /* the last N invocations, see: chld_output_get() */
+#define CFG_CHLD_LOG_FLUSH_SIZE   (256 * 1024) /* unwritten output: flushed before the timer */
+#define CFG_CHLD_LOG_QUEUE_MAX    (16 * 1024 * 1024) /* then dropped: the log file is stuck */
+#define CFG_CHLD_LOG_SEGMENT_SIZE (4 * 1024 * 1024)
+#define CFG_CHLD_LOG_SEGMENTS     (4) /* log_file.1 ... log_file.N */
+
+/* cmd plugins */
+#define CFG_CMD_PLUGINS_SIZE     (16)
+#define CFG_CMD_PLUGIN_CMDS_SIZE (32) /* all plugins */
+
+/* session lock table */
+#define CFG_SESSION_TABLE_BUCKETS (1024)
+#define CFG_SESSION_TABLE_WAYS    (8)
+#define CFG_SESSION_TABLE_SUFFIX  "-locks"
+
+/* extern api rpc */
+#define CFG_RPC_SOCKET_SUFFIX "-rpc.sock"
+#define CFG_RPC_MSG_SIZE      (1024 * 1024)
+#define CFG_RPC_IO_TIMEOUT_MS (2000) /* a client writes its request at once: an rpc thread isn't held longer */
+#define CFG_RPC_WORKER_SIZE   (2) /* its own pool, the updates don't starve it, nor it them */
+
+/* http circuit breaker */
+#define CFG_HTTP_BREAKER_SIZE         (16)
+#define CFG_HTTP_BREAKER_WINDOW_S     (30)
+#define CFG_HTTP_BREAKER_MIN_REQUESTS (5)
+#define CFG_HTTP_BREAKER_FAIL_RATIO   (50) /* percent */
+#define CFG_HTTP_BREAKER_SLOW_MS      (3000)
+#define CFG_HTTP_BREAKER_OPEN_S       (30)
 
 #define CFG_ENV_API             "TG_API"
 #define CFG_ENV_ROOT_DIR        "TG_ROOT_DIR"
 #define CFG_ENV_DB_MAIN_FILE    "TG_DB_MAIN_FILE"
 #define CFG_ENV_DB_SESSION_FILE "TG_DB_SESSION_FILE"
 #define CFG_ENV_DB_SCHED_FILE   "TG_DB_SCHED_FILE"
+#define CFG_ENV_SESSION_FILE    "TG_SESSION_FILE"
+#define CFG_ENV_RPC_FILE        "TG_RPC_FILE"
 #define CFG_ENV_CONFIG_FILE     "TG_CONFIG_FILE"
 #define CFG_ENV_TELEGRAM_API    "TG_API_URL"
 #define CFG_ENV_OWNER_ID        "TG_OWNER_ID"
@@ -59,6 +125,7 @@
 #define CFG_CMD_EXTERN_API_SIZE      (4096)
 #define CFG_CMD_EXTERN_ROOT_DIR      (4096)
 #define CFG_CMD_EXTERN_LOG_FILE_SIZE (4096)
+#define CFG_CMD_PLUGIN_DIR_SIZE      (4096)
 
 
 typedef struct config {
@@ -83,6 +150,7 @@ typedef struct config {
 	char     cmd_extern_api[CFG_CMD_EXTERN_API_SIZE];
 	char     cmd_extern_root_dir[CFG_CMD_EXTERN_ROOT_DIR];
 	char     cmd_extern_log_file[CFG_CMD_EXTERN_LOG_FILE_SIZE];
+	char     cmd_plugin_dir[CFG_CMD_PLUGIN_DIR_SIZE];
 } Config;
 
 int  config_load(Config *c, const char path[]);
@@ -11,7 +11,9 @@
 #include <arpa/inet.h>
 #include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/timerfd.h>
+#include <sys/un.h>
 
 #include "ev.h"
 
@@ -29,6 +31,7 @@ static Ev _instance = { .fd = -1 };
 
 
 static void _signal_handler(EvCtx *c);
+static int  _listener_init(EvListener *e, int fd, void (*callback_fn)(void *, int), void *udata);
 static void _listener_handler(EvCtx *c);
 static void _timer_handler(EvCtx *c);
 
@@ -198,28 +201,46 @@ ev_listener_create(EvListener *e, const char host[], uint16_t port, void (*callb
 		return -1;
 	}
 
-	if (listen(fd, 32) < 0) {
-		LOG_ERRP("ev", "%s", "listen");
-		close(fd);
+	return _listener_init(e, fd, callback_fn, udata);
+}
+
+
+int
+ev_listener_create_unix(EvListener *e, const char path[], void (*callback_fn)(void *, int), void *udata)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (cstr_copy_n(addr.sun_path, LEN(addr.sun_path), path) != strlen(path)) {
+		LOG_ERRN("ev", "'%s': %s", path, "path is too long");
 		return -1;
 	}
 
-	*e = (EvListener) {
-		.callback_fn = callback_fn,
-		.udata = udata,
-		.ctx = (EvCtx) {
-			.fd = fd,
-			.callback_fn = _listener_handler,
-		},
-	};
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		LOG_ERRP("ev", "%s", "socket");
+		return -1;
+	}
 
-	const int ret = ev_ctx_add_in(&e->ctx);
-	if (ret < 0) {
-		LOG_ERR(ret, "ev", "%s", "ev_ctx_add_in");
+	/* stale socket file from the previous run */
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		LOG_ERRP("ev", "bind: '%s'", path);
 		close(fd);
 		return -1;
 	}
 
+	if (chmod(path, 0600) < 0) {
+		LOG_ERRP("ev", "chmod: '%s'", path);
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	if (_listener_init(e, fd, callback_fn, udata) < 0) {
+		unlink(path);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -295,10 +316,9 @@ _signal_handler(EvCtx *c)
 
 	switch (siginfo.ssi_signo) {
 	case SIGINT:
-		s->callback_fn(s->udata, siginfo.ssi_signo, 0);
-		break;
 	case SIGHUP:
 	case SIGCHLD:
+		s->callback_fn(s->udata, siginfo.ssi_signo, 0);
 		break;
 	default:
 		/* TODO */
@@ -307,6 +327,35 @@ _signal_handler(EvCtx *c)
 }
 
 
+static int
+_listener_init(EvListener *e, int fd, void (*callback_fn)(void *, int), void *udata)
+{
+	if (listen(fd, 32) < 0) {
+		LOG_ERRP("ev", "%s", "listen");
+		close(fd);
+		return -1;
+	}
+
+	*e = (EvListener) {
+		.callback_fn = callback_fn,
+		.udata = udata,
+		.ctx = (EvCtx) {
+			.fd = fd,
+			.callback_fn = _listener_handler,
+		},
+	};
+
+	const int ret = ev_ctx_add_in(&e->ctx);
+	if (ret < 0) {
+		LOG_ERR(ret, "ev", "%s", "ev_ctx_add_in");
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+
 static void
 _listener_handler(EvCtx *c)
 {
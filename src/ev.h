@@ -45,6 +45,7 @@ typedef struct ev_listener {
 
 int  ev_listener_create(EvListener *e, const char host[], uint16_t port, void (*callback_fn)(void *, int),
 		      void *udata);
+int  ev_listener_create_unix(EvListener *e, const char path[], void (*callback_fn)(void *, int), void *udata);
 void ev_listener_destroy(const EvListener *e);
 
 
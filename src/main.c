@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <json.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -10,14 +11,18 @@
 #include <unistd.h>
 
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include "config.h"
 #include "cmd.h"
 #include "ev.h"
 #include "model.h"
 #include "picohttpparser.h"
+#include "rpc.h"
 #include "sched.h"
+#include "session.h"
 #include "sqlite_pool.h"
+#include "tg.h"
 #include "tg_api.h"
 #include "thrd_pool.h"
 #include "update.h"
@@ -44,7 +49,9 @@ typedef struct server Server;
 
 typedef struct client {
 	Server      *parent;
-	json_object *body;
+	char        *body;		/* raw update, handed over to a worker */
+	int64_t      update_id;
+	int          is_body_valid;
 	size_t       body_len;
 	EvCtx        ctx;
 	DListNode    node;
@@ -75,11 +82,19 @@ typedef struct server_verif {
 	size_t hook_path_len;
 } ServerVerif;
 
+/* sliding window over the most recent update ids */
+typedef struct server_dedup {
+	int64_t  max_id;
+	uint64_t bits[CFG_UPDATE_DEDUP_SIZE / 64];
+} ServerDedup;
+
 typedef struct server {
 	const char *config_file;
 	Config      config;
 	ServerVerif verif;
+	ServerDedup dedup;
 	DList       clients;
+	ThrdPool    rpc_pool;	/* ./api requests: not behind the updates */
 } Server;
 
 static int  _server_init(Server *s, const char config_file[]);
@@ -90,11 +105,19 @@ static int  _server_run(Server *s, char *envp[]);
 static void _server_on_signal(void *udata, uint32_t signo, int err);
 static void _server_on_timer(void *udata, int err);
 static void _server_on_listener(void *udata, int fd);
+static void _server_on_rpc_listener(void *udata, int fd);
 
+static int  _server_is_update_seen(Server *s, int64_t id);
+static void _server_set_update_seen(Server *s, int64_t id);
 static int  _server_add_client(Server *s, int fd);
 static void _server_del_client(Server *s, Client *client);
 static void _server_handle_client(EvCtx *ctx);
 static void _server_handle_update(void *ctx, void *udata);
+static void _server_handle_rpc(void *ctx, void *udata);
+static void _server_handle_reload(void *ctx, void *udata);
+static void _server_handle_chld_output(void *ctx, void *udata);
+static void _server_handle_chld_dropped(void *ctx, void *udata);
+static void _server_handle_sched_purge(void *ctx, void *udata);
 static int  _server_timeout_clients(const DListNode *node, void *udata);
 
 
@@ -233,9 +256,9 @@ static int
 _client_state_resp(Client *c)
 {
 	int is_err = 1;
-	const char *const buff = (c->body != NULL)? CFG_HTTP_RESPONSE_OK : CFG_HTTP_RESPONSE_ERROR;
-	const size_t buff_len = (c->body != NULL)? sizeof(CFG_HTTP_RESPONSE_OK) - 1 :
-						   sizeof(CFG_HTTP_RESPONSE_ERROR) - 1;
+	const char *const buff = (c->is_body_valid)? CFG_HTTP_RESPONSE_OK : CFG_HTTP_RESPONSE_ERROR;
+	const size_t buff_len = (c->is_body_valid)? sizeof(CFG_HTTP_RESPONSE_OK) - 1 :
+						    sizeof(CFG_HTTP_RESPONSE_ERROR) - 1;
 
 	size_t sent = c->bytes;
 	const ssize_t sn = send(c->ctx.fd, buff + sent, buff_len - sent, 0);
@@ -261,7 +284,7 @@ _client_state_resp(Client *c)
 
 out0:
 	if (is_err) {
-		json_object_put(c->body);
+		free(c->body);
 		c->body = NULL;
 	}
 
@@ -390,15 +413,43 @@ _client_header_validate(const Client *c, const HttpRequest *req, size_t *content
 }
 
 
+/*
+ * Only peek at the raw body here: updates nobody handles are acknowledged without building a
+ * json_object tree, the rest is parsed by a worker.
+ */
 static void
 _client_body_parse(Client *c)
 {
-	enum json_tokener_error err;
-	json_object *const json = json_tokener_parse_verbose(c->buffer, &err);
-	if (json == NULL)
-		LOG_ERRN("main", "json_tokene_parse: %s", json_tokener_error_desc(err));
+	const size_t len = c->body_len;
+	c->buffer[len] = '\0';
+
+	TgUpdatePeek peek;
+	if (tg_update_peek(&peek, c->buffer, len) < 0) {
+		LOG_ERRN("main", "fd: %d: tg_update_peek: invalid update", c->ctx.fd);
+		return;
+	}
+
+	c->is_body_valid = 1;
+	if (_server_is_update_seen(c->parent, peek.id)) {
+		LOG_INFO("main", "update: %" PRIi64 ": duplicate, ignored", peek.id);
+		return;
+	}
+
+	if (peek.is_ignored) {
+		LOG_DEBUG("main", "update: %" PRIi64 ": %s: ignored", peek.id,
+			  tg_update_type_str(peek.type));
+		return;
+	}
+
+	char *const body = malloc(len + 1);
+	if (body == NULL) {
+		LOG_ERRP("main", "update: %" PRIi64 ": malloc", peek.id);
+		c->is_body_valid = 0;
+		return;
+	}
 
-	c->body = json;
+	c->body = memcpy(body, c->buffer, len + 1);
+	c->update_id = peek.id;
 }
 
 
@@ -426,6 +477,7 @@ _server_init(Server *s, const char config_file[])
 		return -1;
 
 	dlist_init(&s->clients);
+	memset(&s->dedup, 0, sizeof(s->dedup));
 
 	s->verif.api_secret_len = strlen(s->config.api_secret);
 	s->verif.hook_path_len = strlen(s->config.hook_path);
@@ -526,6 +578,29 @@ _server_init_chld(Server *s, const char api[], char *envp[])
 		goto err0;
 	}
 
+	const size_t db_session_file_len = strlen(db_session_file);
+	if ((db_session_file_len + sizeof(CFG_SESSION_TABLE_SUFFIX)) > sizeof(buffer)) {
+		LOG_ERRN("main", "%s", "session table path: too long");
+		goto err0;
+	}
+
+	memcpy(buffer + db_session_file_len, CFG_SESSION_TABLE_SUFFIX, sizeof(CFG_SESSION_TABLE_SUFFIX));
+	if (chld_add_env_kv(CFG_ENV_SESSION_FILE, buffer) < 0) {
+		LOG_ERRP("main", "%s: '%s'", "chld_add_env_kv", CFG_ENV_SESSION_FILE);
+		goto err0;
+	}
+
+	if ((db_session_file_len + sizeof(CFG_RPC_SOCKET_SUFFIX)) > sizeof(buffer)) {
+		LOG_ERRN("main", "%s", "rpc socket path: too long");
+		goto err0;
+	}
+
+	memcpy(buffer + db_session_file_len, CFG_RPC_SOCKET_SUFFIX, sizeof(CFG_RPC_SOCKET_SUFFIX));
+	if (chld_add_env_kv(CFG_ENV_RPC_FILE, buffer) < 0) {
+		LOG_ERRP("main", "%s: '%s'", "chld_add_env_kv", CFG_ENV_RPC_FILE);
+		goto err0;
+	}
+
 	const char *const db_sched_file = realpath(config->db_sched_path, buffer);
 	if (db_sched_file == NULL) {
 		LOG_ERRP("main", "%s: '%s'", "realpath", config->db_sched_path);
@@ -571,6 +646,7 @@ _server_run(Server *s, char *envp[])
 	EvSignal signale;
 	EvTimer timer;
 	EvListener listener;
+	EvListener rpc_listener;
 	Sched sched;
 	const Config *const config = &s->config;
 	const SqlitePoolParam db_params[] = {
@@ -595,62 +671,92 @@ _server_run(Server *s, char *envp[])
 	if (ret < 0)
 		return ret;
 
-	if (model_init() < 0)
+	ret = model_init();
+	if (ret < 0)
 		goto out0;
 
+	char session_file[CFG_DB_FILE_SIZE + sizeof(CFG_SESSION_TABLE_SUFFIX)];
+	snprintf(session_file, sizeof(session_file), "%s%s", config->db_session_path,
+		 CFG_SESSION_TABLE_SUFFIX);
+
+	ret = session_table_init(session_file, 1);
+	if (ret < 0)
+		goto out1;
+
 	ret = ev_init();
 	if (ret < 0) {
 		LOG_ERR(ret, "main", "%s", "ev_init");
-		goto out0;
+		goto out2;
 	}
 
 	ret = ev_signal_create(&signale, _server_on_signal, s);
 	if (ret < 0)
-		goto out1;
+		goto out3;
 
 	ret = ev_timer_create(&timer, _server_on_timer, s, 5);
 	if (ret < 0)
-		goto out2;
+		goto out4;
 
 	ret = ev_listener_create(&listener, config->listen_host, config->listen_port, _server_on_listener, s);
 	if (ret < 0)
-		goto out3;
+		goto out5;
+
+	char rpc_file[CFG_DB_FILE_SIZE + sizeof(CFG_RPC_SOCKET_SUFFIX)];
+	snprintf(rpc_file, sizeof(rpc_file), "%s%s", config->db_session_path, CFG_RPC_SOCKET_SUFFIX);
+
+	ret = ev_listener_create_unix(&rpc_listener, rpc_file, _server_on_rpc_listener, s);
+	if (ret < 0)
+		goto out6;
 
 	ret = _server_init_chld(s, config->api_url, envp);
 	if (ret < 0)
-		goto out4;
+		goto out7;
 
-	ret = sched_create(&sched, 1);
+	ret = sched_create(&sched);
 	if (ret < 0)
-		goto out5;
+		goto out8;
+
+	ret = cmd_init(config->cmd_plugin_dir);
+	if (ret < 0)
+		goto out9;
 
 	ret = thrd_pool_create(config->worker_size);
 	if (ret < 0)
-		goto out6;
+		goto out10;
 
-	ret = cmd_init();
+	ret = thrd_pool_init(&s->rpc_pool, CFG_RPC_WORKER_SIZE);
 	if (ret < 0)
-		goto out7;
+		goto out11;
 
 	ret = ev_run();
 	if (ret < 0)
 		LOG_ERR(ret, "main", "%s", "ev_run");
 
-out7:
+	thrd_pool_deinit(&s->rpc_pool);
+out11:
 	thrd_pool_destroy();
-out6:
+out10:
+	cmd_deinit();
+out9:
 	sched_destroy(&sched);
-out5:
+out8:
 	chld_wait_all();
 	chld_deinit();
-out4:
+out7:
+	ev_listener_destroy(&rpc_listener);
+	unlink(rpc_file);
+out6:
 	ev_listener_destroy(&listener);
-out3:
+out5:
 	ev_timer_destroy(&timer);
-out2:
+out4:
 	ev_signal_destroy(&signale);
-out1:
+out3:
 	ev_deinit();
+out2:
+	session_table_deinit();
+out1:
+	model_deinit();
 out0:
 	sqlite_pool_deinit();
 	return ret;
@@ -665,6 +771,21 @@ _server_on_signal(void *udata, uint32_t signo, int err)
 		return;
 	}
 
+	switch (signo) {
+	case SIGCHLD:
+		/* a burst of exits doesn't wait for the timer */
+		if ((chld_reap() > 0) && (thrd_pool_add_job(_server_handle_chld_output, NULL, NULL) < 0))
+			LOG_ERRN("main", "%s", "failed to flush the extern command output");
+
+		return;
+	case SIGHUP:
+		/* waits for the running commands, keep it off the event loop */
+		if (thrd_pool_add_job(_server_handle_reload, NULL, NULL) < 0)
+			LOG_ERRN("main", "%s", "failed to reload plugins");
+
+		return;
+	}
+
 	putchar('\n');
 	LOG_INFO("main", "signo: %u", signo);
 
@@ -684,7 +805,17 @@ _server_on_timer(void *udata, int err)
 
 	dlist_iterate(&s->clients, _server_timeout_clients, NULL);
 
-	chld_reap();
+	chld_kill_expired();
+
+	/* file io, keep it off the event loop */
+	if (thrd_pool_add_job(_server_handle_chld_output, NULL, NULL) < 0)
+		LOG_ERRN("main", "%s", "failed to flush the extern command output");
+
+	if (thrd_pool_add_job(_server_handle_chld_dropped, NULL, NULL) < 0)
+		LOG_ERRN("main", "%s", "failed to reply to the dropped extern commands");
+
+	if (thrd_pool_add_job(_server_handle_sched_purge, NULL, NULL) < 0)
+		LOG_ERRN("main", "%s", "failed to purge the expired scheduled messages");
 }
 
 
@@ -702,6 +833,66 @@ _server_on_listener(void *udata, int fd)
 }
 
 
+static void
+_server_on_rpc_listener(void *udata, int fd)
+{
+	if (fd < 0) {
+		LOG_ERR(fd, "main", "%s", "");
+		return;
+	}
+
+	Server *const s = (Server *)udata;
+	if (thrd_pool_push(&s->rpc_pool, _server_handle_rpc, (void *)(intptr_t)fd, NULL) < 0)
+		close(fd);
+}
+
+
+/*
+ * Telegram redelivers an update when our response is slow or the connection drops.
+ * Only called from the event loop thread.
+ */
+static int
+_server_is_update_seen(Server *s, int64_t id)
+{
+	const ServerDedup *const d = &s->dedup;
+	const int64_t size = CFG_UPDATE_DEDUP_SIZE;
+	if ((id <= 0) || (id > d->max_id))
+		return 0;
+
+	/* too old to tell, it must have been seen */
+	if ((d->max_id - id) >= size)
+		return 1;
+
+	return (d->bits[(id % size) / 64] & (UINT64_C(1) << (id % 64))) != 0;
+}
+
+
+/* only once it was accepted: the 200 was sent and a worker has it */
+static void
+_server_set_update_seen(Server *s, int64_t id)
+{
+	ServerDedup *const d = &s->dedup;
+	const int64_t size = CFG_UPDATE_DEDUP_SIZE;
+	if (id <= 0)
+		return;
+
+	if (id > d->max_id) {
+		if ((id - d->max_id) >= size) {
+			memset(d->bits, 0, sizeof(d->bits));
+		} else {
+			for (int64_t i = d->max_id + 1; i <= id; i++)
+				d->bits[(i % size) / 64] &= ~(UINT64_C(1) << (i % 64));
+		}
+
+		d->max_id = id;
+	} else if ((d->max_id - id) >= size) {
+		return;
+	}
+
+	d->bits[(id % size) / 64] |= UINT64_C(1) << (id % 64);
+}
+
+
 static int
 _server_add_client(Server *s, int fd)
 {
@@ -761,10 +952,17 @@ _server_handle_client(EvCtx *ctx)
 	if (_client_handle_state(c))
 		return;
 
-	if ((c->body != NULL) && (thrd_pool_add_job(_server_handle_update, s, c->body) == 0))
-		c->body = NULL;
+	/* c->body is only left when the 200 was sent in full */
+	if (c->body != NULL) {
+		if (thrd_pool_add_job(_server_handle_update, s, c->body) == 0) {
+			_server_set_update_seen(s, c->update_id);
+			c->body = NULL;
+		} else {
+			LOG_ERRN("main", "update: %" PRIi64 ": failed to queue", c->update_id);
+		}
+	}
 
-	json_object_put(c->body);
+	free(c->body);
 	_server_del_client(s, c);
 }
 
@@ -773,18 +971,104 @@ static void
 _server_handle_update(void *ctx, void *udata)
 {
 	Server *const s = (Server *)ctx;
-	json_object *const json = (json_object *)udata;
+	char *const raw = (char *)udata;
 	const Config *const config = &s->config;
 
+	enum json_tokener_error err;
+	json_object *const json = json_tokener_parse_verbose(raw, &err);
+	if (json == NULL) {
+		LOG_ERRN("main", "json_tokener_parse: %s", json_tokener_error_desc(err));
+		free(raw);
+		return;
+	}
+
+	/*
+	 * on the worker's stack: a parsed message with its reply, users and entities takes ~1 KiB,
+	 * the escaped names and titles of a command reply take a few more. Bigger ones spill into
+	 * malloc'd chunks. The pool threads run with the default (8 MiB) stack.
+	 */
+	char buffer[CFG_UPDATE_ARENA_SIZE];
+	Arena arena;
+	arena_init(&arena, buffer, sizeof(buffer), CFG_UPDATE_ARENA_SIZE);
+
 	const Update update = {
 		.id_bot = config->bot_id,
 		.id_owner = config->owner_id,
+		.deadline_ms = time_now_ms() + CFG_UPDATE_DEADLINE_MS,
+		.arena = &arena,
 		.username = config->bot_username,
 		.resp = json,
+		.raw = raw,
+		.raw_len = strlen(raw),
 	};
 
 	update_handle(&update);
+	arena_deinit(&arena);
 	json_object_put(json);
+	free(raw);
+}
+
+
+static void
+_server_handle_rpc(void *ctx, void *udata)
+{
+	const int fd = (int)(intptr_t)ctx;
+	/* per read/write: rpc_serve() bounds the whole request */
+	const struct timeval tv = {
+		.tv_sec = CFG_RPC_IO_TIMEOUT_MS / 1000,
+		.tv_usec = (CFG_RPC_IO_TIMEOUT_MS % 1000) * 1000,
+	};
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		LOG_ERRP("main", "%s", "setsockopt: SO_RCVTIMEO");
+		goto out0;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
+		LOG_ERRP("main", "%s", "setsockopt: SO_SNDTIMEO");
+		goto out0;
+	}
+
+	rpc_serve(fd);
+
+out0:
+	close(fd);
+	(void)udata;
+}
+
+
+static void
+_server_handle_reload(void *ctx, void *udata)
+{
+	cmd_reload_plugins();
+	(void)ctx;
+	(void)udata;
+}
+
+
+static void
+_server_handle_chld_output(void *ctx, void *udata)
+{
+	chld_output_flush();
+	(void)ctx;
+	(void)udata;
+}
+
+
+static void
+_server_handle_chld_dropped(void *ctx, void *udata)
+{
+	cmd_reply_dropped();
+	(void)ctx;
+	(void)udata;
+}
+
+
+static void
+_server_handle_sched_purge(void *ctx, void *udata)
+{
+	sched_purge_expired();
+	(void)ctx;
+	(void)udata;
 }
 
 
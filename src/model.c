@@ -1,5 +1,8 @@
+#include <ctype.h>
 #include <errno.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <threads.h>
 #include <sqlite3.h>
 
 #include "model.h"
@@ -59,6 +62,140 @@ static int _sqlite_query_one(int db_index, const char query[], const Data args[]
 			     int args_len, Data out[], int out_len);
 
 
+/*
+ * CmdCache: Cmd_Message & Cmd_Extern lookups, including the negative ones
+ */
+enum {
+	_CMD_CACHE_TYPE_MESSAGE,
+	_CMD_CACHE_TYPE_EXTERN,
+};
+
+typedef struct cmd_cache_entry {
+	struct cmd_cache_entry *next;
+	int                     type;
+	int64_t                 chat_id;	/* Cmd_Extern: 0 */
+	char                    name[MODEL_CMD_NAME_SIZE];
+	size_t                  value_size;	/* 0: negative entry */
+	char                    value[];	/* Cmd_Message: value, Cmd_Extern: ModelCmdExtern */
+} CmdCacheEntry;
+
+typedef struct cmd_cache {
+	int             is_ready;
+	mtx_t           mutex;
+	unsigned        count;
+	int64_t         version;		/* Cmd_Version, bumped by triggers on every write */
+	uint64_t        gen;			/* bumped on every flush and delete */
+	_Atomic int64_t checked_at;
+	CmdCacheEntry  *buckets[CFG_CMD_CACHE_BUCKETS];
+} CmdCache;
+
+static CmdCache _cmd_cache;
+
+static int  _cmd_cache_init(void);
+static void _cmd_cache_deinit(void);
+static int  _cmd_cache_get(int type, int64_t chat_id, const char name[], void *value, size_t size,
+			   uint64_t *gen);
+static void _cmd_cache_put(int type, int64_t chat_id, const char name[], const void *value,
+			   size_t size, uint64_t gen);
+static void _cmd_cache_del(int type, int64_t chat_id, const char name[]);
+static void _cmd_cache_validate(void);
+
+
+/*
+ * ChatCache: Chat flags, sharded by chat_id, LRU per shard
+ */
+typedef struct chat_cache_entry {
+	struct chat_cache_entry *hnext;
+	struct chat_cache_entry *prev;
+	struct chat_cache_entry *next;
+	int64_t                  chat_id;
+	int                      flags;
+} ChatCacheEntry;
+
+typedef struct chat_cache_shard {
+	mtx_t           mutex;
+	unsigned        used;		/* entries[0..used) have been handed out */
+	ChatCacheEntry *free;		/* linked through hnext */
+	uint64_t        gen;		/* bumped on every write-through */
+	ChatCacheEntry  lru;		/* sentinel: lru.next is the most recently used */
+	ChatCacheEntry *buckets[CFG_CHAT_CACHE_SIZE];
+	ChatCacheEntry  entries[CFG_CHAT_CACHE_SIZE];
+} ChatCacheShard;
+
+typedef struct chat_cache {
+	int            is_ready;
+	ChatCacheShard shards[CFG_CHAT_CACHE_SHARDS];
+} ChatCache;
+
+static ChatCache _chat_cache;
+
+static int  _chat_cache_init(void);
+static void _chat_cache_deinit(void);
+static int  _chat_cache_get(int64_t chat_id, int *flags, uint64_t *gen);
+static void _chat_cache_fill(int64_t chat_id, int flags, uint64_t gen);
+static void _chat_cache_set(int64_t chat_id, int flags);
+static void _chat_cache_del(int64_t chat_id);
+
+
+/*
+ * AdminCache: per chat admin set, sorted by user_id
+ */
+typedef struct admin_cache_item {
+	int64_t user_id;
+	int     privileges;
+} AdminCacheItem;
+
+typedef struct admin_cache_entry {
+	struct admin_cache_entry *next;
+	int64_t                   chat_id;
+	int64_t                   expire_at;	/* time_now_ms() */
+	int                       len;
+	AdminCacheItem            items[];
+} AdminCacheEntry;
+
+typedef struct admin_cache {
+	int              is_ready;
+	mtx_t            mutex;
+	unsigned         count;
+	uint64_t         gen;
+	AdminCacheEntry *buckets[CFG_ADMIN_CACHE_SIZE];
+} AdminCache;
+
+static AdminCache _admin_cache;
+
+static int  _admin_cache_init(void);
+static void _admin_cache_deinit(void);
+static int  _admin_cache_get(int64_t chat_id, int64_t user_id, uint64_t *gen);
+static void _admin_cache_put(int64_t chat_id, AdminCacheItem items[], int len, uint64_t *gen);
+static void _admin_cache_del(int64_t chat_id);
+
+
+/*
+ * ResultCache: MODEL_CMD_FLAG_EXTERN_CACHE replies, by key
+ */
+typedef struct result_cache_entry {
+	struct result_cache_entry *next;
+	int64_t                    expire_at;	/* time_now_ms() */
+	const char                *key;		/* "name:args", stored after 'data' */
+	char                       type[MODEL_CMD_EXTERN_RESULT_TYPE_SIZE];
+	char                       data[];
+} ResultCacheEntry;
+
+typedef struct result_cache {
+	int               is_ready;
+	mtx_t             mutex;
+	unsigned          count;
+	ResultCacheEntry *buckets[CFG_RESULT_CACHE_SIZE];
+} ResultCache;
+
+static ResultCache _result_cache;
+
+static int                _result_cache_init(void);
+static void               _result_cache_deinit(void);
+static ResultCacheEntry **_result_cache_find(const char key[]);
+static void               _result_cache_evict(int64_t now);
+
+
 /*
  * InitQueries
  */
@@ -74,8 +211,9 @@ static const char *_chat_query(Str *str);
 static const char *_admin_query(Str *str);
 static const char *_cmd_builtin_query(Str *str);
 static const char *_cmd_extern_query(Str *str);
+static const char *_cmd_extern_limit_query(Str *str);
 static const char *_cmd_message_query(Str *str);
-static const char *_session_cmd_query(Str *str);
+static const char *_cmd_version_query(Str *str);
 static const char *_sched_message_query(Str *str);
 static const char *_anime_sched_query(Str *str);
 
@@ -89,22 +227,57 @@ model_init(void)
 	LOG_INFO("model", "sqlite version: v%s", SQLITE_VERSION);
 
 	const TableQuery queries[] = {
-		{ MODEL_DB_INDEX_MAIN, "WAL",         _enable_wal_mode },
-		{ MODEL_DB_INDEX_MAIN, "Chat",        _chat_query },
-		{ MODEL_DB_INDEX_MAIN, "Admin",       _admin_query },
-		{ MODEL_DB_INDEX_MAIN, "Cmd_Builtin", _cmd_builtin_query },
-		{ MODEL_DB_INDEX_MAIN, "Cmd_Extern",  _cmd_extern_query },
-		{ MODEL_DB_INDEX_MAIN, "Cmd_Message", _cmd_message_query },
-		{ MODEL_DB_INDEX_MAIN, "Anime_Sched", _anime_sched_query },
-
+		{ MODEL_DB_INDEX_MAIN, "WAL",              _enable_wal_mode },
+		{ MODEL_DB_INDEX_MAIN, "Chat",             _chat_query },
+		{ MODEL_DB_INDEX_MAIN, "Admin",            _admin_query },
+		{ MODEL_DB_INDEX_MAIN, "Cmd_Builtin",      _cmd_builtin_query },
+		{ MODEL_DB_INDEX_MAIN, "Cmd_Extern",       _cmd_extern_query },
+		{ MODEL_DB_INDEX_MAIN, "Cmd_Extern_Limit", _cmd_extern_limit_query },
+		{ MODEL_DB_INDEX_MAIN, "Cmd_Message",      _cmd_message_query },
+		{ MODEL_DB_INDEX_MAIN, "Cmd_Version",      _cmd_version_query },
+		{ MODEL_DB_INDEX_MAIN, "Anime_Sched",      _anime_sched_query },
+
+		/* the command sessions live in session.c's shared table */
 		{ MODEL_DB_INDEX_SESSION, "WAL",         _enable_wal_mode },
-		{ MODEL_DB_INDEX_SESSION, "Session_Cmd", _session_cmd_query },
 
 		{ MODEL_DB_INDEX_SCHED, "WAL",           _enable_wal_mode },
 		{ MODEL_DB_INDEX_SCHED, "Sched_Message", _sched_message_query },
 	};
 
-	return _init_tables(queries, (int)LEN(queries));
+	if (_init_tables(queries, (int)LEN(queries)) < 0)
+		return -1;
+
+	if (_cmd_cache_init() < 0)
+		return -1;
+
+	if (_chat_cache_init() < 0)
+		goto err0;
+
+	if (_admin_cache_init() < 0)
+		goto err1;
+
+	if (_result_cache_init() < 0)
+		goto err2;
+
+	return 0;
+
+err2:
+	_admin_cache_deinit();
+err1:
+	_chat_cache_deinit();
+err0:
+	_cmd_cache_deinit();
+	return -1;
+}
+
+
+void
+model_deinit(void)
+{
+	_result_cache_deinit();
+	_admin_cache_deinit();
+	_chat_cache_deinit();
+	_cmd_cache_deinit();
 }
 
 
@@ -114,21 +287,33 @@ model_init(void)
 int
 model_chat_init(int64_t chat_id)
 {
+	int flags = 0;
+	uint64_t gen = 0;
+	if (_chat_cache_get(chat_id, &flags, &gen) > 0)
+		return 0;
+
 	const Data args[] = {
 		_ARG_INT64(chat_id),
 		_ARG_INT(_CHAT_DEF_FLAGS),
 		_ARG_INT64(time(NULL)),
 	};
 
-	const char *query = "SELECT 1 FROM Chat WHERE (chat_id = ?);";
-	const int ret = _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, args, 1, NULL, 0);
+	Data out = _OUT_INT(&flags);
+	const char *query = "SELECT flags FROM Chat WHERE (chat_id = ?);";
+	int ret = _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, args, 1, &out, 1);
 	if (ret < 0)
 		return -1;
-	if (ret > 0)
+	if (ret > 0) {
+		_chat_cache_fill(chat_id, flags, gen);
 		return 0;
+	}
 
 	query = "INSERT INTO Chat(chat_id, flags, created_at) VALUES(?, ?, ?);";
-	return _sqlite_exec(MODEL_DB_INDEX_MAIN, 1, query, args, LEN(args));
+	ret = _sqlite_exec(MODEL_DB_INDEX_MAIN, 1, query, args, LEN(args));
+	if (ret > 0)
+		_chat_cache_fill(chat_id, _CHAT_DEF_FLAGS, gen);
+
+	return ret;
 }
 
 
@@ -141,20 +326,33 @@ model_chat_set_flags(int64_t chat_id, int flags)
 	};
 
 	const char *const query = "UPDATE Chat SET flags = ? WHERE (chat_id = ?);";
-	return _sqlite_exec(MODEL_DB_INDEX_MAIN, 1, query, args, LEN(args));
+	const int ret = _sqlite_exec(MODEL_DB_INDEX_MAIN, 1, query, args, LEN(args));
+	if (ret > 0)
+		_chat_cache_set(chat_id, flags);
+	else
+		_chat_cache_del(chat_id);
+
+	return ret;
 }
 
 
 int
 model_chat_get_flags(int64_t chat_id)
 {
+	int flags = 0;
+	uint64_t gen = 0;
+	if (_chat_cache_get(chat_id, &flags, &gen) > 0)
+		return flags;
+
 	const Data arg = _ARG_INT64(chat_id);
 	const char *const query = "SELECT flags FROM Chat WHERE (chat_id = ?);";
 
-	int flags = 0;
 	Data out = _OUT_INT(&flags);
-	if (_sqlite_query_one(MODEL_DB_INDEX_MAIN, query, &arg, 1, &out, 1) < 0)
+	const int ret = _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, &arg, 1, &out, 1);
+	if (ret < 0)
 		return -1;
+	if (ret > 0)
+		_chat_cache_fill(chat_id, flags, gen);
 
 	return flags;
 }
@@ -264,7 +462,89 @@ model_admin_reload(const ModelAdmin list[], int len)
 	is_ok = 1;
 
 out1:
-	sqlite_pool_tran_end(conn, is_ok);
+	if (sqlite_pool_tran_end(conn, is_ok) < 0) {
+		is_ok = 0;
+		ret = -1;
+	}
+out0:
+	sqlite_pool_put(conn);
+	if (is_ok == 0) {
+		_admin_cache_del(list[0].chat_id);
+		return ret;
+	}
+
+	/* write-through: list[] is the whole admin set of the chat */
+	AdminCacheItem *const items = malloc(sizeof(AdminCacheItem) * (size_t)len);
+	if (items == NULL) {
+		_admin_cache_del(list[0].chat_id);
+		return ret;
+	}
+
+	for (int i = 0; i < len; i++)
+		items[i] = (AdminCacheItem) { .user_id = list[i].user_id, .privileges = list[i].privileges };
+
+	_admin_cache_put(list[0].chat_id, items, len, NULL);
+	free(items);
+	return ret;
+}
+
+
+static int
+_admin_get_privileges_load(int64_t chat_id, int64_t user_id, uint64_t gen)
+{
+	const char *const query =
+		"SELECT user_id, privileges "
+		"FROM Admin "
+		"WHERE (chat_id = ?) "
+		"ORDER BY user_id, id;";
+
+	sqlite3_stmt *stmt;
+	DbConn *const conn = sqlite_pool_get(MODEL_DB_INDEX_MAIN);
+	if (conn == NULL)
+		return -1;
+
+	const Data arg = _ARG_INT64(chat_id);
+	int ret = _sqlite_prep(conn->sql, query, -1, &arg, 1, &stmt);
+	if (ret < 0)
+		goto out0;
+
+	int len = 0;
+	int size = 0;
+	int privs = 0;
+	AdminCacheItem *items = NULL;
+	while ((ret = _sqlite_step_one(stmt)) > 0) {
+		const int64_t _user_id = sqlite3_column_int64(stmt, 0);
+		const int _privs = sqlite3_column_int(stmt, 1);
+		if (_user_id == user_id)
+			privs = _privs;
+
+		/* duplicated user_id: the latest row wins, like before */
+		if ((len > 0) && (items[len - 1].user_id == _user_id)) {
+			items[len - 1].privileges = _privs;
+			continue;
+		}
+
+		if (len == size) {
+			size = (size == 0) ? 16 : (size * 2);
+			AdminCacheItem *const _items = realloc(items, sizeof(AdminCacheItem) * (size_t)size);
+			if (_items == NULL) {
+				ret = -1;
+				break;
+			}
+
+			items = _items;
+		}
+
+		items[len++] = (AdminCacheItem) { .user_id = _user_id, .privileges = _privs };
+	}
+
+	if (ret == 0) {
+		_admin_cache_put(chat_id, items, len, &gen);
+		ret = privs;
+	}
+
+	free(items);
+	sqlite3_finalize(stmt);
 out0:
 	sqlite_pool_put(conn);
 	return ret;
@@ -274,23 +554,73 @@ out0:
 int
 model_admin_get_privileges(int64_t chat_id, int64_t user_id)
 {
-	const char *const query =
-		"SELECT privileges "
-		"FROM Admin "
-		"WHERE (chat_id = ?) AND (user_id = ?) "
-		"ORDER BY id DESC LIMIT 1;";
+	uint64_t gen = 0;
+	const int ret = _admin_cache_get(chat_id, user_id, &gen);
+	if (ret >= 0)
+		return ret;
+
+	return _admin_get_privileges_load(chat_id, user_id, gen);
+}
+
+
+/* adds or replaces one admin of a chat */
+int
+model_admin_set(const ModelAdmin *a)
+{
+	int ret = -1;
+	int is_ok = 0;
+	DbConn *const conn = sqlite_pool_get(MODEL_DB_INDEX_MAIN);
+	if (conn == NULL)
+		return -1;
+
+	if (sqlite_pool_tran_begin(conn) < 0)
+		goto out0;
+
+	const char *const query = "DELETE FROM Admin WHERE (chat_id = ?) AND (user_id = ?);";
+	const Data args[] = {
+		_ARG_INT64(a->chat_id),
+		_ARG_INT64(a->user_id),
+	};
+
+	sqlite3_stmt *stmt;
+	if (_sqlite_prep(conn->sql, query, -1, args, LEN(args), &stmt) < 0)
+		goto out1;
+
+	ret = _sqlite_step_one_wait(conn->sql, stmt);
+	sqlite3_finalize(stmt);
+	if (ret < 0)
+		goto out1;
 
+	ret = _admin_add(conn, a, 1);
+	if (ret < 0)
+		goto out1;
+
+	is_ok = 1;
+
+out1:
+	if (sqlite_pool_tran_end(conn, is_ok) < 0)
+		ret = -1;
+out0:
+	sqlite_pool_put(conn);
+
+	/* reloaded from the table on the next lookup */
+	_admin_cache_del(a->chat_id);
+	return ret;
+}
+
+
+int
+model_admin_remove(int64_t chat_id, int64_t user_id)
+{
 	const Data args[] = {
 		_ARG_INT64(chat_id),
 		_ARG_INT64(user_id),
 	};
 
-	int privs = 0;
-	Data out = _OUT_INT(&privs);
-	if (_sqlite_query_one(MODEL_DB_INDEX_MAIN, query, args, LEN(args), &out, 1) < 0)
-		return -1;
-
-	return privs;
+	const char *const query = "DELETE FROM Admin WHERE (chat_id = ?) AND (user_id = ?);";
+	const int ret = _sqlite_exec(MODEL_DB_INDEX_MAIN, 1, query, args, LEN(args));
+	_admin_cache_del(chat_id);
+	return ret;
 }
 
 
@@ -442,6 +772,130 @@ out0:
 }
 
 
+/* Cmd_Version: bumped on every Cmd_Extern/Cmd_Message write, by any process */
+int
+model_cmd_get_version(int64_t *version)
+{
+	if (_cmd_cache.is_ready) {
+		_cmd_cache_validate();
+
+		mtx_lock(&_cmd_cache.mutex);
+		*version = _cmd_cache.version;
+		mtx_unlock(&_cmd_cache.mutex);
+		if (*version >= 0)
+			return 0;
+	}
+
+	Data out = _OUT_INT64(version);
+	const char *const query = "SELECT version FROM Cmd_Version WHERE (id = 1);";
+	if (_sqlite_query_one(MODEL_DB_INDEX_MAIN, query, NULL, 0, &out, 1) <= 0)
+		return -1;
+
+	return 0;
+}
+
+
+/*
+ * ModelCmdResolve
+ */
+int
+model_cmd_resolve(ModelCmdResolve *r, int64_t chat_id, const char name[])
+{
+	uint64_t chat_gen = 0;
+	uint64_t cmd_gen = 0;
+	const int has_chat = _chat_cache_get(chat_id, &r->chat_flags, &chat_gen);
+	const int has_message = _cmd_cache_get(_CMD_CACHE_TYPE_MESSAGE, chat_id, name, r->message,
+					       LEN(r->message), &cmd_gen);
+	const int has_extern = _cmd_cache_get(_CMD_CACHE_TYPE_EXTERN, 0, name, &r->cmd_extern,
+					      sizeof(r->cmd_extern), &cmd_gen);
+	if ((has_chat > 0) && (has_message >= 0) && (has_extern >= 0)) {
+		r->has_message = has_message;
+		r->has_extern = has_extern;
+		return 0;
+	}
+
+	/* Cmd_Builtin isn't here: builtins are resolved in memory, see cmd.c */
+	const char *const query =
+		"SELECT c.chat_id, c.flags, m.id, m.value, "
+			"e.id, e.is_enable, e.flags, e.name, e.file_name, e.description, "
+			"COALESCE(l.timeout_s, 0), COALESCE(l.cpu_s, 0), COALESCE(l.mem_mb, 0), "
+			"COALESCE(l.cgroup, '') "
+		"FROM (SELECT ? AS chat_id, ? AS name) AS k "
+		"LEFT JOIN Chat AS c ON (c.chat_id = k.chat_id) "
+		"LEFT JOIN Cmd_Message AS m ON (m.chat_id = k.chat_id) AND (m.name = k.name) "
+		"LEFT JOIN Cmd_Extern AS e ON (e.name = k.name) "
+		"LEFT JOIN Cmd_Extern_Limit AS l ON (l.name = e.name) "
+		"LIMIT 1;";
+
+	const Data args[] = {
+		_ARG_INT64(chat_id),
+		_ARG_TEXT(name, -1),
+	};
+
+	sqlite3_stmt *stmt;
+	DbConn *const conn = sqlite_pool_get(MODEL_DB_INDEX_MAIN);
+	if (conn == NULL)
+		return -1;
+
+	int ret = _sqlite_prep(conn->sql, query, -1, args, LEN(args), &stmt);
+	if (ret < 0)
+		goto out0;
+
+	ret = _sqlite_step_one(stmt);
+	if (ret <= 0) {
+		/* the "k" row always exists */
+		ret = -1;
+		goto out1;
+	}
+
+	int i = 0;
+	if (sqlite3_column_type(stmt, i++) != SQLITE_NULL) {
+		r->chat_flags = sqlite3_column_int(stmt, i++);
+		_chat_cache_fill(chat_id, r->chat_flags, chat_gen);
+	} else {
+		r->chat_flags = 0;
+		i++;
+	}
+
+	r->has_message = (sqlite3_column_type(stmt, i++) != SQLITE_NULL);
+	if (r->has_message) {
+		cstr_copy_n(r->message, LEN(r->message), (const char *)sqlite3_column_text(stmt, i));
+		_cmd_cache_put(_CMD_CACHE_TYPE_MESSAGE, chat_id, name, r->message,
+			       strlen(r->message) + 1, cmd_gen);
+	} else {
+		_cmd_cache_put(_CMD_CACHE_TYPE_MESSAGE, chat_id, name, NULL, 0, cmd_gen);
+	}
+
+	i++;
+
+	ModelCmdExtern *const e = &r->cmd_extern;
+	r->has_extern = (sqlite3_column_type(stmt, i) != SQLITE_NULL);
+	if (r->has_extern) {
+		e->id = sqlite3_column_int(stmt, i++);
+		e->is_enable = sqlite3_column_int(stmt, i++);
+		e->flags = sqlite3_column_int(stmt, i++);
+		cstr_copy_n(e->name, LEN(e->name), (const char *)sqlite3_column_text(stmt, i++));
+		cstr_copy_n(e->file_name, LEN(e->file_name), (const char *)sqlite3_column_text(stmt, i++));
+		cstr_copy_n(e->description, LEN(e->description), (const char *)sqlite3_column_text(stmt, i++));
+		e->timeout_s = sqlite3_column_int(stmt, i++);
+		e->cpu_s = sqlite3_column_int(stmt, i++);
+		e->mem_mb = sqlite3_column_int(stmt, i++);
+		cstr_copy_n(e->cgroup, LEN(e->cgroup), (const char *)sqlite3_column_text(stmt, i++));
+		_cmd_cache_put(_CMD_CACHE_TYPE_EXTERN, 0, name, e, sizeof(*e), cmd_gen);
+	} else {
+		_cmd_cache_put(_CMD_CACHE_TYPE_EXTERN, 0, name, NULL, 0, cmd_gen);
+	}
+
+	ret = 0;
+
+out1:
+	sqlite3_finalize(stmt);
+out0:
+	sqlite_pool_put(conn);
+	return ret;
+}
+
+
 /*
  * ModelCmdBuiltin
  */
@@ -475,24 +929,6 @@ model_cmd_builtin_clear(void)
 }
 
 
-int
-model_cmd_builtin_get_index(const char name[])
-{
-	const Data arg = _ARG_TEXT(name, -1);
-	const char *const query = "SELECT idx FROM Cmd_Builtin WHERE (name = ?);";
-
-	int index = 0;
-	Data out = _OUT_INT(&index);
-	const int ret = _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, &arg, 1, &out, 1);
-	if (ret < 0)
-		return -1;
-	if (ret == 0)
-		return -2;
-
-	return index;
-}
-
-
 int
 model_cmd_builtin_is_exists(const char name[])
 {
@@ -508,10 +944,18 @@ model_cmd_builtin_is_exists(const char name[])
 int
 model_cmd_extern_get(ModelCmdExtern *c, const char name[])
 {
+	uint64_t gen = 0;
+	int ret = _cmd_cache_get(_CMD_CACHE_TYPE_EXTERN, 0, name, c, sizeof(*c), &gen);
+	if (ret >= 0)
+		return ret;
+
 	const char *const query =
-		"SELECT id, is_enable, flags, name, file_name, description "
-		"FROM Cmd_Extern "
-		"WHERE (name = ?); ";
+		"SELECT e.id, e.is_enable, e.flags, e.name, e.file_name, e.description, "
+			"COALESCE(l.timeout_s, 0), COALESCE(l.cpu_s, 0), COALESCE(l.mem_mb, 0), "
+			"COALESCE(l.cgroup, '') "
+		"FROM Cmd_Extern AS e "
+		"LEFT JOIN Cmd_Extern_Limit AS l ON (l.name = e.name) "
+		"WHERE (e.name = ?); ";
 
 	const Data arg = _ARG_TEXT(name, -1);
 	Data out[] = {
@@ -521,9 +965,19 @@ model_cmd_extern_get(ModelCmdExtern *c, const char name[])
 		_OUT_TEXT(c->name, LEN(c->name)),
 		_OUT_TEXT(c->file_name, LEN(c->file_name)),
 		_OUT_TEXT(c->description, LEN(c->description)),
+		_OUT_INT(&c->timeout_s),
+		_OUT_INT(&c->cpu_s),
+		_OUT_INT(&c->mem_mb),
+		_OUT_TEXT(c->cgroup, LEN(c->cgroup)),
 	};
 
-	return _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, &arg, 1, out, LEN(out));
+	ret = _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, &arg, 1, out, LEN(out));
+	if (ret == 0)
+		_cmd_cache_put(_CMD_CACHE_TYPE_EXTERN, 0, name, NULL, 0, gen);
+	else if (ret > 0)
+		_cmd_cache_put(_CMD_CACHE_TYPE_EXTERN, 0, name, c, sizeof(*c), gen);
+
+	return ret;
 }
 
 
@@ -537,57 +991,187 @@ model_cmd_extern_is_exists(const char name[])
 
 
 /*
- * ModelCmdMessage
+ * ModelCmdExternResult
  */
 int
-model_cmd_message_set(const ModelCmdMessage *c)
+model_cmd_extern_result_key(char key[], size_t size, const char name[], const char args[])
 {
-	const char *query = "SELECT 1 FROM Cmd_Message WHERE (chat_id = ?) AND (name = ?);";
-	const Data args0[] = {
-		_ARG_INT64(c->chat_id),
-		_ARG_TEXT(c->name_in, -1),
-	};
-
-	const int ret = _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, args0, LEN(args0), NULL, 0);
-	if ((ret < 0) || ((ret == 0) && (c->value_in == NULL)))
+	const int ret = snprintf(key, size, "%s:", name);
+	if ((ret < 0) || ((size_t)ret >= size))
 		return -1;
 
-	int64_t user_id;
-	if (ret == 0) {
-		query = "INSERT INTO Cmd_Message(value, created_by, created_at, chat_id, name) "
-			"SELECT ?, ?, ?, ?, ? ";
-		user_id = c->created_by;
-	} else {
-		query = "UPDATE Cmd_Message "
-				"SET value = ?, updated_by = ?, updated_at = ? "
-			"WHERE (chat_id = ?) and (name = ?);";
-		user_id = c->updated_by;
-	}
+	size_t len = (size_t)ret;
+	int is_space = 0;
+	int is_empty = 1;
+	for (args = cstr_empty_if_null(args); *args != '\0'; args++) {
+		const unsigned char c = (unsigned char)*args;
+		if (isspace(c)) {
+			is_space = 1;
+			continue;
+		}
 
-	const Data args1[] = {
-		_ARG_TEXT(c->value_in, -1),
-		_ARG_INT64(user_id),
-		_ARG_INT64(time(NULL)),
-		_ARG_INT64(c->chat_id),
-		_ARG_TEXT(c->name_in, -1),
-	};
+		/* +1: the NUL */
+		const int has_sep = (is_space && (is_empty == 0));
+		if ((len + (size_t)has_sep + 1) >= size)
+			return -1;
+
+		if (has_sep)
+			key[len++] = ' ';
+
+		key[len++] = (char)tolower(c);
+		is_space = 0;
+		is_empty = 0;
+	}
 
-	return _sqlite_exec(MODEL_DB_INDEX_MAIN, 1, query, args1, LEN(args1));
+	key[len] = '\0';
+	return 0;
 }
 
 
-int
-model_cmd_message_get_value(int64_t chat_id, const char name[], char value[], size_t value_len)
+char *
+model_cmd_extern_result_get(const char key[], char type[], size_t type_size)
 {
-	const Data args[] = {
-		_ARG_INT64(chat_id),
+	if (_result_cache.is_ready == 0)
+		return NULL;
+
+	char *data = NULL;
+	mtx_lock(&_result_cache.mutex);
+
+	ResultCacheEntry **const entry = _result_cache_find(key);
+	ResultCacheEntry *const curr = *entry;
+	if (curr == NULL)
+		goto out0;
+
+	if (curr->expire_at <= time_now_ms()) {
+		*entry = curr->next;
+		free(curr);
+		_result_cache.count--;
+		goto out0;
+	}
+
+	data = strdup(curr->data);
+	if (data != NULL)
+		cstr_copy_n(type, type_size, curr->type);
+
+out0:
+	mtx_unlock(&_result_cache.mutex);
+	return data;
+}
+
+
+void
+model_cmd_extern_result_put(const char key[], const char type[], const char data[])
+{
+	if (_result_cache.is_ready == 0)
+		return;
+
+	/* model_cmd_extern_result_key() doesn't make longer ones */
+	const size_t key_len = strlen(key);
+	if (key_len >= MODEL_CMD_EXTERN_RESULT_KEY_SIZE)
+		return;
+
+	const size_t data_len = strlen(data);
+	ResultCacheEntry *const new_entry = malloc(sizeof(ResultCacheEntry) + data_len + 1 + key_len + 1);
+	if (new_entry == NULL)
+		return;
+
+	const int64_t now = time_now_ms();
+	new_entry->expire_at = now + (CFG_RESULT_CACHE_TTL_S * 1000);
+	cstr_copy_n(new_entry->type, LEN(new_entry->type), type);
+	memcpy(new_entry->data, data, data_len + 1);
+	new_entry->key = memcpy(new_entry->data + data_len + 1, key, key_len + 1);
+
+	mtx_lock(&_result_cache.mutex);
+
+	/* the last reply of an invocation wins */
+	ResultCacheEntry **const entry = _result_cache_find(key);
+	if (*entry != NULL) {
+		ResultCacheEntry *const old_entry = *entry;
+		new_entry->next = old_entry->next;
+		*entry = new_entry;
+		free(old_entry);
+	} else {
+		if (_result_cache.count >= CFG_RESULT_CACHE_SIZE)
+			_result_cache_evict(now);
+
+		ResultCacheEntry **const bucket = _result_cache_find(key);
+		new_entry->next = *bucket;
+		*bucket = new_entry;
+		_result_cache.count++;
+	}
+
+	mtx_unlock(&_result_cache.mutex);
+}
+
+
+/*
+ * ModelCmdMessage
+ */
+int
+model_cmd_message_set(const ModelCmdMessage *c)
+{
+	const char *query = "SELECT 1 FROM Cmd_Message WHERE (chat_id = ?) AND (name = ?);";
+	const Data args0[] = {
+		_ARG_INT64(c->chat_id),
+		_ARG_TEXT(c->name_in, -1),
+	};
+
+	int ret = _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, args0, LEN(args0), NULL, 0);
+	if ((ret < 0) || ((ret == 0) && (c->value_in == NULL)))
+		return -1;
+
+	int64_t user_id;
+	if (ret == 0) {
+		query = "INSERT INTO Cmd_Message(value, created_by, created_at, chat_id, name) "
+			"SELECT ?, ?, ?, ?, ? ";
+		user_id = c->created_by;
+	} else {
+		query = "UPDATE Cmd_Message "
+				"SET value = ?, updated_by = ?, updated_at = ? "
+			"WHERE (chat_id = ?) and (name = ?);";
+		user_id = c->updated_by;
+	}
+
+	const Data args1[] = {
+		_ARG_TEXT(c->value_in, -1),
+		_ARG_INT64(user_id),
+		_ARG_INT64(time(NULL)),
+		_ARG_INT64(c->chat_id),
+		_ARG_TEXT(c->name_in, -1),
+	};
+
+	ret = _sqlite_exec(MODEL_DB_INDEX_MAIN, 1, query, args1, LEN(args1));
+
+	/* after the commit: a reader that missed before it drops its put, see: _cmd_cache_put() */
+	_cmd_cache_del(_CMD_CACHE_TYPE_MESSAGE, c->chat_id, c->name_in);
+	return ret;
+}
+
+
+int
+model_cmd_message_get_value(int64_t chat_id, const char name[], char value[], size_t value_len)
+{
+	uint64_t gen = 0;
+	int ret = _cmd_cache_get(_CMD_CACHE_TYPE_MESSAGE, chat_id, name, value, value_len, &gen);
+	if (ret >= 0)
+		return ret;
+
+	const Data args[] = {
+		_ARG_INT64(chat_id),
 		_ARG_TEXT(name, -1),
 	};
 
+	value[0] = '\0';
 	Data out = _OUT_TEXT(value, value_len);
 	const char *const query = "SELECT value FROM Cmd_Message WHERE (chat_id = ?) AND (name = ?);";
 
-	return _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, args, LEN(args), &out, 1);
+	ret = _sqlite_query_one(MODEL_DB_INDEX_MAIN, query, args, LEN(args), &out, 1);
+	if (ret == 0)
+		_cmd_cache_put(_CMD_CACHE_TYPE_MESSAGE, chat_id, name, NULL, 0, gen);
+	else if (ret > 0)
+		_cmd_cache_put(_CMD_CACHE_TYPE_MESSAGE, chat_id, name, value, strlen(value) + 1, gen);
+
+	return ret;
 }
 
 
@@ -609,8 +1193,9 @@ model_cmd_message_is_exists(const char name[])
 /*
  * ModelSchedMessage
  */
+/* ret: 1: found, 0: not found, -1: error */
 int
-model_sched_message_get_list(ModelSchedMessage *list[], int len, time_t now)
+model_sched_message_get(ModelSchedMessage *s, int32_t id)
 {
 	sqlite3_stmt *stmt;
 	DbConn *const conn = sqlite_pool_get(MODEL_DB_INDEX_SCHED);
@@ -620,11 +1205,55 @@ model_sched_message_get_list(ModelSchedMessage *list[], int len, time_t now)
 	const char *const query =
 		"SELECT id, type, chat_id, message_id, user_id, value, next_run, expire "
 		"FROM Sched_Message "
-		"WHERE (? >= next_run) AND (? < (next_run + expire)) "
-		"LIMIT ?";
+		"WHERE (id = ?);";
+
+	const Data args[] = { _ARG_INT(id) };
+	int ret = _sqlite_prep(conn->sql, query, -1, args, LEN(args), &stmt);
+	if (ret < 0)
+		goto out0;
+
+	ret = _sqlite_step_one(stmt);
+	if (ret <= 0)
+		goto out1;
+
+	s->id = sqlite3_column_int(stmt, 0);
+	s->type = sqlite3_column_int(stmt, 1);
+	s->chat_id = sqlite3_column_int64(stmt, 2);
+	s->message_id = sqlite3_column_int64(stmt, 3);
+	s->user_id = sqlite3_column_int64(stmt, 4);
+	cstr_copy_n(s->value, LEN(s->value), cstr_empty_if_null((const char *)sqlite3_column_text(stmt, 5)));
+	s->next_run = sqlite3_column_int64(stmt, 6);
+	s->expire = sqlite3_column_int64(stmt, 7);
+
+out1:
+	sqlite3_finalize(stmt);
+out0:
+	sqlite_pool_put(conn);
+	return ret;
+}
+
+
+/*
+ * pages through the unexpired ones by id: 'after_id' = the last id of the previous page,
+ * 0: the first one
+ */
+int
+model_sched_message_get_times(ModelSchedTime list[], int len, int32_t after_id, time_t now)
+{
+	sqlite3_stmt *stmt;
+	DbConn *const conn = sqlite_pool_get(MODEL_DB_INDEX_SCHED);
+	if (conn == NULL)
+		return -1;
+
+	const char *const query =
+		"SELECT id, next_run, expire "
+		"FROM Sched_Message "
+		"WHERE (id > ?) AND ((next_run + expire) > ?) "
+		"ORDER BY id "
+		"LIMIT ?;";
 
 	const Data args[] = {
-		_ARG_INT64(now),
+		_ARG_INT(after_id),
 		_ARG_INT64(now),
 		_ARG_INT(len),
 	};
@@ -641,28 +1270,17 @@ model_sched_message_get_list(ModelSchedMessage *list[], int len, time_t now)
 		if (ret == 0)
 			break;
 
-		ModelSchedMessage *const it = malloc(sizeof(ModelSchedMessage));
-		if (it == NULL)
-			goto out1;
-
-		it->id = sqlite3_column_int(stmt, 0);
-		it->type = sqlite3_column_int(stmt, 1);
-		it->chat_id = sqlite3_column_int64(stmt, 2);
-		it->message_id = sqlite3_column_int64(stmt, 3);
-		it->user_id = sqlite3_column_int64(stmt, 4);
-		cstr_copy_n(it->value, LEN(it->value), (const char *)sqlite3_column_text(stmt, 5));
-		it->next_run = sqlite3_column_int64(stmt, 6);
-		it->expire = sqlite3_column_int64(stmt, 7);
-
-		list[count] = it;
+		list[count] = (ModelSchedTime) {
+			.id = sqlite3_column_int(stmt, 0),
+			.next_run = sqlite3_column_int64(stmt, 1),
+			.expire = sqlite3_column_int64(stmt, 2),
+		};
 	}
 
 	ret = count;
 
 out1:
 	sqlite3_finalize(stmt);
-	for (int i = 0; (i < count) && (ret < 0); i++)
-		free(list[i]);
 out0:
 	sqlite_pool_put(conn);
 	return ret;
@@ -715,8 +1333,26 @@ out0:
 }
 
 
+/* at most 'limit' rows, through the Sched_Message_expire_at index: ret: the deleted count */
+int
+model_sched_message_purge(time_t now, int limit)
+{
+	const Data args[] = {
+		_ARG_INT64(now),
+		_ARG_INT(limit),
+	};
+
+	const char *const query =
+		"DELETE FROM Sched_Message "
+		"WHERE id IN ("
+		"	SELECT id FROM Sched_Message WHERE ((next_run + expire) <= ?) LIMIT ?"
+		");";
+	return _sqlite_exec(MODEL_DB_INDEX_SCHED, 1, query, args, LEN(args));
+}
+
+
 int
-model_sched_message_add(const ModelSchedMessage *s, time_t interval_s)
+model_sched_message_add(const ModelSchedMessage *s)
 {
 	Data args[] = {
 		_ARG_INT(s->type),
@@ -724,7 +1360,7 @@ model_sched_message_add(const ModelSchedMessage *s, time_t interval_s)
 		_ARG_INT64(s->message_id),
 		_ARG_INT64(s->user_id),
 		_ARG_TEXT(s->value_in, -1),
-		_ARG_INT64(time(NULL) + interval_s),
+		_ARG_INT64(s->next_run),
 		_ARG_INT64(s->expire),
 	};
 
@@ -741,57 +1377,27 @@ model_sched_message_add(const ModelSchedMessage *s, time_t interval_s)
 		"INSERT INTO Sched_Message(type, chat_id, message_id, user_id, value, next_run, expire) "
 		"VALUES(?, ?, ?, ?, ?, ?, ?);";
 
-	return _sqlite_exec(MODEL_DB_INDEX_SCHED, 1, query, args, LEN(args));
-}
-
-/*
- * ModelSessionCmd
- */
-int
-model_session_cmd_add(const ModelSessionCmd *s)
-{
-	const Data args[] = {
-		_ARG_INT64(s->chat_id),
-		_ARG_INT64(s->user_id),
-		_ARG_TEXT(s->ctx, -1),
-		_ARG_INT64(time(NULL)),
-	};
-
-	const char *query =
-		"SELECT 1 FROM Session_Cmd "
-		"WHERE (chat_id = ?) AND (user_id = ?) AND (ctx = LOWER(?)) "
-			"AND ((? - created_at) < " MODEL_SESSION_CMD_DEF_EXP ") "
-		"ORDER BY id DESC "
-		"LIMIT 1;";
-
-	const int ret = _sqlite_query_one(MODEL_DB_INDEX_SESSION, query, args, LEN(args), NULL, 0);
-	if (ret < 0)
+	DbConn *const conn = sqlite_pool_get(MODEL_DB_INDEX_SCHED);
+	if (conn == NULL)
 		return -1;
-	if (ret > 0)
-		return -2;
-
-	query = "INSERT INTO Session_Cmd(chat_id, user_id, ctx, created_at) VALUES(?, ?, LOWER(?), ?);";
-	if (_sqlite_exec(MODEL_DB_INDEX_SESSION, 0, query, args, LEN(args)) > 0)
-		return 0;
 
-	// nothing or failed to insert
-	return -1;
-}
+	sqlite3_stmt *stmt;
+	int ret = _sqlite_prep(conn->sql, query, -1, args, LEN(args), &stmt);
+	if (ret < 0)
+		goto out0;
 
+	ret = _sqlite_step_one_wait(conn->sql, stmt);
+	if (ret < 0)
+		goto out1;
 
-int
-model_session_cmd_delete(const ModelSessionCmd *s)
-{
-	const Data args[] = {
-		_ARG_INT64(s->chat_id),
-		_ARG_INT64(s->user_id),
-		_ARG_TEXT(s->ctx, -1),
-	};
+	/* same connection, nothing else ran on it in between */
+	ret = (int)sqlite3_last_insert_rowid(conn->sql);
 
-	const char *const query =
-		"DELETE FROM Session_Cmd "
-		"WHERE (chat_id = ?) AND (user_id = ?) AND (ctx = LOWER(?));";
-	return _sqlite_exec(MODEL_DB_INDEX_SESSION, 0, query, args, LEN(args));
+out1:
+	sqlite3_finalize(stmt);
+out0:
+	sqlite_pool_put(conn);
+	return ret;
 }
 
 
@@ -1042,12 +1648,19 @@ _sqlite_step_one(sqlite3_stmt *stmt)
 static int
 _sqlite_step_one_wait(sqlite3 *sql, sqlite3_stmt *stmt)
 {
+	int64_t wait_ms;
 	while (ev_is_alive()) {
 		const int ret = sqlite3_step(stmt);
 		switch (ret) {
 		case SQLITE_BUSY:
 			LOG_INFO("model", "sqlite3_step: %s", sqlite3_errstr(ret));
-			sqlite3_busy_timeout(sql, CFG_DB_WAIT);
+			wait_ms = deadline_remain_ms(CFG_DB_WAIT);
+			if (wait_ms == 0) {
+				LOG_ERRN("model", "%s", "sqlite3_step: deadline exceeded");
+				return -1;
+			}
+
+			sqlite3_busy_timeout(sql, (int)wait_ms);
 			continue;
 		case SQLITE_DONE: return 0;
 		case SQLITE_ROW: return 1;
@@ -1154,6 +1767,762 @@ out0:
 }
 
 
+/*
+ * CmdCache
+ */
+static int
+_cmd_cache_init(void)
+{
+	memset(&_cmd_cache, 0, sizeof(_cmd_cache));
+	if (mtx_init(&_cmd_cache.mutex, mtx_plain) != thrd_success) {
+		LOG_ERRN("model", "%s", "mtx_init: failed");
+		return -1;
+	}
+
+	_cmd_cache.version = -1;
+	_cmd_cache.is_ready = 1;
+	return 0;
+}
+
+
+/* the caller must hold the mutex */
+static void
+_cmd_cache_flush(void)
+{
+	for (unsigned i = 0; i < CFG_CMD_CACHE_BUCKETS; i++) {
+		CmdCacheEntry *entry = _cmd_cache.buckets[i];
+		while (entry != NULL) {
+			CmdCacheEntry *const next = entry->next;
+			free(entry);
+			entry = next;
+		}
+
+		_cmd_cache.buckets[i] = NULL;
+	}
+
+	_cmd_cache.count = 0;
+	_cmd_cache.gen++;
+}
+
+
+static void
+_cmd_cache_deinit(void)
+{
+	if (_cmd_cache.is_ready == 0)
+		return;
+
+	_cmd_cache_flush();
+	mtx_destroy(&_cmd_cache.mutex);
+	_cmd_cache.is_ready = 0;
+}
+
+
+static unsigned
+_cmd_cache_hash(int type, int64_t chat_id, const char name[])
+{
+	const uint64_t hash = fnv1a_cstr(fnv1a(FNV1A_INIT ^ (uint64_t)type, &chat_id, sizeof(chat_id)), name, 0);
+
+	return (unsigned)(hash % CFG_CMD_CACHE_BUCKETS);
+}
+
+
+/*
+ * Writes made outside this process (extern commands, sqlite3 shell) are only visible through
+ * Cmd_Version, checked at most once per CFG_CMD_CACHE_CHECK_MS.
+ */
+static void
+_cmd_cache_validate(void)
+{
+	const int64_t now = time_now_ms();
+	int64_t checked_at = atomic_load(&_cmd_cache.checked_at);
+	if ((now - checked_at) < CFG_CMD_CACHE_CHECK_MS)
+		return;
+
+	if (atomic_compare_exchange_strong(&_cmd_cache.checked_at, &checked_at, now) == 0)
+		return;
+
+	int64_t version = 0;
+	Data out = _OUT_INT64(&version);
+	const char *const query = "SELECT version FROM Cmd_Version WHERE (id = 1);";
+	if (_sqlite_query_one(MODEL_DB_INDEX_MAIN, query, NULL, 0, &out, 1) <= 0)
+		return;
+
+	mtx_lock(&_cmd_cache.mutex);
+	if (_cmd_cache.version != version) {
+		LOG_DEBUG("model", "cmd cache: version: %" PRIi64 " -> %" PRIi64 ": flush",
+			  _cmd_cache.version, version);
+
+		_cmd_cache_flush();
+		_cmd_cache.version = version;
+	}
+	mtx_unlock(&_cmd_cache.mutex);
+}
+
+
+/* ret: -1: miss, 0: negative hit, 1: hit; on miss, 'gen' must be passed back to _cmd_cache_put() */
+static int
+_cmd_cache_get(int type, int64_t chat_id, const char name[], void *value, size_t size,
+	       uint64_t *gen)
+{
+	if (_cmd_cache.is_ready == 0)
+		return -1;
+
+	_cmd_cache_validate();
+
+	int ret = -1;
+	const unsigned index = _cmd_cache_hash(type, chat_id, name);
+
+	mtx_lock(&_cmd_cache.mutex);
+
+	const CmdCacheEntry *entry = _cmd_cache.buckets[index];
+	for (; entry != NULL; entry = entry->next) {
+		if ((entry->type != type) || (entry->chat_id != chat_id))
+			continue;
+
+		if (strcmp(entry->name, name) != 0)
+			continue;
+
+		if (entry->value_size == 0) {
+			ret = 0;
+			break;
+		}
+
+		if (type == _CMD_CACHE_TYPE_MESSAGE)
+			cstr_copy_n(value, size, entry->value);
+		else
+			memcpy(value, entry->value, MIN(size, entry->value_size));
+
+		ret = 1;
+		break;
+	}
+
+	*gen = _cmd_cache.gen;
+	mtx_unlock(&_cmd_cache.mutex);
+	return ret;
+}
+
+
+/*
+ * 'gen' from the miss: a flush or delete since then may have raced with the query, the value
+ * could be older than what was just invalidated.
+ */
+static void
+_cmd_cache_put(int type, int64_t chat_id, const char name[], const void *value, size_t size,
+	       uint64_t gen)
+{
+	if (_cmd_cache.is_ready == 0)
+		return;
+
+	if (strlen(name) >= MODEL_CMD_NAME_SIZE)
+		return;
+
+	CmdCacheEntry *const new_entry = malloc(sizeof(CmdCacheEntry) + size);
+	if (new_entry == NULL)
+		return;
+
+	new_entry->type = type;
+	new_entry->chat_id = chat_id;
+	new_entry->value_size = size;
+	cstr_copy_n(new_entry->name, LEN(new_entry->name), name);
+	if (size > 0)
+		memcpy(new_entry->value, value, size);
+
+	const unsigned index = _cmd_cache_hash(type, chat_id, name);
+
+	mtx_lock(&_cmd_cache.mutex);
+	if (_cmd_cache.gen != gen) {
+		mtx_unlock(&_cmd_cache.mutex);
+		free(new_entry);
+		return;
+	}
+
+	/* another reader may have filled it meanwhile */
+	CmdCacheEntry **entry = &_cmd_cache.buckets[index];
+	for (; *entry != NULL; entry = &(*entry)->next) {
+		CmdCacheEntry *const curr = *entry;
+		if ((curr->type != type) || (curr->chat_id != chat_id) || (strcmp(curr->name, name) != 0))
+			continue;
+
+		new_entry->next = curr->next;
+		*entry = new_entry;
+		free(curr);
+		goto out0;
+	}
+
+	/* bounded: start over instead of tracking recency */
+	if (_cmd_cache.count >= CFG_CMD_CACHE_SIZE)
+		_cmd_cache_flush();
+
+	new_entry->next = _cmd_cache.buckets[index];
+	_cmd_cache.buckets[index] = new_entry;
+	_cmd_cache.count++;
+
+out0:
+	mtx_unlock(&_cmd_cache.mutex);
+}
+
+
+static void
+_cmd_cache_del(int type, int64_t chat_id, const char name[])
+{
+	if (_cmd_cache.is_ready == 0)
+		return;
+
+	const unsigned index = _cmd_cache_hash(type, chat_id, name);
+
+	mtx_lock(&_cmd_cache.mutex);
+
+	CmdCacheEntry **entry = &_cmd_cache.buckets[index];
+	while (*entry != NULL) {
+		CmdCacheEntry *const curr = *entry;
+		if ((curr->type != type) || (curr->chat_id != chat_id) || (strcmp(curr->name, name) != 0)) {
+			entry = &curr->next;
+			continue;
+		}
+
+		*entry = curr->next;
+		free(curr);
+		_cmd_cache.count--;
+	}
+
+	_cmd_cache.gen++;
+	mtx_unlock(&_cmd_cache.mutex);
+}
+
+
+/*
+ * ChatCache
+ */
+static int
+_chat_cache_init(void)
+{
+	memset(&_chat_cache, 0, sizeof(_chat_cache));
+
+	int i = 0;
+	for (; i < CFG_CHAT_CACHE_SHARDS; i++) {
+		ChatCacheShard *const shard = &_chat_cache.shards[i];
+		if (mtx_init(&shard->mutex, mtx_plain) != thrd_success) {
+			LOG_ERRN("model", "%s", "mtx_init: failed");
+			goto err0;
+		}
+
+		shard->lru.prev = &shard->lru;
+		shard->lru.next = &shard->lru;
+	}
+
+	_chat_cache.is_ready = 1;
+	return 0;
+
+err0:
+	while (i-- > 0)
+		mtx_destroy(&_chat_cache.shards[i].mutex);
+
+	return -1;
+}
+
+
+static void
+_chat_cache_deinit(void)
+{
+	if (_chat_cache.is_ready == 0)
+		return;
+
+	for (int i = 0; i < CFG_CHAT_CACHE_SHARDS; i++)
+		mtx_destroy(&_chat_cache.shards[i].mutex);
+
+	_chat_cache.is_ready = 0;
+}
+
+
+static uint64_t
+_chat_cache_hash(int64_t chat_id)
+{
+	/* splitmix64 finalizer: chat ids are sequential-ish and mostly negative */
+	uint64_t x = (uint64_t)chat_id;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+	return x ^ (x >> 31);
+}
+
+
+static unsigned
+_chat_cache_bucket(int64_t chat_id)
+{
+	return (unsigned)((_chat_cache_hash(chat_id) >> 32) % CFG_CHAT_CACHE_SIZE);
+}
+
+
+static ChatCacheShard *
+_chat_cache_shard(int64_t chat_id, unsigned *bucket)
+{
+	*bucket = _chat_cache_bucket(chat_id);
+	return &_chat_cache.shards[_chat_cache_hash(chat_id) % CFG_CHAT_CACHE_SHARDS];
+}
+
+
+static void
+_chat_cache_lru_unlink(ChatCacheEntry *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+
+static void
+_chat_cache_lru_push(ChatCacheShard *shard, ChatCacheEntry *entry)
+{
+	entry->prev = &shard->lru;
+	entry->next = shard->lru.next;
+	shard->lru.next->prev = entry;
+	shard->lru.next = entry;
+}
+
+
+/* the caller must hold the shard mutex */
+static ChatCacheEntry *
+_chat_cache_find(ChatCacheShard *shard, unsigned bucket, int64_t chat_id)
+{
+	ChatCacheEntry *entry = shard->buckets[bucket];
+	for (; entry != NULL; entry = entry->hnext) {
+		if (entry->chat_id == chat_id)
+			return entry;
+	}
+
+	return NULL;
+}
+
+
+/* the caller must hold the shard mutex */
+static void
+_chat_cache_unlink(ChatCacheShard *shard, ChatCacheEntry *entry)
+{
+	ChatCacheEntry **curr = &shard->buckets[_chat_cache_bucket(entry->chat_id)];
+	while (*curr != entry)
+		curr = &(*curr)->hnext;
+
+	*curr = entry->hnext;
+	_chat_cache_lru_unlink(entry);
+}
+
+
+/* the caller must hold the shard mutex */
+static void
+_chat_cache_insert(ChatCacheShard *shard, unsigned bucket, int64_t chat_id, int flags)
+{
+	ChatCacheEntry *entry = _chat_cache_find(shard, bucket, chat_id);
+	if (entry != NULL) {
+		_chat_cache_lru_unlink(entry);
+	} else {
+		if (shard->free != NULL) {
+			entry = shard->free;
+			shard->free = entry->hnext;
+		} else if (shard->used < CFG_CHAT_CACHE_SIZE) {
+			entry = &shard->entries[shard->used++];
+		} else {
+			/* evict the least recently used one */
+			entry = shard->lru.prev;
+			_chat_cache_unlink(shard, entry);
+		}
+
+		entry->chat_id = chat_id;
+		entry->hnext = shard->buckets[bucket];
+		shard->buckets[bucket] = entry;
+	}
+
+	entry->flags = flags;
+	_chat_cache_lru_push(shard, entry);
+}
+
+
+/* ret: 1: hit, 0: miss; on miss, 'gen' must be passed back to _chat_cache_fill() */
+static int
+_chat_cache_get(int64_t chat_id, int *flags, uint64_t *gen)
+{
+	if (_chat_cache.is_ready == 0)
+		return 0;
+
+	int ret = 0;
+	unsigned bucket;
+	ChatCacheShard *const shard = _chat_cache_shard(chat_id, &bucket);
+
+	mtx_lock(&shard->mutex);
+
+	ChatCacheEntry *const entry = _chat_cache_find(shard, bucket, chat_id);
+	if (entry != NULL) {
+		_chat_cache_lru_unlink(entry);
+		_chat_cache_lru_push(shard, entry);
+		*flags = entry->flags;
+		ret = 1;
+	}
+
+	*gen = shard->gen;
+	mtx_unlock(&shard->mutex);
+	return ret;
+}
+
+
+/* lazy load: dropped if a write-through happened since _chat_cache_get() */
+static void
+_chat_cache_fill(int64_t chat_id, int flags, uint64_t gen)
+{
+	if (_chat_cache.is_ready == 0)
+		return;
+
+	unsigned bucket;
+	ChatCacheShard *const shard = _chat_cache_shard(chat_id, &bucket);
+
+	mtx_lock(&shard->mutex);
+	if (shard->gen == gen)
+		_chat_cache_insert(shard, bucket, chat_id, flags);
+	mtx_unlock(&shard->mutex);
+}
+
+
+static void
+_chat_cache_set(int64_t chat_id, int flags)
+{
+	if (_chat_cache.is_ready == 0)
+		return;
+
+	unsigned bucket;
+	ChatCacheShard *const shard = _chat_cache_shard(chat_id, &bucket);
+
+	mtx_lock(&shard->mutex);
+	_chat_cache_insert(shard, bucket, chat_id, flags);
+	shard->gen++;
+	mtx_unlock(&shard->mutex);
+}
+
+
+static void
+_chat_cache_del(int64_t chat_id)
+{
+	if (_chat_cache.is_ready == 0)
+		return;
+
+	unsigned bucket;
+	ChatCacheShard *const shard = _chat_cache_shard(chat_id, &bucket);
+
+	mtx_lock(&shard->mutex);
+
+	ChatCacheEntry *const entry = _chat_cache_find(shard, bucket, chat_id);
+	if (entry != NULL) {
+		_chat_cache_unlink(shard, entry);
+		entry->hnext = shard->free;
+		shard->free = entry;
+	}
+
+	shard->gen++;
+	mtx_unlock(&shard->mutex);
+}
+
+
+/*
+ * AdminCache
+ */
+static int
+_admin_cache_init(void)
+{
+	memset(&_admin_cache, 0, sizeof(_admin_cache));
+	if (mtx_init(&_admin_cache.mutex, mtx_plain) != thrd_success) {
+		LOG_ERRN("model", "%s", "mtx_init: failed");
+		return -1;
+	}
+
+	_admin_cache.is_ready = 1;
+	return 0;
+}
+
+
+static void
+_admin_cache_deinit(void)
+{
+	if (_admin_cache.is_ready == 0)
+		return;
+
+	for (unsigned i = 0; i < CFG_ADMIN_CACHE_SIZE; i++) {
+		AdminCacheEntry *entry = _admin_cache.buckets[i];
+		while (entry != NULL) {
+			AdminCacheEntry *const next = entry->next;
+			free(entry);
+			entry = next;
+		}
+	}
+
+	mtx_destroy(&_admin_cache.mutex);
+	_admin_cache.is_ready = 0;
+}
+
+
+static unsigned
+_admin_cache_bucket(int64_t chat_id)
+{
+	return (unsigned)(_chat_cache_hash(chat_id) % CFG_ADMIN_CACHE_SIZE);
+}
+
+
+/* the caller must hold the mutex */
+static AdminCacheEntry **
+_admin_cache_find(int64_t chat_id)
+{
+	AdminCacheEntry **entry = &_admin_cache.buckets[_admin_cache_bucket(chat_id)];
+	while ((*entry != NULL) && ((*entry)->chat_id != chat_id))
+		entry = &(*entry)->next;
+
+	return entry;
+}
+
+
+/* the caller must hold the mutex */
+static void
+_admin_cache_evict(int64_t now)
+{
+	AdminCacheEntry **oldest = NULL;
+	for (unsigned i = 0; i < CFG_ADMIN_CACHE_SIZE; i++) {
+		AdminCacheEntry **entry = &_admin_cache.buckets[i];
+		while (*entry != NULL) {
+			AdminCacheEntry *const curr = *entry;
+			if (curr->expire_at <= now) {
+				*entry = curr->next;
+				free(curr);
+				_admin_cache.count--;
+				continue;
+			}
+
+			if ((oldest == NULL) || (curr->expire_at < (*oldest)->expire_at))
+				oldest = entry;
+
+			entry = &curr->next;
+		}
+	}
+
+	if ((_admin_cache.count < CFG_ADMIN_CACHE_SIZE) || (oldest == NULL))
+		return;
+
+	AdminCacheEntry *const curr = *oldest;
+	*oldest = curr->next;
+	free(curr);
+	_admin_cache.count--;
+}
+
+
+/* ret: -1: miss, >= 0: privileges (0: not an admin) */
+static int
+_admin_cache_get(int64_t chat_id, int64_t user_id, uint64_t *gen)
+{
+	if (_admin_cache.is_ready == 0)
+		return -1;
+
+	int ret = -1;
+	const int64_t now = time_now_ms();
+
+	mtx_lock(&_admin_cache.mutex);
+
+	*gen = _admin_cache.gen;
+	AdminCacheEntry **const entry = _admin_cache_find(chat_id);
+	AdminCacheEntry *const curr = *entry;
+	if (curr == NULL)
+		goto out0;
+
+	if (curr->expire_at <= now) {
+		*entry = curr->next;
+		free(curr);
+		_admin_cache.count--;
+		goto out0;
+	}
+
+	int left = 0;
+	int right = curr->len - 1;
+	ret = 0;
+	while (left <= right) {
+		const int mid = left + ((right - left) / 2);
+		const int64_t id = curr->items[mid].user_id;
+		if (id == user_id) {
+			ret = curr->items[mid].privileges;
+			break;
+		}
+
+		if (id < user_id)
+			left = mid + 1;
+		else
+			right = mid - 1;
+	}
+
+out0:
+	mtx_unlock(&_admin_cache.mutex);
+	return ret;
+}
+
+
+static int
+_admin_cache_item_cmp(const void *a, const void *b)
+{
+	const int64_t x = ((const AdminCacheItem *)a)->user_id;
+	const int64_t y = ((const AdminCacheItem *)b)->user_id;
+	return (x > y) - (x < y);
+}
+
+
+/*
+ * 'gen' == NULL: write-through, always replaces the entry.
+ * Otherwise: lazy load, dropped if the chat was reloaded or invalidated since _admin_cache_get().
+ */
+static void
+_admin_cache_put(int64_t chat_id, AdminCacheItem items[], int len, uint64_t *gen)
+{
+	if (_admin_cache.is_ready == 0)
+		return;
+
+	AdminCacheEntry *const new_entry = malloc(sizeof(AdminCacheEntry) +
+						  (sizeof(AdminCacheItem) * (size_t)len));
+	if (new_entry == NULL)
+		return;
+
+	if (len > 0) {
+		qsort(items, (size_t)len, sizeof(AdminCacheItem), _admin_cache_item_cmp);
+		memcpy(new_entry->items, items, sizeof(AdminCacheItem) * (size_t)len);
+	}
+
+	const int64_t now = time_now_ms();
+	new_entry->chat_id = chat_id;
+	new_entry->expire_at = now + (CFG_ADMIN_CACHE_TTL_S * 1000);
+	new_entry->len = len;
+
+	mtx_lock(&_admin_cache.mutex);
+
+	if ((gen != NULL) && (*gen != _admin_cache.gen)) {
+		free(new_entry);
+		goto out0;
+	}
+
+	AdminCacheEntry **const entry = _admin_cache_find(chat_id);
+	if (*entry != NULL) {
+		AdminCacheEntry *const old_entry = *entry;
+		new_entry->next = old_entry->next;
+		*entry = new_entry;
+		free(old_entry);
+	} else {
+		if (_admin_cache.count >= CFG_ADMIN_CACHE_SIZE)
+			_admin_cache_evict(now);
+
+		AdminCacheEntry **const bucket = &_admin_cache.buckets[_admin_cache_bucket(chat_id)];
+		new_entry->next = *bucket;
+		*bucket = new_entry;
+		_admin_cache.count++;
+	}
+
+	if (gen == NULL)
+		_admin_cache.gen++;
+
+out0:
+	mtx_unlock(&_admin_cache.mutex);
+}
+
+
+static void
+_admin_cache_del(int64_t chat_id)
+{
+	if (_admin_cache.is_ready == 0)
+		return;
+
+	mtx_lock(&_admin_cache.mutex);
+
+	AdminCacheEntry **const entry = _admin_cache_find(chat_id);
+	if (*entry != NULL) {
+		AdminCacheEntry *const curr = *entry;
+		*entry = curr->next;
+		free(curr);
+		_admin_cache.count--;
+	}
+
+	_admin_cache.gen++;
+	mtx_unlock(&_admin_cache.mutex);
+}
+
+
+/*
+ * ResultCache
+ */
+static int
+_result_cache_init(void)
+{
+	memset(&_result_cache, 0, sizeof(_result_cache));
+	if (mtx_init(&_result_cache.mutex, mtx_plain) != thrd_success) {
+		LOG_ERRN("model", "%s", "mtx_init: failed");
+		return -1;
+	}
+
+	_result_cache.is_ready = 1;
+	return 0;
+}
+
+
+static void
+_result_cache_deinit(void)
+{
+	if (_result_cache.is_ready == 0)
+		return;
+
+	for (unsigned i = 0; i < CFG_RESULT_CACHE_SIZE; i++) {
+		ResultCacheEntry *entry = _result_cache.buckets[i];
+		while (entry != NULL) {
+			ResultCacheEntry *const next = entry->next;
+			free(entry);
+			entry = next;
+		}
+	}
+
+	mtx_destroy(&_result_cache.mutex);
+	_result_cache.is_ready = 0;
+}
+
+
+/* the caller must hold the mutex */
+static ResultCacheEntry **
+_result_cache_find(const char key[])
+{
+	const uint64_t hash = fnv1a_cstr(FNV1A_INIT, key, 0);
+	ResultCacheEntry **entry = &_result_cache.buckets[hash % CFG_RESULT_CACHE_SIZE];
+	while ((*entry != NULL) && (strcmp((*entry)->key, key) != 0))
+		entry = &(*entry)->next;
+
+	return entry;
+}
+
+
+/* the caller must hold the mutex */
+static void
+_result_cache_evict(int64_t now)
+{
+	ResultCacheEntry **oldest = NULL;
+	for (unsigned i = 0; i < CFG_RESULT_CACHE_SIZE; i++) {
+		ResultCacheEntry **entry = &_result_cache.buckets[i];
+		while (*entry != NULL) {
+			ResultCacheEntry *const curr = *entry;
+			if (curr->expire_at <= now) {
+				*entry = curr->next;
+				free(curr);
+				_result_cache.count--;
+				continue;
+			}
+
+			if ((oldest == NULL) || (curr->expire_at < (*oldest)->expire_at))
+				oldest = entry;
+
+			entry = &curr->next;
+		}
+	}
+
+	if ((_result_cache.count < CFG_RESULT_CACHE_SIZE) || (oldest == NULL))
+		return;
+
+	ResultCacheEntry *const curr = *oldest;
+	*oldest = curr->next;
+	free(curr);
+	_result_cache.count--;
+}
+
+
 /*
  * InitQueries
  */
@@ -1226,7 +2595,8 @@ _admin_query(Str *str)
 		"	is_anonymous	BOOLEAN NOT Null,\n"
 		"	privileges	INTEGER NOT NUll,\n"
 		"	created_at	TIMESTAMP NOT Null\n"
-		");",
+		");\n"
+		"CREATE INDEX IF NOT EXISTS Admin_chat_id_user_id ON Admin(chat_id, user_id);",
 		(MODEL_USER_FIRST_NAME_SIZE - 1)
 	);
 }
@@ -1266,6 +2636,23 @@ _cmd_extern_query(Str *str)
 }
 
 
+/* per-command limits of Cmd_Extern, enforced by chld_spawn() */
+static const char *
+_cmd_extern_limit_query(Str *str)
+{
+	return str_set_fmt(str,
+		"CREATE TABLE IF NOT EXISTS Cmd_Extern_Limit(\n"
+		"	name		VARCHAR(%d) PRIMARY KEY,\n"
+		"	timeout_s	INTEGER NOT Null DEFAULT 0,\n"
+		"	cpu_s		INTEGER NOT Null DEFAULT 0,\n"
+		"	mem_mb		INTEGER NOT Null DEFAULT 0,\n"
+		"	cgroup		VARCHAR(%d) Null\n"
+		");",
+		(MODEL_CMD_NAME_SIZE - 1), (MODEL_CMD_EXTERN_CGROUP_SIZE - 1)
+	);
+}
+
+
 static const char *
 _cmd_message_query(Str *str)
 {
@@ -1286,18 +2673,34 @@ _cmd_message_query(Str *str)
 
 
 static const char *
-_session_cmd_query(Str *str)
+_cmd_version_query(Str *str)
 {
-	return str_set_fmt(str,
-		"CREATE TABLE IF NOT EXISTS Session_Cmd(\n"
-		"	id		INTEGER PRIMARY KEY AUTOINCREMENT,\n"
-		"	chat_id		BIGINT NOT Null,\n"
-		"	user_id		BIGINT NOT Null,\n"
-		"	ctx		VARCHAR(%d) NOT Null,\n"
-		"	created_at	TIMESTAMP NOT Null\n"
-		");",
-		(MODEL_CMD_NAME_SIZE - 1)
+	const char *ret = str_set(str,
+		"CREATE TABLE IF NOT EXISTS Cmd_Version(\n"
+		"	id		INTEGER PRIMARY KEY CHECK (id = 1),\n"
+		"	version		BIGINT NOT Null\n"
+		");\n"
+		"INSERT OR IGNORE INTO Cmd_Version(id, version) VALUES(1, 0);\n"
 	);
+
+	const char *const tables[] = { "Cmd_Builtin", "Cmd_Extern", "Cmd_Extern_Limit", "Cmd_Message" };
+	const char *const events[] = { "INSERT", "UPDATE", "DELETE" };
+	for (size_t i = 0; i < LEN(tables); i++) {
+		for (size_t j = 0; j < LEN(events); j++) {
+			if (ret == NULL)
+				return NULL;
+
+			ret = str_append_fmt(str,
+				"CREATE TRIGGER IF NOT EXISTS %s_Version_%s AFTER %s ON %s\n"
+				"BEGIN\n"
+				"	UPDATE Cmd_Version SET version = (version + 1) WHERE (id = 1);\n"
+				"END;\n",
+				tables[i], events[j], events[j], tables[i]
+			);
+		}
+	}
+
+	return ret;
 }
 
 
@@ -1314,7 +2717,8 @@ _sched_message_query(Str *str)
 		"	value		VARCHAR(%d) Null,\n"
 		"	next_run	TIMESTAMP NOT Null,\n"
 		"	expire		TIMESTAMP NOT Null\n"
-		");",
+		");\n"
+		"CREATE INDEX IF NOT EXISTS Sched_Message_expire_at ON Sched_Message(next_run + expire);",
 		(MODEL_SCHED_MESSAGE_VALUE_SIZE - 1)
 	);
 }
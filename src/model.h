@@ -16,7 +16,8 @@ enum {
 };
 
 
-int model_init(void);
+int  model_init(void);
+void model_deinit(void);
 
 
 #define MODEL_USER_FIRST_NAME_SIZE (65)
@@ -61,6 +62,8 @@ typedef struct model_admin {
 int model_admin_reload(const ModelAdmin list[], int len);
 int model_admin_get_privileges(int64_t chat_id, int64_t user_id);
 int model_admin_get_list(ModelAdmin list[], int len, int64_t chat_id);
+int model_admin_set(const ModelAdmin *a);
+int model_admin_remove(int64_t chat_id, int64_t user_id);
 
 
 /*
@@ -73,6 +76,8 @@ enum {
 	MODEL_CMD_FLAG_EXTRA                 = (1 << 3),
 	MODEL_CMD_FLAG_DISALLOW_PRIVATE_CHAT = (1 << 4),
 	MODEL_CMD_FLAG_HIDDEN                = (1 << 5),
+	MODEL_CMD_FLAG_EXTERN_WORKER         = (1 << 6),	/* Cmd_Extern: long-running, see extern/README.txt */
+	MODEL_CMD_FLAG_EXTERN_CACHE          = (1 << 7),	/* Cmd_Extern: replies are cached, see extern/README.txt */
 };
 
 #define MODEL_CMD_NAME_SIZE (32)
@@ -87,6 +92,7 @@ typedef struct model_cmd {
 
 int model_cmd_get_list(ModelCmd list[], int len, int offset, int *total, int chat_flags,
 		       int is_private);
+int model_cmd_get_version(int64_t *version);
 
 
 /*
@@ -103,12 +109,6 @@ typedef struct model_cmd_builtin {
 int model_cmd_builtin_add(const ModelCmdBuiltin *c);
 int model_cmd_builtin_clear(void);
 
-/* ret: >= 0: valid index
- *        -1: error
- *        -2: no data
- */
-int model_cmd_builtin_get_index(const char name[]);
-
 int model_cmd_builtin_is_exists(const char name[]);
 
 
@@ -116,6 +116,7 @@ int model_cmd_builtin_is_exists(const char name[]);
  * ModelCmdExtern
  */
 #define MODEL_CMD_EXTERN_FILE_NAME_SIZE (4096)
+#define MODEL_CMD_EXTERN_CGROUP_SIZE    (256)
 
 typedef struct model_cmd_extern {
 	int32_t id;
@@ -124,12 +125,36 @@ typedef struct model_cmd_extern {
 	char    name[MODEL_CMD_NAME_SIZE];
 	char    file_name[MODEL_CMD_EXTERN_FILE_NAME_SIZE];
 	char    description[MODEL_CMD_DESC_SIZE];
+
+	/* Cmd_Extern_Limit, 0/empty: default */
+	int     timeout_s;
+	int     cpu_s;
+	int     mem_mb;
+	char    cgroup[MODEL_CMD_EXTERN_CGROUP_SIZE];	/* cgroup v2 directory, e.g. "/sys/fs/cgroup/kvrt" */
 } ModelCmdExtern;
 
 int model_cmd_extern_get(ModelCmdExtern *c, const char name[]);
 int model_cmd_extern_is_exists(const char name[]);
 
 
+/*
+ * ModelCmdExternResult: in-memory, the api request (type, data) a MODEL_CMD_FLAG_EXTERN_CACHE
+ * command answered with, by command and arguments
+ */
+#define MODEL_CMD_EXTERN_RESULT_KEY_SIZE  (MODEL_CMD_NAME_SIZE + 256)
+#define MODEL_CMD_EXTERN_RESULT_TYPE_SIZE (32)
+
+/*
+ * "name:args": the arguments lowercased, whitespace collapsed, compared as is on lookup.
+ * ret: 0: success, -1: too long for 'size', not cached
+ */
+int  model_cmd_extern_result_key(char key[], size_t size, const char name[], const char args[]);
+
+/* ret: the data, free() it, NULL: miss */
+char *model_cmd_extern_result_get(const char key[], char type[], size_t type_size);
+void  model_cmd_extern_result_put(const char key[], const char type[], const char data[]);
+
+
 /*
  * ModelCmdMessage
  */
@@ -152,6 +177,20 @@ int model_cmd_message_get_value(int64_t chat_id, const char name[], char value[]
 int model_cmd_message_is_exists(const char name[]);
 
 
+/*
+ * ModelCmdResolve: everything cmd_exec() needs to dispatch a command
+ */
+typedef struct model_cmd_resolve {
+	int            chat_flags;
+	int            has_message;
+	int            has_extern;
+	char           message[MODEL_CMD_MESSAGE_VALUE_SIZE];
+	ModelCmdExtern cmd_extern;
+} ModelCmdResolve;
+
+int model_cmd_resolve(ModelCmdResolve *r, int64_t chat_id, const char name[]);
+
+
 /*
  * ModelSchedMessage
  */
@@ -176,24 +215,26 @@ typedef struct model_sched_message {
 	time_t  expire;
 } ModelSchedMessage;
 
-int model_sched_message_get_list(ModelSchedMessage *list[], int len, time_t now);
+typedef struct model_sched_time {
+	int32_t id;
+	time_t  next_run;
+	time_t  expire;
+} ModelSchedTime;
+
+int model_sched_message_get(ModelSchedMessage *s, int32_t id);
+int model_sched_message_get_times(ModelSchedTime list[], int len, int32_t after_id, time_t now);
 int model_sched_message_delete(int32_t list[], int len);
-int model_sched_message_add(const ModelSchedMessage *s, time_t interval_s);
+int model_sched_message_purge(time_t now, int limit);
+
+/* ret: the new id, -1: error */
+int model_sched_message_add(const ModelSchedMessage *s);
 
 
 /*
  * ModelSession
  */
-#define MODEL_SESSION_CMD_DEF_EXP "60"
-
-typedef struct model_session_cmd {
-	int64_t     chat_id;
-	int64_t     user_id;
-	const char *ctx;
-} ModelSessionCmd;
-
-int model_session_cmd_add(const ModelSessionCmd *s);
-int model_session_cmd_delete(const ModelSessionCmd *s);
+#define MODEL_SESSION_CMD_DEF_EXP   "60"
+#define MODEL_SESSION_CMD_DEF_EXP_S (60)
 
 
 /*
@@ -0,0 +1,852 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "rpc.h"
+
+#include "common.h"
+#include "config.h"
+#include "model.h"
+#include "tg_api.h"
+#include "util.h"
+
+
+#define _TYPE_SEND_TEXT       "send_text"
+#define _TYPE_SEND_PHOTO      "send_photo"
+#define _TYPE_SEND_ANIMATION  "send_animation"
+#define _TYPE_ANSWER_CALLBACK "answer_callback"
+#define _TYPE_DELETE_MESSAGE  "delete_message"
+#define _TYPE_SCHED_MESSAGE   "sched_message"
+#define _TYPE_SESSION         "session"
+#define _TYPE_CHLD_OUTPUT     "chld_output"
+
+
+static int _read_all(int fd, Str *str, int64_t deadline);
+static int _write_all(int fd, const char buf[], size_t len);
+
+static int _json_add_str(json_object *root, const char key[], const char value[]);
+
+static void _result_cache_put(int fd, const RpcReq *req);
+
+static int _send_text(const RpcReq *req);
+static int _send_photo(const RpcReq *req);
+static int _send_animation(const RpcReq *req);
+static int _delete_message(const RpcReq *req);
+static int _answer_callback(const RpcReq *req);
+static int _sched_message(const RpcReq *req);
+static int _session(const RpcReq *req);
+static int _chld_output(const RpcReq *req);
+
+
+/*
+ * Public
+ */
+int
+rpc_exec(const RpcReq *r)
+{
+	if (cstr_casecmp(r->type, _TYPE_SEND_TEXT))
+		return _send_text(r);
+	if (cstr_casecmp(r->type, _TYPE_SEND_PHOTO))
+		return _send_photo(r);
+	if (cstr_casecmp(r->type, _TYPE_SEND_ANIMATION))
+		return _send_animation(r);
+	if (cstr_casecmp(r->type, _TYPE_DELETE_MESSAGE))
+		return _delete_message(r);
+	if (cstr_casecmp(r->type, _TYPE_ANSWER_CALLBACK))
+		return _answer_callback(r);
+	if (cstr_casecmp(r->type, _TYPE_SCHED_MESSAGE))
+		return _sched_message(r);
+	if (cstr_casecmp(r->type, _TYPE_SESSION))
+		return _session(r);
+	if (cstr_casecmp(r->type, _TYPE_CHLD_OUTPUT))
+		return _chld_output(r);
+
+	rpc_add_response(r, "invalid api type!");
+	return -1;
+}
+
+
+int
+rpc_add_response(const RpcReq *req, const char error[])
+{
+	if (_json_add_str(req->resp, "type", req->type) < 0)
+		return -1;
+	if (_json_add_str(req->resp, "name", req->name) < 0)
+		return -1;
+	if (_json_add_str(req->resp, "proc", req->proc) < 0)
+		return -1;
+
+	return _json_add_str(req->resp, "error", error);
+}
+
+
+int
+rpc_serve(int fd)
+{
+	int ret = -1;
+	Str str;
+	if (str_init_alloc(&str, 4096, NULL) < 0)
+		return -1;
+
+	if (_read_all(fd, &str, time_now_ms() + CFG_RPC_IO_TIMEOUT_MS) < 0)
+		goto out0;
+
+	json_object *const resp_obj = json_object_new_object();
+	if (resp_obj == NULL)
+		goto out0;
+
+	json_object *const req_obj = json_tokener_parse(str.cstr);
+	RpcReq req = {
+		.type = "undefined",
+		.name = "undefined",
+		.proc = "undefined",
+		.resp = resp_obj,
+	};
+
+	json_object *obj;
+	if ((req_obj != NULL) && json_object_object_get_ex(req_obj, "type", &obj))
+		req.type = json_object_get_string(obj);
+	if ((req_obj != NULL) && json_object_object_get_ex(req_obj, "name", &obj))
+		req.name = json_object_get_string(obj);
+	if ((req_obj != NULL) && json_object_object_get_ex(req_obj, "proc", &obj))
+		req.proc = json_object_get_string(obj);
+	if (req_obj != NULL)
+		json_object_object_get_ex(req_obj, "data", &req.data);
+
+	int res;
+	if (req.data == NULL) {
+		rpc_add_response(&req, "'Data': failed to parse");
+		res = -1;
+	} else {
+		LOG_DEBUG("rpc", "%s: %s: %s", req.proc, req.name, req.type);
+		res = rpc_exec(&req);
+	}
+
+	if ((res == 0) && (cstr_casecmp(req.type, _TYPE_SEND_TEXT) || cstr_casecmp(req.type, _TYPE_SEND_PHOTO)))
+		_result_cache_put(fd, &req);
+
+	json_object *const root = json_object_new_object();
+	if (root == NULL) {
+		json_object_put(resp_obj);
+		goto out1;
+	}
+
+	json_object_object_add(root, "ret", json_object_new_int(res));
+	json_object_object_add(root, "resp", resp_obj);
+
+	size_t len;
+	const char *const resp_str = json_object_to_json_string_length(root, JSON_C_TO_STRING_PLAIN, &len);
+	if (resp_str != NULL)
+		ret = _write_all(fd, resp_str, len);
+
+	json_object_put(root);
+
+out1:
+	json_object_put(req_obj);
+out0:
+	str_deinit(&str);
+	return ret;
+}
+
+
+int
+rpc_call(const char path[], const RpcReq *r, json_object **resp, int *res)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (cstr_copy_n(addr.sun_path, LEN(addr.sun_path), path) != strlen(path))
+		return -2;
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -2;
+
+	int ret = -2;
+	json_object *req_obj = NULL;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		goto out0;
+
+	/* from here on, the server may get the request: running it locally too would run it twice */
+	ret = -1;
+
+	req_obj = json_object_new_object();
+	if (req_obj == NULL)
+		goto out0;
+
+	json_object_object_add(req_obj, "type", json_object_new_string(r->type));
+	json_object_object_add(req_obj, "name", json_object_new_string(r->name));
+	json_object_object_add(req_obj, "proc", json_object_new_string(r->proc));
+	json_object_object_add(req_obj, "data", json_object_get(r->data));
+
+	size_t len;
+	const char *const req_str = json_object_to_json_string_length(req_obj, JSON_C_TO_STRING_PLAIN, &len);
+	if ((req_str == NULL) || (_write_all(fd, req_str, len) < 0))
+		goto out0;
+
+	shutdown(fd, SHUT_WR);
+
+	Str str;
+	if (str_init_alloc(&str, 1024, NULL) < 0)
+		goto out0;
+
+	if (_read_all(fd, &str, 0) < 0)
+		goto out1;
+
+	json_object *const root = json_tokener_parse(str.cstr);
+	if (root == NULL)
+		goto out1;
+
+	json_object *ret_obj;
+	json_object *resp_obj;
+	if (json_object_object_get_ex(root, "ret", &ret_obj) &&
+	    json_object_object_get_ex(root, "resp", &resp_obj)) {
+		*res = json_object_get_int(ret_obj);
+		*resp = json_object_get(resp_obj);
+		ret = 0;
+	}
+
+	json_object_put(root);
+
+out1:
+	str_deinit(&str);
+out0:
+	json_object_put(req_obj);
+	close(fd);
+	return ret;
+}
+
+
+/*
+ * Private
+ */
+/* 'deadline': time_now_ms() based, for the whole message, 0: none */
+static int
+_read_all(int fd, Str *str, int64_t deadline)
+{
+	char buffer[4096];
+	while (1) {
+		const ssize_t rd = read(fd, buffer, sizeof(buffer));
+		if (rd < 0) {
+			if (errno == EINTR)
+				continue;
+
+			LOG_ERRP("rpc", "%s", "read");
+			return -1;
+		}
+
+		if (rd == 0)
+			break;
+
+		if ((str->len + (size_t)rd) > CFG_RPC_MSG_SIZE) {
+			LOG_ERRN("rpc", "%s", "read: message is too large");
+			return -1;
+		}
+
+		if (str_append_n(str, buffer, (size_t)rd) == NULL)
+			return -1;
+
+		if ((deadline > 0) && (time_now_ms() >= deadline)) {
+			LOG_ERRN("rpc", "%s", "read: timed out");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+static int
+_write_all(int fd, const char buf[], size_t len)
+{
+	while (len > 0) {
+		const ssize_t wr = send(fd, buf, len, MSG_NOSIGNAL);
+		if (wr < 0) {
+			if (errno == EINTR)
+				continue;
+
+			LOG_ERRP("rpc", "%s", "send");
+			return -1;
+		}
+
+		buf += wr;
+		len -= (size_t)wr;
+	}
+
+	return 0;
+}
+
+
+/*
+ * A reply of a MODEL_CMD_FLAG_EXTERN_CACHE command, see: cmd.c. The key is the server's: kept
+ * with the child it spawned, found by the client's process group. Nothing the client sends is
+ * trusted for it but the name, which has to match the key's command.
+ */
+static void
+_result_cache_put(int fd, const RpcReq *req)
+{
+	struct ucred cred;
+	socklen_t cred_len = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0) {
+		LOG_ERRP("rpc", "%s", "getsockopt: SO_PEERCRED");
+		return;
+	}
+
+	/* still running: it waits for the reply */
+	const pid_t pgid = getpgid(cred.pid);
+	if (pgid < 0)
+		return;
+
+	char key[MODEL_CMD_EXTERN_RESULT_KEY_SIZE];
+	if (chld_tag_get(pgid, key, LEN(key)) < 0)
+		return;
+
+	const size_t name_len = strlen(req->name);
+	if ((strncmp(key, req->name, name_len) != 0) || (key[name_len] != ':'))
+		return;
+
+	ModelCmdExtern ce;
+	if ((model_cmd_extern_get(&ce, req->name) <= 0) || ((ce.flags & MODEL_CMD_FLAG_EXTERN_CACHE) == 0))
+		return;
+
+	model_cmd_extern_result_put(key, req->type, json_object_to_json_string_ext(req->data, JSON_C_TO_STRING_PLAIN));
+}
+
+
+static int
+_json_add_str(json_object *root, const char key[], const char value[])
+{
+	json_object *const str_obj = json_object_new_string(value);
+	if (str_obj == NULL)
+		return -1;
+
+	if (json_object_object_add(root, key, str_obj) != 0) {
+		json_object_put(str_obj);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+_send_text(const RpcReq *req)
+{
+	int ret = -1;
+	int64_t ret_id = 0;
+	const char  *error = "";
+
+	json_object *type_obj;
+	if (json_object_object_get_ex(req->data, "type", &type_obj) == 0) {
+		error = "no 'type' field";
+		goto out0;
+	}
+
+	const char *const type_str = json_object_get_string(type_obj);
+
+	int type;
+	if (cstr_casecmp(type_str, "plain")) {
+		type = TG_API_TEXT_TYPE_PLAIN;
+	} else if (cstr_casecmp(type_str, "format")) {
+		type = TG_API_TEXT_TYPE_FORMAT;
+	} else {
+		error = "'type': invalid value";
+		goto out0;
+	}
+
+	json_object *chat_id_obj;
+	if (json_object_object_get_ex(req->data, "chat_id", &chat_id_obj) == 0) {
+		error = "no 'chat_id' field";
+		goto out0;
+	}
+
+	json_object *msg_id_obj;
+	if (json_object_object_get_ex(req->data, "message_id", &msg_id_obj) == 0) {
+		error = "no 'message_id' field";
+		goto out0;
+	}
+
+	json_object *user_id_obj;
+	if (json_object_object_get_ex(req->data, "user_id", &user_id_obj) == 0) {
+		error = "no 'user_id' field";
+		goto out0;
+	}
+
+	const int64_t user_id = json_object_get_int64(user_id_obj);
+
+	json_object *text_obj;
+	if (json_object_object_get_ex(req->data, "text", &text_obj) == 0) {
+		error = "no 'text' field";
+		goto out0;
+	}
+
+	const int64_t chat_id = json_object_get_int64(chat_id_obj);
+	if (chat_id == 0) {
+		error = "'chat_id': invalid value";
+		goto out0;
+	}
+
+	const int64_t msg_id = json_object_get_int64(msg_id_obj);
+
+	const char *const text = json_object_get_string(text_obj);
+	if (cstr_is_empty(text)) {
+		error = "'text': empty";
+		goto out0;
+	}
+
+	char *const markup = new_deleter(user_id);
+	const TgApiText api = {
+		.type = type,
+		.chat_id = chat_id,
+		.msg_id = msg_id,
+		.text = text,
+		.markup = markup,
+	};
+
+	TgApiResp resp;
+	ret = tg_api_text_send(&api, &resp);
+	if (ret < 0)
+		error = resp.error_msg;
+
+	ret_id = resp.msg_id;
+	free(markup);
+
+out0:
+	json_object_object_add(req->resp, "message_id", json_object_new_int64(ret_id));
+	rpc_add_response(req, error);
+	return ret;
+}
+
+
+static int
+_send_photo(const RpcReq *req)
+{
+	int ret = -1;
+	int64_t ret_id = 0;
+	const char  *error = "";
+
+	json_object *text_type_obj;
+	if (json_object_object_get_ex(req->data, "text_type", &text_type_obj) == 0) {
+		error = "no 'text_type' field";
+		goto out0;
+	}
+
+	const char *const text_type_str = json_object_get_string(text_type_obj);
+
+	int text_type;
+	if (cstr_casecmp(text_type_str, "plain")) {
+		text_type = TG_API_TEXT_TYPE_PLAIN;
+	} else if (cstr_casecmp(text_type_str, "format")) {
+		text_type = TG_API_TEXT_TYPE_FORMAT;
+	} else {
+		error = "'text_type': invalid value";
+		goto out0;
+	}
+
+	json_object *chat_id_obj;
+	if (json_object_object_get_ex(req->data, "chat_id", &chat_id_obj) == 0) {
+		error = "no 'chat_id' field";
+		goto out0;
+	}
+
+	json_object *msg_id_obj;
+	if (json_object_object_get_ex(req->data, "message_id", &msg_id_obj) == 0) {
+		error = "no 'message_id' field";
+		goto out0;
+	}
+
+	json_object *user_id_obj;
+	if (json_object_object_get_ex(req->data, "user_id", &user_id_obj) == 0) {
+		error = "no 'user_id' field";
+		goto out0;
+	}
+
+	const int64_t user_id = json_object_get_int64(user_id_obj);
+
+	json_object *photo_obj;
+	if (json_object_object_get_ex(req->data, "photo", &photo_obj) == 0) {
+		error = "no 'photo' field";
+		goto out0;
+	}
+
+	const char *text = "";
+	json_object *text_obj;
+	if (json_object_object_get_ex(req->data, "text", &text_obj)) {
+		text = json_object_get_string(text_obj);
+		text = (cstr_is_empty(text))? "" : text;
+	}
+
+	const int64_t chat_id = json_object_get_int64(chat_id_obj);
+	if (chat_id == 0) {
+		error = "'chat_id': invalid value";
+		goto out0;
+	}
+
+	const int64_t msg_id = json_object_get_int64(msg_id_obj);
+
+	const char *const photo = json_object_get_string(photo_obj);
+	if (cstr_is_empty(photo)) {
+		error = "'photo': empty";
+		goto out0;
+	}
+
+	char *const markup = new_deleter(user_id);
+	const TgApiPhoto api = {
+		.text_type = text_type,
+		.chat_id = chat_id,
+		.msg_id = msg_id,
+		.photo = photo,
+		.text = text,
+		.markup = markup,
+	};
+
+	TgApiResp resp;
+	ret = tg_api_photo_send(&api, &resp);
+	if (ret < 0)
+		error = resp.error_msg;
+
+	ret_id = resp.msg_id;
+	free(markup);
+
+out0:
+	json_object_object_add(req->resp, "message_id", json_object_new_int64(ret_id));
+	rpc_add_response(req, error);
+	return ret;
+}
+
+
+static int
+_send_animation(const RpcReq *req)
+{
+	int ret = -1;
+	int64_t ret_id = 0;
+	const char  *error = "";
+
+	json_object *text_type_obj;
+	if (json_object_object_get_ex(req->data, "text_type", &text_type_obj) == 0) {
+		error = "no 'text_type' field";
+		goto out0;
+	}
+
+	const char *const text_type_str = json_object_get_string(text_type_obj);
+
+	int text_type;
+	if (cstr_casecmp(text_type_str, "plain")) {
+		text_type = TG_API_TEXT_TYPE_PLAIN;
+	} else if (cstr_casecmp(text_type_str, "format")) {
+		text_type = TG_API_TEXT_TYPE_FORMAT;
+	} else {
+		error = "'text_type': invalid value";
+		goto out0;
+	}
+
+	json_object *chat_id_obj;
+	if (json_object_object_get_ex(req->data, "chat_id", &chat_id_obj) == 0) {
+		error = "no 'chat_id' field";
+		goto out0;
+	}
+
+	json_object *msg_id_obj;
+	if (json_object_object_get_ex(req->data, "message_id", &msg_id_obj) == 0) {
+		error = "no 'message_id' field";
+		goto out0;
+	}
+
+	json_object *user_id_obj;
+	if (json_object_object_get_ex(req->data, "user_id", &user_id_obj) == 0) {
+		error = "no 'user_id' field";
+		goto out0;
+	}
+
+	const int64_t user_id = json_object_get_int64(user_id_obj);
+
+	json_object *animation_obj;
+	if (json_object_object_get_ex(req->data, "animation", &animation_obj) == 0) {
+		error = "no 'animation' field";
+		goto out0;
+	}
+
+	const char *text = "";
+	json_object *text_obj;
+	if (json_object_object_get_ex(req->data, "text", &text_obj)) {
+		text = json_object_get_string(text_obj);
+		text = (cstr_is_empty(text))? "" : text;
+	}
+
+	const int64_t chat_id = json_object_get_int64(chat_id_obj);
+	if (chat_id == 0) {
+		error = "'chat_id': invalid value";
+		goto out0;
+	}
+
+	const int64_t msg_id = json_object_get_int64(msg_id_obj);
+
+	const char *const animation = json_object_get_string(animation_obj);
+	if (cstr_is_empty(animation)) {
+		error = "'animation': empty";
+		goto out0;
+	}
+
+	char *const markup = new_deleter(user_id);
+	const TgApiAnimation api = {
+		.text_type = text_type,
+		.chat_id = chat_id,
+		.msg_id = msg_id,
+		.animation = animation,
+		.text = text,
+		.markup = markup,
+	};
+
+	TgApiResp resp;
+	ret = tg_api_animation_send(&api, &resp);
+	if (ret < 0)
+		error = resp.error_msg;
+
+	ret_id = resp.msg_id;
+	free(markup);
+
+out0:
+	json_object_object_add(req->resp, "message_id", json_object_new_int64(ret_id));
+	rpc_add_response(req, error);
+	return ret;
+}
+
+
+static int
+_delete_message(const RpcReq *req)
+{
+	int ret = -1;
+	const char *error = "";
+
+	json_object *chat_id_obj;
+	if (json_object_object_get_ex(req->data, "chat_id", &chat_id_obj) == 0) {
+		error = "no 'chat_id' field";
+		goto out0;
+	}
+
+	json_object *msg_id_obj;
+	if (json_object_object_get_ex(req->data, "message_id", &msg_id_obj) == 0) {
+		error = "no 'message_id' field";
+		goto out0;
+	}
+
+	const int64_t chat_id = json_object_get_int64(chat_id_obj);
+	if (chat_id == 0) {
+		error = "'chat_id': invalid value";
+		goto out0;
+	}
+
+	const int64_t msg_id = json_object_get_int64(msg_id_obj);
+	if (msg_id == 0) {
+		error = "'msg_id': invalid value";
+		goto out0;
+	}
+
+	TgApiResp resp;
+	ret = tg_api_delete(chat_id, msg_id, &resp);
+	if (ret < 0)
+		error = resp.error_msg;
+
+out0:
+	json_object_object_add(req->resp, "name", json_object_new_string(req->name));
+	rpc_add_response(req, error);
+	return ret;
+}
+
+
+static int
+_answer_callback(const RpcReq *req)
+{
+	int ret = -1;
+	const char *error = "";
+
+	json_object *id_obj;
+	if (json_object_object_get_ex(req->data, "id", &id_obj) == 0) {
+		error = "no 'id' field";
+		goto out0;
+	}
+
+	json_object *is_text_obj;
+	if (json_object_object_get_ex(req->data, "is_text", &is_text_obj) == 0) {
+		error = "no 'is_text' field";
+		goto out0;
+	}
+
+	json_object *value_obj;
+	if (json_object_object_get_ex(req->data, "value", &value_obj) == 0) {
+		error = "no 'value' field";
+		goto out0;
+	}
+
+	json_object *show_alert_obj;
+	if (json_object_object_get_ex(req->data, "show_alert", &show_alert_obj) == 0) {
+		error = "no 'show_alert' field";
+		goto out0;
+	}
+
+	const char *const id = json_object_get_string(id_obj);
+	if (cstr_is_empty(id)) {
+		error = "'id': empty";
+		goto out0;
+	}
+
+	const int is_text = json_object_get_int(is_text_obj);
+
+	const char *const value = json_object_get_string(value_obj);
+	if (cstr_is_empty(value)) {
+		error = "'value': empty";
+		goto out0;
+	}
+
+	const int show_alert = json_object_get_int(show_alert_obj);
+	if (is_text)
+		ret = TG_API_CALLBACK_VALUE_TYPE_TEXT;
+	else
+		ret = TG_API_CALLBACK_VALUE_TYPE_URL;
+
+	TgApiResp resp;
+	const TgApiCallback api = {
+		.value_type = TG_API_CALLBACK_VALUE_TYPE_TEXT,
+		.show_alert = show_alert,
+		.id = id,
+		.value = value,
+	};
+
+	ret = tg_api_callback_answer(&api, &resp);
+	if (ret < 0)
+		error = resp.error_msg;
+
+out0:
+	rpc_add_response(req, error);
+	return ret;
+}
+
+
+static int
+_sched_message(const RpcReq *req)
+{
+	int ret = -1;
+
+	/* TODO */
+	rpc_add_response(req, "not yet supported");
+	return ret;
+}
+
+
+static int
+_session(const RpcReq *req)
+{
+	int ret = -1;
+	const char *error = "";
+
+	json_object *type_obj;
+	if (json_object_object_get_ex(req->data, "type", &type_obj) == 0) {
+		error = "no 'type' field";
+		goto out0;
+	}
+
+	json_object *chat_id_obj;
+	if (json_object_object_get_ex(req->data, "chat_id", &chat_id_obj) == 0) {
+		error = "no 'chat_id' field";
+		goto out0;
+	}
+
+	json_object *user_id_obj;
+	if (json_object_object_get_ex(req->data, "user_id", &user_id_obj) == 0) {
+		error = "no 'user_id' field";
+		goto out0;
+	}
+
+	json_object *ctx_obj;
+	if (json_object_object_get_ex(req->data, "ctx", &ctx_obj) == 0) {
+		error = "no 'ctx' field";
+		goto out0;
+	}
+
+	int type;
+	const char *const type_str = json_object_get_string(type_obj);
+	if (cstr_casecmp(type_str, "acquire")) {
+		type = 0;
+	} else if (cstr_casecmp(type_str, "release")) {
+		type = 1;
+	} else {
+		error = "'type': invalid value";
+		goto out0;
+	}
+
+	const int64_t chat_id = json_object_get_int64(chat_id_obj);
+	if (chat_id == 0) {
+		error = "'chat_id': invalid value";
+		goto out0;
+	}
+
+	const int64_t user_id = json_object_get_int64(user_id_obj);
+	if (user_id == 0) {
+		error = "'user_id': invalid value";
+		goto out0;
+	}
+
+	const char *const ctx_str = json_object_get_string(ctx_obj);
+	if (cstr_is_empty(ctx_str)) {
+		error = "'ctx': empty";
+		goto out0;
+	}
+
+	switch (type) {
+	case 0:
+		ret = session_acquire(chat_id, user_id, ctx_str);
+		if (ret == -1)
+			error = "failed to acquire session lock";
+		else if (ret == -2)
+			error = "session is locked";
+		else
+			ret = 0;
+		break;
+	case 1:
+		ret = session_release(chat_id, user_id, ctx_str);
+		if (ret < 0)
+			error = "failed to release session lock";
+		else
+			ret = 0;
+		break;
+	}
+
+out0:
+	json_object_object_add(req->resp, "name", json_object_new_string(req->name));
+	rpc_add_response(req, error);
+	return ret;
+}
+
+
+static int
+_chld_output(const RpcReq *req)
+{
+	int ret = -1;
+	const char *error = "";
+
+	int64_t count = 10;
+	json_object *count_obj;
+	if (json_object_object_get_ex(req->data, "count", &count_obj))
+		count = json_object_get_int64(count_obj);
+
+	if ((count <= 0) || (count > CFG_CHLD_OUTPUT_HISTORY)) {
+		error = "'count': invalid value";
+		goto out0;
+	}
+
+	/* kept by the bot server only */
+	json_object *const list_obj = chld_output_get((unsigned)count);
+	if (list_obj == NULL) {
+		error = "not available: not served by the bot server";
+		goto out0;
+	}
+
+	json_object_object_add(req->resp, "list", list_obj);
+	ret = 0;
+
+out0:
+	rpc_add_response(req, error);
+	return ret;
+}
@@ -0,0 +1,39 @@
+#ifndef __RPC_H__
+#define __RPC_H__
+
+
+#include <json.h>
+
+
+/*
+ * Rpc: the extern api requests (see: extern/README.txt), served by kvrt_bot on a Unix socket
+ *
+ * Framing, one request per connection:
+ *   client: { "type": "send_text", "name": "/xxx", "proc": "yyyy", "data": { ... } }, then EOF
+ *   server: { "ret": 0, "resp": { "type": "send_text", "name": "/xxx", ..., "error": "" } }
+ */
+typedef struct rpc_req {
+	const char  *type;
+	const char  *name;
+	const char  *proc;
+	json_object *data;
+	json_object *resp;
+} RpcReq;
+
+/* ret: 0: success, -1: failed, -2: session is locked */
+int rpc_exec(const RpcReq *r);
+
+/* fills the common response fields: "type", "name", "proc", and "error" */
+int rpc_add_response(const RpcReq *r, const char error[]);
+
+/* serves a single request on a connected socket */
+int rpc_serve(int fd);
+
+/*
+ * ret: 0: success, 'resp' and 'res' are set, -1: failed, the server may have run the request,
+ *      -2: the server is not reachable, nothing was sent
+ */
+int rpc_call(const char path[], const RpcReq *r, json_object **resp, int *res);
+
+
+#endif
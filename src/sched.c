@@ -1,4 +1,7 @@
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -13,8 +16,40 @@
 #include "util.h"
 
 
+/*
+ * SchedHeap: the due times, min-heap by next_run. Sched_Message is written through on insert and
+ * read back by id when a task runs: no queries on a tick.
+ */
+typedef struct sched_task {
+	time_t  next_run;
+	time_t  expire_at;	/* next_run + expire */
+	int32_t id;
+} SchedTask;
+
+typedef struct sched_heap {
+	mtx_t      mutex;
+	int        timer_fd;	/* armed to the top's next_run, disarmed when empty */
+	unsigned   len;
+	unsigned   size;
+	SchedTask *items;
+} SchedHeap;
+
+static SchedHeap _heap;
+
+/* sched_purge_expired(): one at a time */
+static atomic_flag _is_purging = ATOMIC_FLAG_INIT;
+
+static int  _heap_init(void);
+static void _heap_deinit(void);
+static int  _heap_load(void);
+static int  _heap_push(const SchedTask *task);
+static void _heap_pop(SchedTask *task);
+static void _heap_arm(time_t not_before);
+
+
 static void _spawn_handler(EvCtx *ctx);
 static void _handler(void *ctx, void *udata);
+static int  _run_due(time_t now);
 static void _run_task(void *ctx, void *udata);
 static int  _add(const SchedParam *param, int type);
 
@@ -23,23 +58,18 @@ static int  _add(const SchedParam *param, int type);
  * Public
  */
 int
-sched_create(Sched *s, time_t timeout_s)
+sched_create(Sched *s)
 {
-	const int fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (fd < 0) {
-		LOG_ERRP("sched", "%s", "timerfd_create");
+	if (_heap_init() < 0)
 		return -1;
-	}
 
-	const struct itimerspec timerspec = {
-		.it_value = (struct timespec) { .tv_sec = timeout_s },
-		.it_interval = (struct timespec) { .tv_sec = timeout_s },
-	};
+	if (_heap_load() < 0)
+		goto err0;
 
-	if (timerfd_settime(fd, 0, &timerspec, NULL) < 0) {
-		LOG_ERRP("sched", "%s", "timerfd_settime");
-		close(fd);
-		return -1;
+	const int fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		LOG_ERRP("sched", "%s", "timerfd_create");
+		goto err0;
 	}
 
 	*s = (Sched) {
@@ -51,17 +81,26 @@ sched_create(Sched *s, time_t timeout_s)
 			},
 		},
 		.is_ready = true,
-		.timeout_s = timeout_s,
 	};
 
 	const int ret = ev_ctx_add_in(&s->ctx);
 	if (ret < 0) {
 		LOG_ERR(ret, "ev", "%s", "ev_ctx_add_in");
-		close(fd);
-		return -1;
+		goto err1;
 	}
 
+	/* no ticks: only woken up when the earliest task is due */
+	mtx_lock(&_heap.mutex);
+	_heap.timer_fd = fd;
+	_heap_arm(0);
+	mtx_unlock(&_heap.mutex);
 	return 0;
+
+err1:
+	close(fd);
+err0:
+	_heap_deinit();
+	return -1;
 }
 
 
@@ -69,6 +108,7 @@ void
 sched_destroy(const Sched *s)
 {
 	close(s->ctx.fd);
+	_heap_deinit();
 }
 
 
@@ -93,6 +133,44 @@ sched_delete_message(const SchedParam *param)
 }
 
 
+/*
+ * Rows the heap never sees expire in the table: left over from a failed delete or a failed push,
+ * or added by an extern command. Purged in bounded batches, and only when nothing is due.
+ */
+void
+sched_purge_expired(void)
+{
+	if (atomic_flag_test_and_set(&_is_purging))
+		return;
+
+	const time_t now = time(NULL);
+
+	mtx_lock(&_heap.mutex);
+	const bool is_idle = (_heap.len == 0) || (_heap.items[0].next_run > now);
+	mtx_unlock(&_heap.mutex);
+
+	if (is_idle == false)
+		goto out0;
+
+	int total = 0;
+	for (int i = 0; i < CFG_SCHED_PURGE_BATCHES; i++) {
+		const int ret = model_sched_message_purge(now, CFG_SCHED_PURGE_SIZE);
+		if (ret < 0)
+			break;
+
+		total += ret;
+		if (ret < CFG_SCHED_PURGE_SIZE)
+			break;
+	}
+
+	if (total > 0)
+		LOG_INFO("sched", "purged: %d expired task(s)", total);
+
+out0:
+	atomic_flag_clear(&_is_purging);
+}
+
+
 /*
  * Private
  */
@@ -104,7 +182,10 @@ _spawn_handler(EvCtx *ctx)
 	uint64_t timer = 0;
 	const ssize_t rd = read(ctx->fd, &timer, sizeof(timer));
 	if (rd < 0) {
-		LOG_ERRP("sched", "%s", "read");
+		/* re-armed before it was read */
+		if (errno != EAGAIN)
+			LOG_ERRP("sched", "%s", "read");
+
 		return;
 	}
 
@@ -125,39 +206,90 @@ _handler(void *ctx, void *udata)
 {
 	Sched *const s = (Sched *)ctx;
 
-	const time_t now = time(NULL);
-	ModelSchedMessage *msg_list[32];
-	int32_t id_list[LEN(msg_list)];
+	/* all of the due ones, CFG_SCHED_BATCH_SIZE at a time */
+	int ret;
+	time_t now;
+	do {
+		now = time(NULL);
+		ret = _run_due(now);
+	} while (ret > 0);
 
-	const int list_len = model_sched_message_get_list(msg_list, LEN(msg_list), now);
-	if (list_len <= 0)
-		goto out0;
+	/* before re-arming: a wakeup after this is never dropped by _spawn_handler() */
+	atomic_store(&s->is_ready, true);
+
+	/* the pool didn't take it: retry in a second, not in a busy loop */
+	mtx_lock(&_heap.mutex);
+	_heap_arm((ret < 0)? (now + 1) : 0);
+	mtx_unlock(&_heap.mutex);
+	(void)udata;
+}
 
+
+/* ret: 1: there are more, 0: done, -1: the thread pool failed */
+static int
+_run_due(time_t now)
+{
+	int ret = 0;
+	int32_t expired_list[CFG_SCHED_BATCH_SIZE];
+	int expired_len = 0;
 	int count = 0;
-	for (; count < list_len; count++) {
-		/* run function handler and transfer memory ownership */
-		if (thrd_pool_add_job(_run_task, msg_list[count], NULL) < 0)
-			goto out1;
 
-		id_list[count] = msg_list[count]->id;
+	mtx_lock(&_heap.mutex);
+
+	for (; (_heap.len > 0) && (_heap.items[0].next_run <= now); count++) {
+		if (count == CFG_SCHED_BATCH_SIZE) {
+			ret = 1;
+			break;
+		}
+
+		SchedTask task;
+		_heap_pop(&task);
+		if (now >= task.expire_at) {
+			LOG_INFO("sched", "%" PRIi32 ": expired", task.id);
+			expired_list[expired_len++] = task.id;
+			continue;
+		}
+
+		/* the row is read, and deleted, by the task itself */
+		if (thrd_pool_add_job(_run_task, (void *)(intptr_t)task.id, NULL) < 0) {
+			_heap_push(&task);
+			ret = -1;
+			break;
+		}
 	}
 
-out1:
-	model_sched_message_delete(id_list, count);
+	mtx_unlock(&_heap.mutex);
 
-	/* free() remaining items, in case error was occured */
-	for (int j = count; (j < list_len); j++)
-		free(msg_list[j]);
-out0:
-	atomic_store(&s->is_ready, true);
-	(void)udata;
+	if (expired_len > 0)
+		model_sched_message_delete(expired_list, expired_len);
+
+	/* braces: LOG_DEBUG() is empty without DEBUG */
+	if (count > 0) {
+		LOG_DEBUG("sched", "ran: %d, expired: %d", count - expired_len, expired_len);
+	}
+
+	return ret;
 }
 
 
 static void
 _run_task(void *ctx, void *udata)
 {
-	ModelSchedMessage *const msg = (ModelSchedMessage *)ctx;
+	int32_t id = (int32_t)(intptr_t)ctx;
+	ModelSchedMessage *const msg = malloc(sizeof(ModelSchedMessage));
+	if (msg == NULL) {
+		LOG_ERRP("sched", "%" PRIi32 ": malloc", id);
+		return;
+	}
+
+	const int res = model_sched_message_get(msg, id);
+	if (res <= 0) {
+		if (res == 0)
+			LOG_ERRN("sched", "%" PRIi32 ": not found", id);
+
+		goto out0;
+	}
+
 	const TgMessage tgm = {
 		.id = msg->message_id,
 		.chat = (TgChat) { .id = msg->chat_id },
@@ -191,7 +323,10 @@ _run_task(void *ctx, void *udata)
 		break;
 	}
 
+	/* deleted once it has run: a task that was running on shutdown runs again on the next start */
+	model_sched_message_delete(&id, 1);
 
+out0:
 	free(msg);
 	(void)udata;
 }
@@ -248,8 +383,183 @@ _add(const SchedParam *param, int type)
 		.message_id = param->message_id,
 		.user_id = param->user_id,
 		.value_in = param->message,
+		.next_run = time(NULL) + param->interval,
 		.expire = param->expire,
 	};
 
-	return model_sched_message_add(&sched, param->interval);
+	const int id = model_sched_message_add(&sched);
+	if (id < 0)
+		return -1;
+
+	const SchedTask task = {
+		.next_run = sched.next_run,
+		.expire_at = sched.next_run + sched.expire,
+		.id = (int32_t)id,
+	};
+
+	mtx_lock(&_heap.mutex);
+	const int ret = _heap_push(&task);
+	if ((ret == 0) && (_heap.items[0].id == task.id))
+		_heap_arm(0);
+	mtx_unlock(&_heap.mutex);
+
+	/* in the table anyway: loaded on the next start */
+	if (ret < 0)
+		LOG_ERRN("sched", "%d: failed to schedule", id);
+
+	return 0;
+}
+
+
+/*
+ * SchedHeap
+ */
+static int
+_heap_init(void)
+{
+	SchedTask *const items = malloc(sizeof(SchedTask) * CFG_SCHED_HEAP_SIZE);
+	if (items == NULL) {
+		LOG_ERRP("sched", "%s", "malloc");
+		return -1;
+	}
+
+	if (mtx_init(&_heap.mutex, mtx_plain) != thrd_success) {
+		LOG_ERRN("sched", "%s", "mtx_init: failed");
+		free(items);
+		return -1;
+	}
+
+	_heap.timer_fd = -1;
+	_heap.len = 0;
+	_heap.size = CFG_SCHED_HEAP_SIZE;
+	_heap.items = items;
+	return 0;
+}
+
+
+static void
+_heap_deinit(void)
+{
+	_heap.timer_fd = -1;
+	mtx_destroy(&_heap.mutex);
+	free(_heap.items);
+	_heap.items = NULL;
+	_heap.len = 0;
+	_heap.size = 0;
+}
+
+
+static int
+_heap_load(void)
+{
+	ModelSchedTime list[CFG_SCHED_LOAD_SIZE];
+	const time_t now = time(NULL);
+	int32_t after_id = 0;
+	while (1) {
+		/* the expired ones are left to sched_purge_expired() */
+		const int len = model_sched_message_get_times(list, LEN(list), after_id, now);
+		if (len < 0)
+			return -1;
+
+		for (int i = 0; i < len; i++) {
+			const SchedTask task = {
+				.next_run = list[i].next_run,
+				.expire_at = list[i].next_run + list[i].expire,
+				.id = list[i].id,
+			};
+
+			if (_heap_push(&task) < 0)
+				return -1;
+		}
+
+		if (len < (int)LEN(list))
+			break;
+
+		after_id = list[len - 1].id;
+	}
+
+	LOG_INFO("sched", "loaded: %u task(s)", _heap.len);
+	return 0;
+}
+
+
+/* the caller holds the mutex */
+static int
+_heap_push(const SchedTask *task)
+{
+	if (_heap.len == _heap.size) {
+		const unsigned size = _heap.size * 2;
+		SchedTask *const items = realloc(_heap.items, sizeof(SchedTask) * size);
+		if (items == NULL) {
+			LOG_ERRP("sched", "%s", "realloc");
+			return -1;
+		}
+
+		_heap.items = items;
+		_heap.size = size;
+	}
+
+	SchedTask *const items = _heap.items;
+	unsigned i = _heap.len++;
+	while (i > 0) {
+		const unsigned parent = (i - 1) / 2;
+		if (items[parent].next_run <= task->next_run)
+			break;
+
+		items[i] = items[parent];
+		i = parent;
+	}
+
+	items[i] = *task;
+	return 0;
+}
+
+
+/* the caller holds the mutex, the heap isn't empty */
+static void
+_heap_pop(SchedTask *task)
+{
+	SchedTask *const items = _heap.items;
+	*task = items[0];
+
+	const unsigned len = --_heap.len;
+	const SchedTask last = items[len];
+	unsigned i = 0;
+	while (1) {
+		unsigned child = (i * 2) + 1;
+		if (child >= len)
+			break;
+		if (((child + 1) < len) && (items[child + 1].next_run < items[child].next_run))
+			child++;
+		if (last.next_run <= items[child].next_run)
+			break;
+
+		items[i] = items[child];
+		i = child;
+	}
+
+	items[i] = last;
+}
+
+
+/* the caller holds the mutex: a one-shot at the top's next_run, 'not_before': 0: none */
+static void
+_heap_arm(time_t not_before)
+{
+	if (_heap.timer_fd < 0)
+		return;
+
+	/* all zero: disarmed */
+	struct itimerspec timerspec = { 0 };
+	if (_heap.len > 0) {
+		time_t next_run = _heap.items[0].next_run;
+		if (next_run < not_before)
+			next_run = not_before;
+
+		/* 0 would disarm it: anything in the past fires right away */
+		timerspec.it_value.tv_sec = (next_run > 0)? next_run : 1;
+	}
+
+	if (timerfd_settime(_heap.timer_fd, TFD_TIMER_ABSTIME, &timerspec, NULL) < 0)
+		LOG_ERRP("sched", "%s", "timerfd_settime");
 }
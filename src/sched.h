@@ -13,12 +13,12 @@
 
 typedef struct sched {
 	EvCtx       ctx;
-	time_t      timeout_s;
 	atomic_bool is_ready;
 } Sched;
 
-int  sched_create(Sched *s, time_t timeout_s);
+int  sched_create(Sched *s);
 void sched_destroy(const Sched *s);
+void sched_purge_expired(void);
 
 
 typedef struct sched_param {
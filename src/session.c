@@ -0,0 +1,319 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "session.h"
+
+#include "config.h"
+#include "model.h"
+#include "util.h"
+
+
+#define _SESSION_TABLE_MAGIC   (0x6b767274u)	/* "kvrt" */
+#define _SESSION_TABLE_VERSION (2u)
+
+
+typedef struct session_slot {
+	int64_t chat_id;	/* 0: free */
+	int64_t user_id;
+	time_t  expire_at;
+	char    ctx[MODEL_CMD_NAME_SIZE];
+} SessionSlot;
+
+/*
+ * The extern children lock it too, and may be killed while holding it (timeout, RLIMIT_*):
+ * a robust mutex is handed to the next locker with EOWNERDEAD instead of staying locked.
+ */
+typedef struct session_bucket {
+	pthread_mutex_t mutex;
+	SessionSlot     slots[CFG_SESSION_TABLE_WAYS];
+} SessionBucket;
+
+typedef struct session_table {
+	uint32_t      magic;
+	uint32_t      version;
+	uint32_t      buckets_len;
+	uint32_t      ways;
+	SessionBucket buckets[CFG_SESSION_TABLE_BUCKETS];
+} SessionTable;
+
+
+static SessionTable *_table;
+
+
+static int            _table_init_mutexes(SessionTable *table);
+static SessionBucket *_bucket_lock(int64_t chat_id, int64_t user_id, const char ctx[]);
+static void           _bucket_unlock(SessionBucket *bucket);
+static SessionSlot   *_bucket_find(SessionBucket *bucket, int64_t chat_id, int64_t user_id,
+				   const char ctx[]);
+static void           _ctx_lower(char dest[], const char src[]);
+
+
+/*
+ * Public
+ */
+int
+session_table_init(const char path[], int is_owner)
+{
+	/*
+	 * Not O_TRUNC: an extern child of the previous run may still have the old table mapped, and
+	 * hold one of its mutexes. Zeroing that in place would unlock it under the child. A new file
+	 * leaves the old mapping alone.
+	 */
+	int flags = O_RDWR | O_CLOEXEC;
+	if (is_owner) {
+		if ((unlink(path) < 0) && (errno != ENOENT)) {
+			LOG_ERRP("session", "unlink: '%s'", path);
+			return -1;
+		}
+
+		flags |= O_CREAT | O_EXCL;
+	}
+
+	const int fd = open(path, flags, 0600);
+	if (fd < 0) {
+		LOG_ERRP("session", "open: '%s'", path);
+		return -1;
+	}
+
+	int ret = -1;
+	const size_t size = sizeof(SessionTable);
+	if (is_owner) {
+		if (ftruncate(fd, (off_t)size) < 0) {
+			LOG_ERRP("session", "ftruncate: '%s'", path);
+			goto out0;
+		}
+	} else {
+		struct stat st;
+		if ((fstat(fd, &st) < 0) || ((size_t)st.st_size != size)) {
+			LOG_ERRN("session", "'%s': invalid table size", path);
+			goto out0;
+		}
+	}
+
+	SessionTable *const table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (table == MAP_FAILED) {
+		LOG_ERRP("session", "mmap: '%s'", path);
+		goto out0;
+	}
+
+	if (is_owner) {
+		/* a new file, ftruncate() zero-filled it: every slot is free */
+		if (_table_init_mutexes(table) < 0) {
+			munmap(table, size);
+			goto out0;
+		}
+
+		table->buckets_len = CFG_SESSION_TABLE_BUCKETS;
+		table->ways = CFG_SESSION_TABLE_WAYS;
+		table->version = _SESSION_TABLE_VERSION;
+		table->magic = _SESSION_TABLE_MAGIC;
+	} else if ((table->magic != _SESSION_TABLE_MAGIC) || (table->version != _SESSION_TABLE_VERSION) ||
+		   (table->buckets_len != CFG_SESSION_TABLE_BUCKETS) ||
+		   (table->ways != CFG_SESSION_TABLE_WAYS)) {
+		LOG_ERRN("session", "'%s': incompatible table", path);
+		munmap(table, size);
+		goto out0;
+	}
+
+	_table = table;
+	ret = 0;
+
+out0:
+	close(fd);
+	return ret;
+}
+
+
+void
+session_table_deinit(void)
+{
+	if (_table == NULL)
+		return;
+
+	munmap(_table, sizeof(SessionTable));
+	_table = NULL;
+}
+
+
+int
+session_table_is_ready(void)
+{
+	return (_table != NULL);
+}
+
+
+/* ret: 0: acquired, -1: failed (table is full), -2: locked */
+int
+session_table_acquire(int64_t chat_id, int64_t user_id, const char ctx[], int exp_s)
+{
+	char _ctx[MODEL_CMD_NAME_SIZE];
+	_ctx_lower(_ctx, ctx);
+
+	int ret = -1;
+	const time_t now = time(NULL);
+	SessionBucket *const bucket = _bucket_lock(chat_id, user_id, _ctx);
+	if (bucket == NULL)
+		return -1;
+
+	SessionSlot *slot = _bucket_find(bucket, chat_id, user_id, _ctx);
+	if (slot != NULL) {
+		if (slot->expire_at > now) {
+			ret = -2;
+			goto out0;
+		}
+	} else {
+		for (int i = 0; i < CFG_SESSION_TABLE_WAYS; i++) {
+			SessionSlot *const s = &bucket->slots[i];
+			if ((s->chat_id == 0) || (s->expire_at <= now)) {
+				slot = s;
+				break;
+			}
+		}
+
+		if (slot == NULL) {
+			LOG_ERRN("session", "%s", "bucket is full");
+			goto out0;
+		}
+
+		slot->chat_id = chat_id;
+		slot->user_id = user_id;
+		memcpy(slot->ctx, _ctx, sizeof(_ctx));
+	}
+
+	slot->expire_at = now + exp_s;
+	ret = 0;
+
+out0:
+	_bucket_unlock(bucket);
+	return ret;
+}
+
+
+int
+session_table_release(int64_t chat_id, int64_t user_id, const char ctx[])
+{
+	char _ctx[MODEL_CMD_NAME_SIZE];
+	_ctx_lower(_ctx, ctx);
+
+	int ret = 0;
+	SessionBucket *const bucket = _bucket_lock(chat_id, user_id, _ctx);
+	if (bucket == NULL)
+		return -1;
+
+	SessionSlot *const slot = _bucket_find(bucket, chat_id, user_id, _ctx);
+	if (slot != NULL) {
+		memset(slot, 0, sizeof(*slot));
+		ret = 1;
+	}
+
+	_bucket_unlock(bucket);
+	return ret;
+}
+
+
+/*
+ * Private
+ */
+static int
+_table_init_mutexes(SessionTable *table)
+{
+	pthread_mutexattr_t attr;
+	int ret = pthread_mutexattr_init(&attr);
+	if (ret != 0) {
+		LOG_ERR(ret, "session", "%s", "pthread_mutexattr_init");
+		return -1;
+	}
+
+	ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	if (ret != 0) {
+		LOG_ERR(ret, "session", "%s", "pthread_mutexattr_setpshared");
+		goto out0;
+	}
+
+	ret = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if (ret != 0) {
+		LOG_ERR(ret, "session", "%s", "pthread_mutexattr_setrobust");
+		goto out0;
+	}
+
+	for (unsigned i = 0; i < CFG_SESSION_TABLE_BUCKETS; i++) {
+		ret = pthread_mutex_init(&table->buckets[i].mutex, &attr);
+		if (ret != 0) {
+			LOG_ERR(ret, "session", "pthread_mutex_init: bucket: %u", i);
+			goto out0;
+		}
+	}
+
+out0:
+	pthread_mutexattr_destroy(&attr);
+	return (ret == 0)? 0 : -1;
+}
+
+
+/* ret: NULL: the bucket is unusable */
+static SessionBucket *
+_bucket_lock(int64_t chat_id, int64_t user_id, const char ctx[])
+{
+	const int64_t ids[] = { chat_id, user_id };
+	const uint64_t hash = fnv1a_cstr(fnv1a(FNV1A_INIT, ids, sizeof(ids)), ctx, 0);
+
+	SessionBucket *const bucket = &_table->buckets[hash % CFG_SESSION_TABLE_BUCKETS];
+
+	const int ret = pthread_mutex_lock(&bucket->mutex);
+	switch (ret) {
+	case 0:
+		return bucket;
+	case EOWNERDEAD:
+		/*
+		 * the owner died in the critical section: at worst a slot is half-written, and it
+		 * is reused once it expires
+		 */
+		LOG_ERRN("session", "%s", "bucket owner died, recovered");
+		pthread_mutex_consistent(&bucket->mutex);
+		return bucket;
+	}
+
+	LOG_ERR(ret, "session", "%s", "pthread_mutex_lock");
+	return NULL;
+}
+
+
+static void
+_bucket_unlock(SessionBucket *bucket)
+{
+	pthread_mutex_unlock(&bucket->mutex);
+}
+
+
+static SessionSlot *
+_bucket_find(SessionBucket *bucket, int64_t chat_id, int64_t user_id, const char ctx[])
+{
+	for (int i = 0; i < CFG_SESSION_TABLE_WAYS; i++) {
+		SessionSlot *const slot = &bucket->slots[i];
+		if ((slot->chat_id == chat_id) && (slot->user_id == user_id) &&
+		    (strcmp(slot->ctx, ctx) == 0)) {
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+
+static void
+_ctx_lower(char dest[], const char src[])
+{
+	size_t i = 0;
+	for (; (i < (MODEL_CMD_NAME_SIZE - 1)) && (src[i] != '\0'); i++)
+		dest[i] = (char)tolower((unsigned char)src[i]);
+
+	memset(dest + i, 0, MODEL_CMD_NAME_SIZE - i);
+}
@@ -0,0 +1,18 @@
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+
+#include <stdint.h>
+
+
+/*
+ * Command session locks, shared by the server and its extern children through a mmap'd file
+ */
+int  session_table_init(const char path[], int is_owner);
+void session_table_deinit(void);
+int  session_table_is_ready(void);
+int  session_table_acquire(int64_t chat_id, int64_t user_id, const char ctx[], int exp_s);
+int  session_table_release(int64_t chat_id, int64_t user_id, const char ctx[]);
+
+
+#endif
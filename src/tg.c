@@ -8,19 +8,22 @@
 #include "util.h"
 
 
-static int  _parse_message(TgMessage *m, json_object *message_obj);
-static int  _parse_message_type(TgMessage *m, json_object *message_obj);
+static int  _parse_message(TgMessage *m, json_object *message_obj, Arena *arena);
+static int  _parse_message_type(TgMessage *m, json_object *message_obj, Arena *arena);
 static int  _parse_audio(TgAudio *a, json_object *audio_obj);
 static int  _parse_document(TgDocument *d, json_object *doc_obj);
 static int  _parse_video(TgVideo *v, json_object *video_obj);
 static void _parse_text(TgText *t, json_object *text_obj);
 static int  _parse_photo(TgPhotoSize *p, json_object *photo_obj);
-static int  _parse_sticker(TgSticker *s, json_object *sticker_obj);
-static int  _parse_message_entities(TgMessage *m, json_object *message_obj);
-static int  _parse_callback_query(TgCallbackQuery *c, json_object *callback_query_obj);
-static int  _parse_user_alloc(TgUser **u, json_object *user_obj);
+static int  _parse_sticker(TgSticker *s, json_object *sticker_obj, Arena *arena);
+static int  _parse_message_entities(TgMessage *m, json_object *message_obj, Arena *arena);
+static int  _parse_chat_member(TgChatMemberUpdated *c, json_object *chat_member_obj);
+static int  _parse_callback_query(TgCallbackQuery *c, json_object *callback_query_obj,
+				  Arena *arena);
+static int  _parse_user_alloc(TgUser **u, json_object *user_obj, Arena *arena);
 static int  _parse_chat(TgChat *c, json_object *chat_obj);
-static void _free_message(TgMessage *m);
+static int  _peek_message(TgUpdatePeek *p, JsonRawIter *it);
+static int  _peek_entity_is_command(JsonRawIter *it);
 
 
 /*
@@ -212,14 +215,7 @@ tg_chat_admin_parse(TgChatAdmin *a, json_object *json)
 
 out0:
 	a->privileges = privs;
-	return _parse_user_alloc(&a->user, user_obj);
-}
-
-
-void
-tg_chat_admin_free(TgChatAdmin *a)
-{
-	free(a->user);
+	return tg_user_parse(&a->user, user_obj);
 }
 
 
@@ -258,9 +254,6 @@ tg_chat_admin_list_parse(TgChatAdminList *a, json_object *json)
 void
 tg_chat_admin_list_free(TgChatAdminList *a)
 {
-	for (unsigned i = 0; i < a->len; i++)
-		tg_chat_admin_free(&a->list[i]);
-
 	json_object_put(a->tmp_obj);
 }
 
@@ -318,6 +311,7 @@ tg_update_type_str(int type)
 	switch (type) {
 	case TG_UPDATE_TYPE_MESSAGE: return "message";
 	case TG_UPDATE_TYPE_CALLBACK_QUERY: return "callback query";
+	case TG_UPDATE_TYPE_CHAT_MEMBER: return "chat member";
 	}
 
 	return "unknown";
@@ -325,7 +319,7 @@ tg_update_type_str(int type)
 
 
 int
-tg_update_parse(TgUpdate *u, json_object *json)
+tg_update_parse(TgUpdate *u, json_object *json, Arena *arena)
 {
 	memset(u, 0, sizeof(*u));
 	u->type = TG_UPDATE_TYPE_UNKNOWN;
@@ -339,16 +333,14 @@ tg_update_parse(TgUpdate *u, json_object *json)
 
 	json_object *message_obj;
 	if (json_object_object_get_ex(json, "message", &message_obj) != 0) {
-		if (_parse_message(&u->message, message_obj) < 0)
+		if (_parse_message(&u->message, message_obj, arena) < 0)
 			return -1;
 
 		json_object *reply_to_obj;
 		if (json_object_object_get_ex(message_obj, "reply_to_message", &reply_to_obj) != 0) {
-			TgMessage *const reply_to = calloc(1, sizeof(TgMessage));
-			if (_parse_message(reply_to, reply_to_obj) == 0)
+			TgMessage *const reply_to = arena_calloc(arena, 1, sizeof(TgMessage));
+			if ((reply_to != NULL) && (_parse_message(reply_to, reply_to_obj, arena) == 0))
 				u->message.reply_to = reply_to;
-			else
-				free(reply_to);
 		}
 
 		u->type = TG_UPDATE_TYPE_MESSAGE;
@@ -357,35 +349,78 @@ tg_update_parse(TgUpdate *u, json_object *json)
 
 	json_object *callback_query_obj;
 	if (json_object_object_get_ex(json, "callback_query", &callback_query_obj) != 0) {
-		if (_parse_callback_query(&u->callback_query, callback_query_obj) < 0)
+		if (_parse_callback_query(&u->callback_query, callback_query_obj, arena) < 0)
 			return -1;
 
 		u->type = TG_UPDATE_TYPE_CALLBACK_QUERY;
 		return 0;
 	}
 
+	json_object *chat_member_obj;
+	if (json_object_object_get_ex(json, "chat_member", &chat_member_obj) != 0) {
+		if (_parse_chat_member(&u->chat_member, chat_member_obj) < 0)
+			return -1;
+
+		u->type = TG_UPDATE_TYPE_CHAT_MEMBER;
+		return 0;
+	}
+
 	u->type = TG_UPDATE_TYPE_UNKNOWN;
 	return -1;
 }
 
 
-void
-tg_update_free(TgUpdate *u)
+/* one pass: the cursor only descends into 'message' */
+int
+tg_update_peek(TgUpdatePeek *p, const char json[], size_t len)
 {
-	switch (u->type) {
-	case TG_UPDATE_TYPE_MESSAGE:
-		if (u->message.reply_to != NULL)
-			_free_message(u->message.reply_to);
-
-		_free_message(&u->message);
-		break;
-	case TG_UPDATE_TYPE_CALLBACK_QUERY:
-		if (u->callback_query.message != NULL)
-			_free_message(u->callback_query.message);
-
-		free(u->callback_query.message);
-		break;
+	JsonRawIter it;
+	json_raw_iter_init(&it, json, len);
+	if (json_raw_iter_enter(&it, '{') < 0)
+		return -1;
+
+	int has_id = 0;
+	p->type = TG_UPDATE_TYPE_UNKNOWN;
+	p->is_ignored = 1;
+	for (;;) {
+		JsonRaw key;
+		const int ret = json_raw_iter_next(&it, &key);
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			break;
+
+		if (json_raw_str_eq(&key, "update_id")) {
+			JsonRaw val;
+			if (json_raw_iter_value(&it, &val) < 0)
+				return -1;
+			if (json_raw_to_int64(&val, &p->id) < 0)
+				return -1;
+
+			has_id = 1;
+		} else if (json_raw_str_eq(&key, "message")) {
+			p->type = TG_UPDATE_TYPE_MESSAGE;
+			if (_peek_message(p, &it) < 0)
+				return -1;
+		} else {
+			if (json_raw_str_eq(&key, "callback_query")) {
+				p->type = TG_UPDATE_TYPE_CALLBACK_QUERY;
+				p->is_ignored = 0;
+			} else if (json_raw_str_eq(&key, "chat_member")) {
+				p->type = TG_UPDATE_TYPE_CHAT_MEMBER;
+				p->is_ignored = 0;
+			}
+
+			if (json_raw_iter_value(&it, NULL) < 0)
+				return -1;
+		}
+
+		/* an update carries one type, the rest is json-c's job */
+		if (has_id && (p->type != TG_UPDATE_TYPE_UNKNOWN))
+			return 0;
 	}
+
+	return has_id? 0 : -1;
 }
 
 
@@ -393,7 +428,7 @@ tg_update_free(TgUpdate *u)
  * Private
  */
 static int
-_parse_message(TgMessage *m, json_object *message_obj)
+_parse_message(TgMessage *m, json_object *message_obj, Arena *arena)
 {
 	json_object *id_obj;
 	if (json_object_object_get_ex(message_obj, "message_id", &id_obj) == 0)
@@ -413,34 +448,30 @@ _parse_message(TgMessage *m, json_object *message_obj)
 
 	json_object *from_obj;
 	if (json_object_object_get_ex(message_obj, "from", &from_obj) != 0) {
-		if (_parse_user_alloc(&m->from, from_obj) < 0)
+		if (_parse_user_alloc(&m->from, from_obj, arena) < 0)
 			return -1;
 	}
 
-	if (_parse_message_type(m, message_obj) < 0)
-		goto err0;
+	if (_parse_message_type(m, message_obj, arena) < 0)
+		return -1;
 
-	if (_parse_message_entities(m, message_obj) < 0)
-		goto err0;
+	if (_parse_message_entities(m, message_obj, arena) < 0)
+		return -1;
 
 	if ((m->entities != NULL) && (m->entities->type == TG_MESSAGE_ENTITY_TYPE_BOT_CMD))
 		m->type = TG_MESSAGE_TYPE_COMMAND;
 
 	if (_parse_chat(&m->chat, chat_obj) < 0)
-		goto err0;
+		return -1;
 
 	m->id = json_object_get_int64(id_obj);
 	m->date = json_object_get_int64(date_obj);
 	return 0;
-
-err0:
-	_free_message(m);
-	return -1;
 }
 
 
 static int
-_parse_message_type(TgMessage *m, json_object *message_obj)
+_parse_message_type(TgMessage *m, json_object *message_obj, Arena *arena)
 {
 	json_object *obj;
 
@@ -481,7 +512,7 @@ _parse_message_type(TgMessage *m, json_object *message_obj)
 			return -1;
 
 		const size_t len = array_list_length(list) + 1; /* +1: NULL "id" */
-		TgPhotoSize *const photo = calloc(len, sizeof(TgPhotoSize));
+		TgPhotoSize *const photo = arena_calloc(arena, len, sizeof(TgPhotoSize));
 		if (photo != NULL) {
 			for (size_t i = 0, j = 0; j < len; j++) {
 				json_object *const _obj = array_list_get_idx(list, j);
@@ -498,7 +529,7 @@ _parse_message_type(TgMessage *m, json_object *message_obj)
 	}
 
 	if (json_object_object_get_ex(message_obj, "sticker", &obj) != 0) {
-		if (_parse_sticker(&m->sticker, obj) < 0)
+		if (_parse_sticker(&m->sticker, obj, arena) < 0)
 			return -1;
 
 		m->type = TG_MESSAGE_TYPE_STICKER;
@@ -672,7 +703,7 @@ _parse_photo(TgPhotoSize *p, json_object *photo_obj)
 
 
 static int
-_parse_sticker(TgSticker *s, json_object *sticker_obj)
+_parse_sticker(TgSticker *s, json_object *sticker_obj, Arena *arena)
 {
 	json_object *id_obj;
 	if (json_object_object_get_ex(sticker_obj, "file_id", &id_obj) == 0)
@@ -704,15 +735,9 @@ _parse_sticker(TgSticker *s, json_object *sticker_obj)
 
 	json_object *obj;
 	if (json_object_object_get_ex(sticker_obj, "thumbnail", &obj) != 0) {
-		TgPhotoSize *thumbn = calloc(1, sizeof(TgPhotoSize));
-		if (thumbn != NULL) {
-			if (_parse_photo(thumbn, obj) < 0) {
-				free(thumbn);
-				thumbn = NULL;
-			}
-		}
-
-		s->thumbnail = thumbn;
+		TgPhotoSize *const thumbn = arena_calloc(arena, 1, sizeof(TgPhotoSize));
+		if ((thumbn != NULL) && (_parse_photo(thumbn, obj) == 0))
+			s->thumbnail = thumbn;
 	}
 
 	if (json_object_object_get_ex(sticker_obj, "emoji", &obj) != 0)
@@ -748,7 +773,7 @@ _parse_sticker(TgSticker *s, json_object *sticker_obj)
 
 
 static int
-_parse_message_entities(TgMessage *m, json_object *message_obj)
+_parse_message_entities(TgMessage *m, json_object *message_obj, Arena *arena)
 {
 	json_object *ents_obj;
 	if (json_object_object_get_ex(message_obj, "entities", &ents_obj) == 0)
@@ -759,7 +784,7 @@ _parse_message_entities(TgMessage *m, json_object *message_obj)
 		return -1;
 
 	const size_t len = array_list_length(list);
-	TgMessageEntity *const ents = calloc(len, sizeof(TgMessageEntity));
+	TgMessageEntity *const ents = arena_calloc(arena, len, sizeof(TgMessageEntity));
 	if (ents == NULL)
 		return -1;
 
@@ -809,7 +834,7 @@ _parse_message_entities(TgMessage *m, json_object *message_obj)
 			e->type = TG_MESSAGE_ENTITY_TYPE_TEXT_PRE;
 		} else if (strcmp(type, "text_mention") == 0) {
 			if (json_object_object_get_ex(obj, "user", &res) != 0)
-				_parse_user_alloc(&e->user, res);
+				_parse_user_alloc(&e->user, res, arena);
 
 			e->type = TG_MESSAGE_ENTITY_TYPE_TEXT_MENTION;
 		} else if (strcmp(type, "text_link") == 0) {
@@ -879,7 +904,44 @@ _parse_chat(TgChat *c, json_object *chat_obj)
 
 
 static int
-_parse_callback_query(TgCallbackQuery *c, json_object *callback_query_obj)
+_parse_chat_member(TgChatMemberUpdated *c, json_object *chat_member_obj)
+{
+	json_object *chat_obj;
+	if (json_object_object_get_ex(chat_member_obj, "chat", &chat_obj) == 0)
+		return -1;
+
+	json_object *id_obj;
+	if (json_object_object_get_ex(chat_obj, "id", &id_obj) == 0)
+		return -1;
+
+	json_object *member_obj;
+	if (json_object_object_get_ex(chat_member_obj, "new_chat_member", &member_obj) == 0)
+		return -1;
+
+	json_object *status_obj;
+	if (json_object_object_get_ex(member_obj, "status", &status_obj) == 0)
+		return -1;
+
+	c->chat_id = json_object_get_int64(id_obj);
+
+	const char *const status = json_object_get_string(status_obj);
+	if ((strcmp(status, "creator") == 0) || (strcmp(status, "administrator") == 0)) {
+		c->is_admin = 1;
+		return tg_chat_admin_parse(&c->member, member_obj);
+	}
+
+	json_object *user_obj;
+	if (json_object_object_get_ex(member_obj, "user", &user_obj) == 0)
+		return -1;
+
+	c->is_admin = 0;
+	memset(&c->member, 0, sizeof(c->member));
+	return tg_user_parse(&c->member.user, user_obj);
+}
+
+
+static int
+_parse_callback_query(TgCallbackQuery *c, json_object *callback_query_obj, Arena *arena)
 {
 	json_object *id_obj;
 	if (json_object_object_get_ex(callback_query_obj, "id", &id_obj) == 0)
@@ -891,9 +953,9 @@ _parse_callback_query(TgCallbackQuery *c, json_object *callback_query_obj)
 
 	json_object *message_obj;
 	if (json_object_object_get_ex(callback_query_obj, "message", &message_obj) != 0) {
-		TgMessage *const message = calloc(1, sizeof(TgMessage));
+		TgMessage *const message = arena_calloc(arena, 1, sizeof(TgMessage));
 		if (message != NULL)
-			_parse_message(message, message_obj);
+			_parse_message(message, message_obj, arena);
 
 		c->message = message;
 	}
@@ -917,42 +979,86 @@ _parse_callback_query(TgCallbackQuery *c, json_object *callback_query_obj)
 
 
 static int
-_parse_user_alloc(TgUser **u, json_object *user_obj)
+_parse_user_alloc(TgUser **u, json_object *user_obj, Arena *arena)
 {
-	TgUser *const user = calloc(1, sizeof(TgUser));
+	TgUser *const user = arena_calloc(arena, 1, sizeof(TgUser));
 	if (user == NULL)
 		return -1;
 
-	if (tg_user_parse(user, user_obj) < 0) {
-		free(user);
+	if (tg_user_parse(user, user_obj) < 0)
 		return -1;
-	}
 
 	*u = user;
 	return 0;
 }
 
 
-static void
-_free_message(TgMessage *m)
+/* consumes the whole 'message' object, see: _parse_message() */
+static int
+_peek_message(TgUpdatePeek *p, JsonRawIter *it)
 {
-	switch (m->type) {
-	case TG_MESSAGE_TYPE_PHOTO:
-		free(m->photo);
-		break;
-	case TG_MESSAGE_TYPE_STICKER:
-		free(m->sticker.thumbnail);
-		break;
-	}
+	if (json_raw_iter_enter(it, '{') < 0)
+		return -1;
+
+	for (;;) {
+		JsonRaw key;
+		const int ret = json_raw_iter_next(it, &key);
+		if (ret <= 0)
+			return ret;
+
+		if (json_raw_str_eq(&key, "new_chat_member") ||
+		    json_raw_str_eq(&key, "left_chat_member")) {
+			p->is_ignored = 0;
+		} else if (json_raw_str_eq(&key, "entities")) {
+			const int is_command = _peek_entity_is_command(it);
+			if (is_command < 0)
+				return -1;
+			if (is_command)
+				p->is_ignored = 0;
 
-	for (size_t i = 0; i < m->entities_len; i++) {
-		if (m->entities[i].type != TG_MESSAGE_ENTITY_TYPE_TEXT_MENTION)
 			continue;
+		}
 
-		free(m->entities[i].user);
+		if (json_raw_iter_value(it, NULL) < 0)
+			return -1;
 	}
+}
+
+
+/* consumes the 'entities' array, ret: 1: the first entity is a bot command */
+static int
+_peek_entity_is_command(JsonRawIter *it)
+{
+	if (json_raw_iter_enter(it, '[') < 0)
+		return -1;
+
+	int ret = json_raw_iter_next(it, NULL);
+	if (ret <= 0)
+		return ret;
+
+	if (json_raw_iter_enter(it, '{') < 0)
+		return -1;
+
+	int is_command = 0;
+	for (;;) {
+		JsonRaw key;
+		ret = json_raw_iter_next(it, &key);
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			break;
+
+		JsonRaw val;
+		if (json_raw_iter_value(it, &val) < 0)
+			return -1;
+
+		if (json_raw_str_eq(&key, "type"))
+			is_command = json_raw_str_eq(&val, "bot_command");
+	}
+
+	/* the rest of the entities */
+	if (json_raw_iter_leave(it) < 0)
+		return -1;
 
-	free(m->from);
-	free(m->entities);
-	free(m->reply_to);
+	return is_command;
 }
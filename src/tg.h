@@ -70,13 +70,12 @@ enum {
 
 typedef struct tg_chat_admin {
 	int         is_anonymous;
-	TgUser     *user;
+	TgUser      user;
 	const char *custom_title; 	/* optional*/
 	int         privileges;
 } TgChatAdmin;
 
-int  tg_chat_admin_parse(TgChatAdmin *a, json_object *json);
-void tg_chat_admin_free(TgChatAdmin *a);
+int tg_chat_admin_parse(TgChatAdmin *a, json_object *json);
 
 
 /* ChatAdmin */
@@ -274,12 +273,23 @@ typedef struct tg_callback_query {
 } TgCallbackQuery;
 
 
+/*
+ * ChatMemberUpdated
+ */
+typedef struct tg_chat_member_updated {
+	int64_t     chat_id;
+	int         is_admin;	/* the new status: creator or administrator */
+	TgChatAdmin member;	/* the new one, privileges: 0 if it isn't an admin */
+} TgChatMemberUpdated;
+
+
 /*
  * Update
  */
 enum {
 	TG_UPDATE_TYPE_MESSAGE = 0,
 	TG_UPDATE_TYPE_CALLBACK_QUERY,
+	TG_UPDATE_TYPE_CHAT_MEMBER,
 	TG_UPDATE_TYPE_UNKNOWN,
 };
 
@@ -289,13 +299,24 @@ typedef struct tg_update {
 	int     type;
 	int64_t id;
 	union {
-		TgMessage       message;
-		TgCallbackQuery callback_query;
+		TgMessage           message;
+		TgCallbackQuery     callback_query;
+		TgChatMemberUpdated chat_member;
 	};
 } TgUpdate;
 
-int  tg_update_parse(TgUpdate *u, json_object *json);
-void tg_update_free(TgUpdate *u);
+/* every allocation is made from 'arena', the result lives until the arena is reset */
+int tg_update_parse(TgUpdate *u, json_object *json, Arena *arena);
+
+
+/* cheap look at the raw update, without building a json_object tree */
+typedef struct tg_update_peek {
+	int64_t id;
+	int     type;
+	int     is_ignored;	/* nothing in update.c would handle it */
+} TgUpdatePeek;
+
+int tg_update_peek(TgUpdatePeek *p, const char json[], size_t len);
 
 
 #endif
@@ -17,22 +17,11 @@ typedef struct thrd_pool_job {
 	DListNode   node;
 } ThrdPoolJob;
 
-typedef struct thrd_pool ThrdPool;
-
-typedef struct thrd_pool_worker {
+struct thrd_pool_worker {
 	unsigned  index;
 	ThrdPool *parent;
 	thrd_t    thread;
-} ThrdPoolWorker;
-
-typedef struct thrd_pool {
-	atomic_int      is_alive;
-	DList           jobs_queue;
-	ThrdPoolWorker *workers;
-	unsigned        workers_len;
-	cnd_t           cond;
-	mtx_t           mutex;
-} ThrdPool;
+};
 
 
 static ThrdPool _instance;
@@ -49,7 +38,27 @@ static int  _worker_fn(void *udata);
 int
 thrd_pool_create(unsigned thrd_size)
 {
-	ThrdPool *const t = &_instance;
+	return thrd_pool_init(&_instance, thrd_size);
+}
+
+
+void
+thrd_pool_destroy(void)
+{
+	thrd_pool_deinit(&_instance);
+}
+
+
+int
+thrd_pool_add_job(ThrdPoolFn func, void *ctx, void *udata)
+{
+	return thrd_pool_push(&_instance, func, ctx, udata);
+}
+
+
+int
+thrd_pool_init(ThrdPool *t, unsigned thrd_size)
+{
 	if (thrd_size <= 1) {
 		LOG_ERR(EINVAL, "thrd_pool", "thrd_size: %u", thrd_size);
 		return -1;
@@ -92,10 +101,8 @@ err0:
 
 
 void
-thrd_pool_destroy(void)
+thrd_pool_deinit(ThrdPool *t)
 {
-	ThrdPool *const t = &_instance;
-
 	_stop(t);
 	for (unsigned i = 0; i < t->workers_len; i++) {
 		ThrdPoolWorker *const wrk = &t->workers[i];
@@ -113,9 +120,8 @@ thrd_pool_destroy(void)
 
 
 int
-thrd_pool_add_job(ThrdPoolFn func, void *ctx, void *udata)
+thrd_pool_push(ThrdPool *t, ThrdPoolFn func, void *ctx, void *udata)
 {
-	ThrdPool *const t = &_instance;
 	if (func == NULL) {
 		LOG_ERRN("thrd_pool", "%s", "func == NULL");
 		return -1;
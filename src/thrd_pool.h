@@ -2,8 +2,11 @@
 #define __THRD_POOL_H__
 
 
+#include <stdatomic.h>
 #include <threads.h>
 
+#include "util.h"
+
 
 /*
  * TODO: Optimize; more reliable
@@ -11,6 +14,23 @@
 
 typedef void (*ThrdPoolFn) (void *ctx, void *udata);
 
+typedef struct thrd_pool_worker ThrdPoolWorker;
+
+typedef struct thrd_pool {
+	atomic_int      is_alive;
+	DList           jobs_queue;
+	ThrdPoolWorker *workers;
+	unsigned        workers_len;
+	cnd_t           cond;
+	mtx_t           mutex;
+} ThrdPool;
+
+/* a separate pool: its jobs don't wait behind the default one's */
+int  thrd_pool_init(ThrdPool *t, unsigned thrd_size);
+void thrd_pool_deinit(ThrdPool *t);
+int  thrd_pool_push(ThrdPool *t, ThrdPoolFn func, void *ctx, void *udata);
+
+/* the default pool */
 int  thrd_pool_create(unsigned thrd_size);
 void thrd_pool_destroy(void);
 int  thrd_pool_add_job(ThrdPoolFn func, void *ctx, void *udata);
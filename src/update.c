@@ -12,10 +12,12 @@
 
 static void _handle_message(const Update *u, const TgMessage *msg);
 static void _handle_callback(const Update *u, const TgCallbackQuery *cb);
+static void _handle_chat_member(const TgChatMemberUpdated *cm);
 static void _handle_message_command(const Update *u, const TgMessage *msg);
 static void _handle_member_new(const Update *u, const TgMessage *msg);
 static void _handle_member_leave(const Update *u, const TgMessage *msg);
-static void _handle_member_state(const TgMessage *msg, const TgUser *user, const char text[]);
+static void _handle_member_state(const Update *u, const TgMessage *msg, const TgUser *user,
+				 const char text[]);
 
 
 /*
@@ -26,10 +28,13 @@ update_handle(const Update *u)
 {
 	LOG_INFO("update", "%s", json_object_to_json_string_ext(u->resp, JSON_C_TO_STRING_PRETTY));
 
+	/* every outbound call (http, sqlite busy wait) made by this thread is bounded by it */
+	deadline_set(u->deadline_ms);
+
 	TgUpdate tgu;
-	if (tg_update_parse(&tgu, u->resp) < 0) {
+	if (tg_update_parse(&tgu, u->resp, u->arena) < 0) {
 		LOG_ERRN("update", "%s", "tg_update_parse: failed");
-		return;
+		goto out0;
 	}
 
 	switch (tgu.type) {
@@ -39,9 +44,16 @@ update_handle(const Update *u)
 	case TG_UPDATE_TYPE_CALLBACK_QUERY:
 		_handle_callback(u, &tgu.callback_query);
 		break;
+	case TG_UPDATE_TYPE_CHAT_MEMBER:
+		_handle_chat_member(&tgu.chat_member);
+		break;
 	}
 
-	tg_update_free(&tgu);
+	if (deadline_remain_ms(1) == 0)
+		LOG_ERRN("update", "deadline exceeded: %" PRIi64 " ms", time_now_ms() - u->deadline_ms);
+
+out0:
+	deadline_set(0);
 }
 
 
@@ -92,9 +104,12 @@ _handle_callback(const Update *u, const TgCallbackQuery *cb)
 		.id_chat = cb->message->chat.id,
 		.id_message = cb->message->id,
 		.id_callback = cb->id,
+		.arena = u->arena,
 		.bot_username = u->username,
 		.msg = cb->message,
 		.json = u->resp,
+		.raw = u->raw,
+		.raw_len = u->raw_len,
 	};
 
 	cmd_exec(&param, cb->data);
@@ -121,9 +136,12 @@ _handle_message_command(const Update *u, const TgMessage *msg)
 		.id_user = msg->from->id,
 		.id_chat = msg->chat.id,
 		.id_message = msg->id,
+		.arena = u->arena,
 		.bot_username = u->username,
 		.msg = msg,
 		.json = u->resp,
+		.raw = u->raw,
+		.raw_len = u->raw_len,
 	};
 
 	cmd_exec(&param, msg->text.cstr);
@@ -142,7 +160,7 @@ _handle_member_new(const Update *u, const TgMessage *msg)
 		return;
 	}
 
-	_handle_member_state(msg, user, "Hello");
+	_handle_member_state(u, msg, user, "Hello");
 }
 
 
@@ -151,13 +169,44 @@ _handle_member_leave(const Update *u, const TgMessage *msg)
 {
 	LOG_DEBUG("update", "%s", "");
 
-	_handle_member_state(msg, &msg->left_chat_member, "See you later");
-	(void)u;
+	const TgUser *const user = &msg->left_chat_member;
+	_handle_member_state(u, msg, user, "See you later");
+
+	/* cheap: the admin set of this chat is cached by now */
+	if (model_admin_get_privileges(msg->chat.id, user->id) > 0)
+		model_admin_remove(msg->chat.id, user->id);
+}
+
+
+/* promoted, demoted, or left: keep the admin set in sync without a full /admin_reload */
+static void
+_handle_chat_member(const TgChatMemberUpdated *cm)
+{
+	LOG_DEBUG("update", "%s", "");
+
+	const TgChatAdmin *const member = &cm->member;
+	if (cm->is_admin == 0) {
+		if (model_admin_get_privileges(cm->chat_id, member->user.id) > 0)
+			model_admin_remove(cm->chat_id, member->user.id);
+
+		return;
+	}
+
+	const ModelAdmin admin = {
+		.chat_id = cm->chat_id,
+		.user_id = member->user.id,
+		.first_name_in = member->user.first_name,
+		.is_bot = member->user.is_bot,
+		.is_anonymous = member->is_anonymous,
+		.privileges = member->privileges,
+	};
+
+	model_admin_set(&admin);
 }
 
 
 static void
-_handle_member_state(const TgMessage *msg, const TgUser *user, const char text[])
+_handle_member_state(const Update *u, const TgMessage *msg, const TgUser *user, const char text[])
 {
 	const int64_t chat_id = msg->chat.id;
 	if (model_admin_get_privileges(chat_id, user->id) > 0) {
@@ -176,17 +225,15 @@ _handle_member_state(const TgMessage *msg, const TgUser *user, const char text[]
 	if (user->is_bot)
 		return;
 
-	char *const fname = tg_escape(user->first_name);
+	const char *const fname = tg_escape_arena(u->arena, user->first_name);
 	if (fname == NULL)
 		return;
 
-	char *const msg_body = cstr_fmt("%s [%s](tg://user?id=%" PRIi64 ") \\:3", text, fname, user->id);
-	if (msg_body == NULL)
-		goto out0;
-
 	int64_t ret_id;
-	if (send_text_format(msg, &ret_id, "%s", msg_body) < 0)
-		goto out1;
+	if (send_text_format(msg, &ret_id, "%s [%s](tg://user?id=%" PRIi64 ") \\:3", text, fname,
+			     user->id) < 0) {
+		return;
+	}
 
 	const SchedParam schd = {
 		.chat_id = msg->chat.id,
@@ -197,9 +244,4 @@ _handle_member_state(const TgMessage *msg, const TgUser *user, const char text[]
 	};
 
 	sched_delete_message(&schd);
-
-out1:
-	free(msg_body);
-out0:
-	free(fname);
 }
@@ -5,12 +5,18 @@
 #include <stdint.h>
 #include <json.h>
 
+#include "util.h"
+
 
 typedef struct update {
 	int64_t      id_bot;
 	int64_t      id_owner;
+	int64_t      deadline_ms;	/* util.h: time_now_ms(), 0: no deadline */
+	Arena       *arena;		/* per-update allocations, reset when the update is done */
 	const char  *username;
 	json_object *resp;
+	const char  *raw;		/* the webhook body 'resp' was parsed from */
+	size_t       raw_len;
 } Update;
 
 void update_handle(const Update *u);
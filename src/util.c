@@ -4,7 +4,8 @@
 #include <fcntl.h>
 #include <json.h>
 #include <limits.h>
-#include <spawn.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <string.h>
 #include <strings.h>
@@ -17,6 +18,7 @@
 #include <unistd.h>
 
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -25,6 +27,8 @@
 
 #include "util.h"
 
+#include "ev.h"
+
 
 /*
  * cstr
@@ -846,23 +850,332 @@ str_dup(Str *s)
 }
 
 
+/*
+ * Arena
+ */
+#define _ARENA_ALIGN (_Alignof(max_align_t))
+
+
+static size_t
+_arena_align(size_t size)
+{
+	return (size + (_ARENA_ALIGN - 1)) & ~(_ARENA_ALIGN - 1);
+}
+
+
+void
+arena_init(Arena *a, char buffer[], size_t size, size_t chunk_size)
+{
+	/* align the caller buffer, so every allocation from it is max_align_t aligned */
+	const uintptr_t addr = (uintptr_t)buffer;
+	const size_t skip = _arena_align(addr) - addr;
+	if ((buffer == NULL) || (skip >= size)) {
+		buffer = NULL;
+		size = 0;
+	} else {
+		buffer += skip;
+		size -= skip;
+	}
+
+	a->buffer = buffer;
+	a->size = size;
+	a->used = 0;
+	a->chunk_size = (chunk_size == 0)? 4096 : chunk_size;
+	a->chunks = NULL;
+}
+
+
+void
+arena_deinit(Arena *a)
+{
+	ArenaChunk *chunk = a->chunks;
+	while (chunk != NULL) {
+		ArenaChunk *const next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	a->chunks = NULL;
+	a->used = 0;
+}
+
+
+void *
+arena_alloc(Arena *a, size_t size)
+{
+	size = _arena_align((size == 0)? 1 : size);
+	if ((a->size - a->used) >= size) {
+		void *const ret = a->buffer + a->used;
+		a->used += size;
+		return ret;
+	}
+
+	ArenaChunk *chunk = a->chunks;
+	if ((chunk == NULL) || ((chunk->size - chunk->used) < size)) {
+		const size_t csize = (size > a->chunk_size)? size : a->chunk_size;
+		chunk = malloc(sizeof(ArenaChunk) + csize);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->size = csize;
+		chunk->used = 0;
+		chunk->next = a->chunks;
+		a->chunks = chunk;
+	}
+
+	void *const ret = ((char *)chunk->data) + chunk->used;
+	chunk->used += size;
+	return ret;
+}
+
+
+void *
+arena_calloc(Arena *a, size_t nmemb, size_t size)
+{
+	if ((size != 0) && (nmemb > (SIZE_MAX / size))) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	void *const ret = arena_alloc(a, nmemb * size);
+	if (ret == NULL)
+		return NULL;
+
+	return memset(ret, 0, nmemb * size);
+}
+
+
+char *
+arena_vfmt(Arena *a, const char fmt[], va_list args)
+{
+	va_list va;
+	va_copy(va, args);
+
+	int ret = vsnprintf(NULL, 0, fmt, va);
+	va_end(va);
+	if (ret < 0)
+		return NULL;
+
+	const size_t len = ((size_t)ret) + 1;
+	char *const res = arena_alloc(a, len);
+	if (res == NULL)
+		return NULL;
+
+	va_copy(va, args);
+	ret = vsnprintf(res, len, fmt, va);
+	va_end(va);
+	if (ret < 0)
+		return NULL;
+
+	return res;
+}
+
+
+char *
+arena_fmt(Arena *a, const char fmt[], ...)
+{
+	va_list va;
+	va_start(va, fmt);
+	char *const ret = arena_vfmt(a, fmt, va);
+	va_end(va);
+	return ret;
+}
+
+
+char *
+arena_cstr_escape(Arena *a, const char escape[], char c, const char src[])
+{
+	if (CSTR_IS_EMPTY_OR(escape, src))
+		return NULL;
+
+	size_t len = 0;
+	for (const char *p = src; *p != '\0'; p++)
+		len += (strchr(escape, *p) != NULL)? 2 : 1;
+
+	char *const ret = arena_alloc(a, len + 1);
+	if (ret == NULL)
+		return NULL;
+
+	char *dest = ret;
+	for (const char *p = src; *p != '\0'; p++) {
+		if (strchr(escape, *p) != NULL)
+			*(dest++) = c;
+
+		*(dest++) = *p;
+	}
+
+	*dest = '\0';
+	return ret;
+}
+
+
 /*
  * Chld
  */
+/*
+ * One process of a worker. Reads one JSON request per line from its stdin, a socket, and
+ * writes one line back on it once a request is done: the acknowledgement.
+ */
+typedef struct chld_worker_proc {
+	EvCtx    ctx;		/* the socket, acks are read by the event loop, -1: closed */
+	pid_t    pid;		/* 0: not running */
+	int      is_spawning;
+	uint64_t spawn_gen;	/* see: Chld.spawn_gen */
+	int64_t  started_ms;
+	int64_t  kill_ms;	/* timed out: SIGTERM sent, SIGKILL after it, 0: not yet */
+	unsigned inflight;	/* written or about to be, not acknowledged yet */
+	int64_t  deadlines[CFG_CHLD_WORKER_INFLIGHT];	/* per request, oldest first, 0: none */
+	mtx_t    write_mutex;	/* one request at a time on the socket */
+} ChldWorkerProc;
+
+/* a long-running extern command */
+typedef struct chld_worker {
+	char           *name;
+	char           *file;
+	unsigned        next;
+	ChldWorkerProc  procs[CFG_CHLD_WORKER_PROCS];
+} ChldWorker;
+
+/* a one-shot invocation's stdout/stderr: a ring of its last CFG_CHLD_OUTPUT_SIZE bytes */
+typedef struct chld_output {
+	EvCtx    ctx;		/* the pipe's read end, -1: closed */
+	char     name[CFG_CHLD_OUTPUT_NAME_SIZE];
+	int64_t  chat_id;
+	pid_t    pid;
+	int      status;
+	time_t   started;
+	int64_t  elapsed_ms;
+	size_t   len;		/* read so far */
+	char    *buf;		/* running: the ring, done: the kept tail, NUL-terminated */
+} ChldOutput;
+
+/* a spawn or a worker request waiting for the limits, owns its copies */
+typedef struct chld_job {
+	uint32_t    key;
+	int         stdin_fd;
+	int64_t     chat_id;
+	int64_t     msg_id;
+	int64_t     queued_ms;
+	int         timeout_s;
+	int         cpu_s;
+	int         mem_mb;
+	char       *cgroup;
+	char       *tag;
+	char       *file;
+	const char *name;
+	char      **argv;		/* a spawn: one allocation, pointers, then strings */
+	ChldWorker *worker;		/* a worker request, NULL: a spawn */
+	char       *req;		/* a worker request: one allocation, the request, then strings */
+	size_t      req_len;
+	int         is_spawn;		/* set by _chld_queue_take(): see _chld_worker_reserve() */
+	int         log_fd;
+} ChldJob;
+
+/* set by the child on itself before exec, see: _chld_exec() */
+typedef struct chld_limits {
+	int           nice;		/* 0: none */
+	struct rlimit cpu;		/* rlim_cur 0: none */
+	struct rlimit mem;		/* RLIMIT_AS, rlim_cur 0: none */
+	char          cgroup_procs[4096];	/* empty: none */
+} ChldLimits;
+
 typedef struct chld {
-	const char *path;
-	const char *log_file;
+	int         dir_fd;
+	int         log_fd;
 	unsigned    count;
+	unsigned    pending;		/* reserved slots, a spawn in progress */
+	uint64_t    spawn_gen;		/* bumped by every spawn: a stashed pid only matches the ones before it */
+	uint64_t    spawn_gens[CFG_CHLD_ITEMS_SIZE];
 	unsigned    slots[CFG_CHLD_ITEMS_SIZE];
 	unsigned    entries[CFG_CHLD_ITEMS_SIZE];
 	pid_t       pids[CFG_CHLD_ITEMS_SIZE];
+	int64_t     started_ms[CFG_CHLD_ITEMS_SIZE];
+	uint32_t    keys[CFG_CHLD_ITEMS_SIZE];
+	int64_t     chat_ids[CFG_CHLD_ITEMS_SIZE];
+	int64_t     deadline_ms[CFG_CHLD_ITEMS_SIZE];	/* 0: none */
+	int64_t     kill_ms[CFG_CHLD_ITEMS_SIZE];		/* SIGTERM sent, SIGKILL after it, 0: not yet */
+	char       *tags[CFG_CHLD_ITEMS_SIZE];		/* ChldParam.tag, NULL: none */
+	uint64_t    timeout_count;
+	uint64_t    kill_count;
+	unsigned    reaped_len;		/* reaped before the spawner got the pid in, cleared when pending is 0 */
+	pid_t       reaped_pids[CFG_CHLD_ITEMS_SIZE];
+	int         reaped_status[CFG_CHLD_ITEMS_SIZE];
+	uint64_t    reaped_gens[CFG_CHLD_ITEMS_SIZE];
+	unsigned    failed_len;		/* exited before exec, left for chld_reap() */
+	pid_t       failed_pids[CFG_CHLD_ITEMS_SIZE];
+	ChldOutput  outputs[CFG_CHLD_ITEMS_SIZE];
+	uint64_t    history_count;
+	ChldOutput  history[CFG_CHLD_OUTPUT_HISTORY];
+	Str         unflushed;		/* formatted, for the log file: a queue, not the history ring */
+	uint64_t    unflushed_dropped;
+	atomic_flag is_flushing;
+	const char *log_file;
+	unsigned    queue_len;
+	ChldJob     queue[CFG_CHLD_QUEUE_SIZE];
+	unsigned    dropped_len;		/* timed out in the queue, not replied yet */
+	ChldDropped dropped[CFG_CHLD_QUEUE_SIZE];
 	unsigned    envp_len;
 	char       *envp[CFG_CHLD_ENVP_SIZE + 1]; /* +1 NULL */
+	unsigned    workers_len;
+	ChldWorker  workers[CFG_CHLD_WORKERS_SIZE];
 	mtx_t       mutex;
 } Chld;
 
+static_assert(CFG_CHLD_RUNNING_MAX <= CFG_CHLD_ITEMS_SIZE, "CFG_CHLD_RUNNING_MAX is too large");
+
 static Chld *_chld_instance = NULL;
 
+static unsigned    _chld_reserve(Chld *c, uint32_t key, int64_t chat_id);
+static int         _chld_pipe(int fds[2], const char file[]);
+static pid_t       _chld_exec(const Chld *c, const char file[], char *const argv[], int stdin_fd, int out_fd,
+			      const ChldParam *limits, pid_t *failed_pid);
+static int         _chld_limits_init(ChldLimits *l, const ChldParam *p);
+static const char *_chld_exec_child(const Chld *c, const ChldLimits *l, int stdin_fd, int out_fd);
+static void        _chld_commit(Chld *c, unsigned slot, pid_t pid, int out_fd, const ChldParam *p);
+static void        _chld_entry_del(Chld *c, unsigned index);
+static int         _chld_reaped_take(Chld *c, pid_t pid, uint64_t spawn_gen, int *status);
+static void        _chld_failed_add(Chld *c, pid_t pid, uint64_t spawn_gen);
+static int         _chld_failed_take(Chld *c, pid_t pid);
+static void        _chld_pending_done(Chld *c);
+static void        _chld_reap(Chld *c);
+static void        _chld_kill_expired(Chld *c, int64_t now);
+static int         _chld_can_run(const Chld *c, uint32_t key, int64_t chat_id);
+static uint32_t    _chld_key(const char file[]);
+static int64_t     _chld_deadline_ms(int timeout_s);
+static int         _chld_queue_has_room(const Chld *c, const char file[], int64_t chat_id);
+static int         _chld_queue_add(Chld *c, const ChldParam *p, uint32_t key);
+static int         _chld_queue_add_worker(Chld *c, const ChldParam *p, ChldWorker *w, const char req[],
+					  size_t len);
+static void        _chld_queue_expire(Chld *c, int64_t now);
+static unsigned    _chld_queue_take(Chld *c, ChldJob jobs[], unsigned slots[], unsigned size);
+static void        _chld_queue_spawn(Chld *c, ChldJob jobs[], const unsigned slots[], unsigned len);
+static ChldParam   _chld_job_param(const ChldJob *job);
+static void        _chld_queue_del(Chld *c, unsigned index);
+static int         _chld_release(Chld *c, pid_t pid, int status);
+static void        _chld_log_exit(const char name[], pid_t pid, int status, int64_t elapsed_ms);
+static void        _chld_log_rotate(Chld *c);
+static void        _chld_output_open(Chld *c, unsigned slot, pid_t pid, int fd, const ChldParam *p);
+static void        _chld_output_on_read(EvCtx *ctx);
+static void        _chld_output_read(ChldOutput *o);
+static void        _chld_output_close(ChldOutput *o);
+static void        _chld_output_done(Chld *c, unsigned slot, int status, int64_t elapsed_ms);
+static int         _chld_output_fmt(const ChldOutput *o, Str *str);
+static ChldWorker *_chld_worker_get(Chld *c, const char file[], const char name[]);
+static int         _chld_worker_reserve(Chld *c, ChldWorker *w, int timeout_s, int *is_spawn, int *log_fd);
+static int         _chld_worker_dispatch(Chld *c, ChldWorker *w, unsigned index, int is_spawn, int log_fd,
+					 const ChldParam *p, const char req[], size_t len);
+static int         _chld_worker_release(Chld *c, pid_t pid, int status);
+static void        _chld_worker_spawn(Chld *c, ChldWorker *w, unsigned index, int log_fd,
+				      const ChldParam *p);
+static void        _chld_worker_commit(Chld *c, ChldWorker *w, unsigned index, pid_t pid, int fd);
+static void        _chld_worker_on_read(EvCtx *ctx);
+static void        _chld_worker_read(ChldWorkerProc *proc);
+static void        _chld_worker_close(ChldWorkerProc *proc);
+static void        _chld_worker_kill_expired(Chld *c, int64_t now);
+static unsigned    _chld_worker_running(const Chld *c);
+static void        _chld_worker_stop(ChldWorkerProc *proc);
+static int         _chld_worker_write(int fd, const char buf[], size_t len, int64_t deadline);
+
 
 int
 chld_init(const char path[], const char log_file[])
@@ -875,19 +1188,45 @@ chld_init(const char path[], const char log_file[])
 		return -1;
 
 	memset(c, 0, sizeof(Chld));
-	if (mtx_init(&c->mutex, mtx_plain) != 0) {
-		free(c);
-		return -1;
+	if (mtx_init(&c->mutex, mtx_plain) != 0)
+		goto err0;
+
+	/* opened once: a spawn only dup2()s and fchdir()s, no path lookups in the child */
+	c->dir_fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (c->dir_fd < 0) {
+		LOG_ERRP("chld", "open: '%s'", path);
+		goto err1;
 	}
 
+	c->log_fd = open(log_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (c->log_fd < 0) {
+		LOG_ERRP("chld", "open: '%s'", log_file);
+		goto err2;
+	}
+
+	if (str_init_alloc(&c->unflushed, 4096, NULL) < 0)
+		goto err3;
+
 	unsigned i = CFG_CHLD_ITEMS_SIZE;
-	while (i--)
+	while (i--) {
 		c->slots[i] = i;
+		c->outputs[i].ctx.fd = -1;
+	}
 
-	c->path = path;
+	atomic_flag_clear(&c->is_flushing);
 	c->log_file = log_file;
 	_chld_instance = c;
 	return 0;
+
+err3:
+	close(c->log_fd);
+err2:
+	close(c->dir_fd);
+err1:
+	mtx_destroy(&c->mutex);
+err0:
+	free(c);
+	return -1;
 }
 
 
@@ -898,6 +1237,33 @@ chld_deinit(void)
 	for (unsigned i = 0; i < _chld_instance->envp_len; i++)
 		free(_chld_instance->envp[i]);
 
+	for (unsigned i = 0; i < _chld_instance->workers_len; i++) {
+		ChldWorker *const w = &_chld_instance->workers[i];
+		for (unsigned j = 0; j < CFG_CHLD_WORKER_PROCS; j++) {
+			_chld_worker_stop(&w->procs[j]);
+			mtx_destroy(&w->procs[j].write_mutex);
+		}
+
+		free(w->name);
+		free(w->file);
+	}
+
+	while (_chld_instance->queue_len > 0)
+		_chld_queue_del(_chld_instance, 0);
+
+	for (unsigned i = 0; i < CFG_CHLD_ITEMS_SIZE; i++) {
+		_chld_output_close(&_chld_instance->outputs[i]);
+		free(_chld_instance->outputs[i].buf);
+		free(_chld_instance->tags[i]);
+	}
+
+	for (unsigned i = 0; i < CFG_CHLD_OUTPUT_HISTORY; i++)
+		free(_chld_instance->history[i].buf);
+
+	str_deinit(&_chld_instance->unflushed);
+
+	close(_chld_instance->log_fd);
+	close(_chld_instance->dir_fd);
 	mtx_destroy(&_chld_instance->mutex);
 
 	free(_chld_instance);
@@ -981,93 +1347,171 @@ chld_add_env_kv_int64(const char key[], int64_t val)
 }
 
 
+/*
+ * Runs now if it fits CFG_CHLD_RUNNING_MAX, CFG_CHLD_RUNNING_PER_CMD, and CFG_CHLD_RUNNING_PER_CHAT,
+ * otherwise it's queued and started by chld_reap() once a child exits. The first queued job that
+ * fits goes first: a busy chat or command doesn't hold up the others.
+ *
+ * The mutex only covers the slot bookkeeping, the spawn runs without it.
+ */
 int
-chld_spawn(const char file[], char *const argv[])
+chld_spawn(const ChldParam *p)
 {
-	int ret = -1;
+	int ret = 0;
+	int slot = -1;
 	Chld *const c = _chld_instance;
 	assert(c != NULL);
 
+	const uint32_t key = _chld_key(p->file);
+	ChldJob jobs[CFG_CHLD_RUNNING_MAX];
+	unsigned slots[CFG_CHLD_RUNNING_MAX];
+
 	mtx_lock(&c->mutex);
 
-	const unsigned count = c->count;
-	if (count == CFG_CHLD_ITEMS_SIZE) {
-		LOG_ERRN("chld", "%s", "slot full");
-		goto out0;
-	}
+	const unsigned jobs_len = _chld_queue_take(c, jobs, slots, LEN(jobs));
+	if (_chld_can_run(c, key, p->chat_id))
+		slot = (int)_chld_reserve(c, key, p->chat_id);
+	else
+		ret = _chld_queue_add(c, p, key);
 
-	posix_spawn_file_actions_t act;
-	if (posix_spawn_file_actions_init(&act) != 0) {
-		LOG_ERRP("chld", "posix_spawn_file_actions_init: \"%s\"", file);
-		goto out0;
-	}
+	mtx_unlock(&c->mutex);
 
-	const int flags = O_WRONLY | O_CREAT | O_APPEND;
-	if (posix_spawn_file_actions_addopen(&act, STDOUT_FILENO, c->log_file, flags, 0644) != 0) {
-		LOG_ERRP("chld", "posix_spawn_file_actions_addopen: STDOUT: \"%s\"", file);
-		goto out1;
-	}
+	_chld_queue_spawn(c, jobs, slots, jobs_len);
+	if (slot < 0)
+		return ret;
 
-	if (posix_spawn_file_actions_adddup2(&act, STDOUT_FILENO, STDERR_FILENO) != 0) {
-		LOG_ERRP("chld", "posix_spawn_file_actions_adddup2: \"%s\"", file);
-		goto out1;
+	pid_t pid = -1;
+	pid_t failed_pid = -1;
+	int fds[2] = { -1, -1 };
+	if (_chld_pipe(fds, p->file) == 0) {
+		pid = _chld_exec(c, p->file, p->argv, p->stdin_fd, fds[1], p, &failed_pid);
+		close(fds[1]);
 	}
 
-	if (posix_spawn_file_actions_addchdir_np(&act, c->path) != 0) {
-		LOG_ERRP("chld", "posix_spawn_file_actions_addchdir_np: \"%s\"", file);
-		goto out1;
+	mtx_lock(&c->mutex);
+	_chld_failed_add(c, failed_pid, c->spawn_gens[slot]);
+	_chld_commit(c, (unsigned)slot, pid, fds[0], p);
+	mtx_unlock(&c->mutex);
+	return (pid < 0)? -1 : 0;
+}
+
+
+/*
+ * Hands a request to a process of the worker 'name' that has fewer than CFG_CHLD_WORKER_INFLIGHT
+ * unacknowledged ones, spawning it on demand. Otherwise it's queued like chld_spawn(), and sent
+ * once an acknowledgement or an exit makes room. A worker that died is restarted on the next
+ * request. One that doesn't acknowledge a request within its timeout_s is killed like a one-shot
+ * command: the requests in flight on it are lost, and logged.
+ * The mutex only covers the pick: the spawn and the write are done without it.
+ */
+int
+chld_worker_send(const ChldParam *p, const char name[], const char req[], size_t len)
+{
+	Chld *const c = _chld_instance;
+	assert(c != NULL);
+	assert(memchr(req, '\n', len) == NULL);
+
+	mtx_lock(&c->mutex);
+
+	ChldWorker *const w = _chld_worker_get(c, p->file, name);
+	if (w == NULL) {
+		mtx_unlock(&c->mutex);
+		return -1;
 	}
 
-	const unsigned slot = c->slots[count];
-	if (posix_spawn(&c->pids[slot], file, &act, NULL, argv, c->envp) != 0) {
-		LOG_ERRP("chld", "posix_spawn: \"%s\"", file);
-		goto out1;
+	int is_spawn = 0;
+	int log_fd = -1;
+	const int index = _chld_worker_reserve(c, w, p->timeout_s, &is_spawn, &log_fd);
+	if (index < 0) {
+		const int ret = _chld_queue_add_worker(c, p, w, req, len);
+		mtx_unlock(&c->mutex);
+		return ret;
 	}
 
-	LOG_DEBUG("chld", "spawn: \"%s\": %d: [%u:%u]", file, c->pids[slot], slot, c->count);
+	mtx_unlock(&c->mutex);
+	return _chld_worker_dispatch(c, w, (unsigned)index, is_spawn, log_fd, p, req, len);
+}
 
-	c->entries[count] = slot;
-	c->count = count + 1;
-	ret = 0;
 
-out1:
-	posix_spawn_file_actions_destroy(&act);
-out0:
+/*
+ * Called on SIGCHLD. Signals coalesce: reaps until there is nothing left.
+ */
+int
+chld_reap(void)
+{
+	Chld *const c = _chld_instance;
+	assert(c != NULL);
+
+	ChldJob jobs[CFG_CHLD_RUNNING_MAX];
+	unsigned slots[CFG_CHLD_RUNNING_MAX];
+
+	mtx_lock(&c->mutex);
+	_chld_reap(c);
+	const unsigned jobs_len = _chld_queue_take(c, jobs, slots, LEN(jobs));
+	const int is_full = (c->unflushed.len >= CFG_CHLD_LOG_FLUSH_SIZE);
 	mtx_unlock(&c->mutex);
-	return ret;
+
+	_chld_queue_spawn(c, jobs, slots, jobs_len);
+	return is_full;
 }
 
 
+/*
+ * Called periodically: SIGTERM on the wall-clock timeout, SIGKILL CFG_CHLD_KILL_GRACE_MS later.
+ * The queue is expired too: a job doesn't wait for the next spawn or exit to time out.
+ */
 void
-chld_reap(void)
+chld_kill_expired(void)
 {
 	Chld *const c = _chld_instance;
 	assert(c != NULL);
 
 	mtx_lock(&c->mutex);
+	const int64_t now = time_now_ms();
+	_chld_kill_expired(c, now);
+	_chld_worker_kill_expired(c, now);
+	_chld_queue_expire(c, now);
+	mtx_unlock(&c->mutex);
+}
 
-	unsigned rcount = 0;
-	unsigned *const entries = c->entries;
-	unsigned count = c->count;
-	for (unsigned i = 0; i < count; i++) {
-		const unsigned slot = entries[i];
-		if (waitpid(c->pids[slot], NULL, WNOHANG) == 0)
+
+unsigned
+chld_dropped_take(ChldDropped list[], unsigned size)
+{
+	Chld *const c = _chld_instance;
+	assert(c != NULL);
+
+	mtx_lock(&c->mutex);
+	const unsigned len = MIN(size, c->dropped_len);
+	memcpy(list, c->dropped, len * sizeof(ChldDropped));
+	c->dropped_len -= len;
+	memmove(c->dropped, c->dropped + len, c->dropped_len * sizeof(ChldDropped));
+	mtx_unlock(&c->mutex);
+	return len;
+}
+
+
+int
+chld_tag_get(pid_t pgid, char buf[], size_t size)
+{
+	Chld *const c = _chld_instance;
+	assert(c != NULL);
+
+	int ret = -1;
+	mtx_lock(&c->mutex);
+	for (unsigned i = 0; i < c->count; i++) {
+		const unsigned slot = c->entries[i];
+		if ((c->pids[slot] != pgid) || (c->tags[slot] == NULL))
 			continue;
 
-		count--;
-		entries[i] = entries[count];
-		c->slots[count] = slot;
-		rcount++;
-		i--;
+		if (cstr_copy_n(buf, size, c->tags[slot]) == strlen(c->tags[slot]))
+			ret = 0;
 
-		LOG_DEBUG("chld", "reap: %d: [%u:%u]", c->pids[slot], slot, count);
+		break;
 	}
 
-	assert(rcount <= c->count);
-	if (rcount > 0)
-		c->count -= rcount;
-
 	mtx_unlock(&c->mutex);
+	return ret;
 }
 
 
@@ -1079,68 +1523,1604 @@ chld_wait_all(void)
 
 	mtx_lock(&c->mutex);
 
-	const unsigned count = c->count;
-	for (unsigned i = 0; i < count; i++) {
-		const unsigned slot = c->entries[i];
-		const pid_t pid = c->pids[slot];
+	if (c->queue_len > 0)
+		LOG_INFO("chld", "dropping %u queued job(s)", c->queue_len);
 
-		LOG_INFO("chld", "waiting child process: (%u:%u): %d...", i, slot, pid);
+	while (c->queue_len > 0)
+		_chld_queue_del(c, 0);
 
-		waitpid(pid, NULL, 0);
+	/* a hung command doesn't hold the shutdown: CFG_CHLD_WAIT_ALL_S at most, then SIGTERM, SIGKILL */
+	const int64_t deadline = time_now_ms() + (CFG_CHLD_WAIT_ALL_S * 1000);
+	for (unsigned i = 0; i < c->count; i++) {
+		const unsigned slot = c->entries[i];
+		if ((c->deadline_ms[slot] == 0) || (c->deadline_ms[slot] > deadline))
+			c->deadline_ms[slot] = deadline;
+
+		LOG_INFO("chld", "waiting child process: (%u:%u): %d...", i, slot, c->pids[slot]);
 	}
 
-	mtx_unlock(&c->mutex);
-}
+	while (1) {
+		_chld_reap(c);
+		if (c->count == 0)
+			break;
 
+		_chld_kill_expired(c, time_now_ms());
 
-/*
- * misc
- */
-int
-val_is_null_and_n(size_t count, ...)
-{
-	va_list va;
-	va_start(va, count);
+		/* let a chld_spawn() in progress get its pid in */
+		mtx_unlock(&c->mutex);
+		thrd_sleep(&(struct timespec) { .tv_nsec = 100000000 }, NULL);
+		mtx_lock(&c->mutex);
+	}
 
-	int ret = 0;
-	for (size_t i = 0; i < count; i++) {
-		void *const curr = va_arg(va, void *);
-		if (curr != NULL)
-			goto out0;
+	LOG_INFO("chld", "timeouts: %" PRIu64 ", killed: %" PRIu64, c->timeout_count, c->kill_count);
+
+	/* EOF on stdin: workers finish their requests in flight, then exit */
+	for (unsigned i = 0; i < c->workers_len; i++) {
+		ChldWorker *const w = &c->workers[i];
+		for (unsigned j = 0; j < CFG_CHLD_WORKER_PROCS; j++) {
+			ChldWorkerProc *const proc = &w->procs[j];
+			_chld_worker_close(proc);
+			if (proc->pid != 0)
+				LOG_INFO("chld", "waiting worker: \"%s\": %d...", w->name, proc->pid);
+		}
 	}
 
-	ret = 1;
+	/* the same deadline, then SIGKILL: chld_deinit() gets what is left */
+	int is_killed = 0;
+	while (1) {
+		_chld_reap(c);
+		if (_chld_worker_running(c) == 0)
+			break;
 
-out0:
-	va_end(va);
-	return ret;
-}
+		const int64_t now = time_now_ms();
+		if (is_killed && (now >= (deadline + CFG_CHLD_KILL_GRACE_MS)))
+			break;
 
+		if ((is_killed == 0) && (now >= deadline)) {
+			for (unsigned i = 0; i < c->workers_len; i++) {
+				const ChldWorker *const w = &c->workers[i];
+				for (unsigned j = 0; j < CFG_CHLD_WORKER_PROCS; j++) {
+					const pid_t pid = w->procs[j].pid;
+					if (pid == 0)
+						continue;
 
-int
-val_is_null_or_n(size_t count, ...)
-{
-	va_list va;
-	va_start(va, count);
+					LOG_INFO("chld", "worker: \"%s\": %d: SIGKILL", w->name, pid);
+					kill(-pid, SIGKILL);
+				}
+			}
 
-	int ret = 1;
-	for (size_t i = 0; i < count; i++) {
-		void *const curr = va_arg(va, void *);
-		if (curr == NULL)
-			goto out0;
+			is_killed = 1;
+		}
+
+		mtx_unlock(&c->mutex);
+		thrd_sleep(&(struct timespec) { .tv_nsec = 100000000 }, NULL);
+		mtx_lock(&c->mutex);
 	}
 
-	ret = 0;
+	mtx_unlock(&c->mutex);
 
-out0:
-	va_end(va);
-	return ret;
+	chld_output_flush();
 }
 
 
-int
-val_cmp_n2(const void *a, size_t a_len, const void *b, size_t b_len)
-{
+/*
+ * The log file is only written from here, the event loop and the children don't wait on it.
+ * Workers write to it directly: they keep the old segment until they're restarted.
+ */
+void
+chld_output_flush(void)
+{
+	Chld *const c = _chld_instance;
+	assert(c != NULL);
+
+	if (atomic_flag_test_and_set(&c->is_flushing))
+		return;
+
+	/* swapped with the queue: the formatting was done by _chld_output_done() */
+	Str str;
+	if (str_init_alloc(&str, 4096, NULL) < 0)
+		goto out0;
+
+	mtx_lock(&c->mutex);
+
+	const Str unflushed = c->unflushed;
+	c->unflushed = str;
+	str = unflushed;
+
+	const uint64_t dropped = c->unflushed_dropped;
+	c->unflushed_dropped = 0;
+
+	mtx_unlock(&c->mutex);
+
+	if (dropped > 0)
+		LOG_ERRN("chld", "output: dropped %" PRIu64 " invocation(s)", dropped);
+
+	if (str.len == 0)
+		goto out1;
+
+	_chld_log_rotate(c);
+
+	/* only changed by _chld_log_rotate() */
+	const int fd = c->log_fd;
+	for (size_t off = 0; off < str.len;) {
+		const ssize_t wr = write(fd, str.cstr + off, str.len - off);
+		if (wr < 0) {
+			if (errno == EINTR)
+				continue;
+
+			LOG_ERRP("chld", "output: write: '%s'", c->log_file);
+			break;
+		}
+
+		off += (size_t)wr;
+	}
+
+out1:
+	str_deinit(&str);
+out0:
+	atomic_flag_clear(&c->is_flushing);
+}
+
+
+json_object *
+chld_output_get(unsigned count)
+{
+	Chld *const c = _chld_instance;
+	if (c == NULL)
+		return NULL;
+
+	json_object *const list = json_object_new_array();
+	if (list == NULL)
+		return NULL;
+
+	mtx_lock(&c->mutex);
+
+	const uint64_t total = c->history_count;
+	count = (unsigned)MIN((uint64_t)MIN(count, CFG_CHLD_OUTPUT_HISTORY), total);
+	for (unsigned i = 1; i <= count; i++) {
+		const ChldOutput *const o = &c->history[(total - i) % CFG_CHLD_OUTPUT_HISTORY];
+		json_object *const obj = json_object_new_object();
+		if (obj == NULL)
+			goto err0;
+
+		json_object_object_add(obj, "name", json_object_new_string(o->name));
+		json_object_object_add(obj, "chat_id", json_object_new_int64(o->chat_id));
+		json_object_object_add(obj, "pid", json_object_new_int(o->pid));
+		json_object_object_add(obj, "started", json_object_new_int64((int64_t)o->started));
+		json_object_object_add(obj, "elapsed_ms", json_object_new_int64(o->elapsed_ms));
+		if (WIFSIGNALED(o->status))
+			json_object_object_add(obj, "signal", json_object_new_int(WTERMSIG(o->status)));
+		else
+			json_object_object_add(obj, "status", json_object_new_int(WEXITSTATUS(o->status)));
+
+		json_object_object_add(obj, "size", json_object_new_int64((int64_t)o->len));
+
+		const size_t kept = MIN(o->len, CFG_CHLD_OUTPUT_SIZE);
+		json_object_object_add(obj, "output", json_object_new_string_len(cstr_empty_if_null(o->buf),
+										   (o->buf != NULL)? (int)kept : 0));
+		if (json_object_array_add(list, obj) < 0) {
+			json_object_put(obj);
+			goto err0;
+		}
+	}
+
+	mtx_unlock(&c->mutex);
+	return list;
+
+err0:
+	mtx_unlock(&c->mutex);
+	json_object_put(list);
+	return NULL;
+}
+
+
+/* the caller holds the mutex: the slot counts for the limits until _chld_commit() */
+static unsigned
+_chld_reserve(Chld *c, uint32_t key, int64_t chat_id)
+{
+	const unsigned count = c->count;
+	assert(count < CFG_CHLD_ITEMS_SIZE);
+
+	const unsigned slot = c->slots[count];
+	c->pids[slot] = 0;
+	c->deadline_ms[slot] = 0;
+	c->kill_ms[slot] = 0;
+	c->started_ms[slot] = time_now_ms();
+	c->keys[slot] = key;
+	c->chat_ids[slot] = chat_id;
+	c->entries[count] = slot;
+	c->count = count + 1;
+	c->spawn_gens[slot] = ++c->spawn_gen;
+	c->pending++;
+	return slot;
+}
+
+
+static int
+_chld_pipe(int fds[2], const char file[])
+{
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		LOG_ERRP("chld", "pipe2: \"%s\"", file);
+		return -1;
+	}
+
+	/* the read end only, the child gets a blocking stdout */
+	if (fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK) < 0) {
+		LOG_ERRP("chld", "fcntl: O_NONBLOCK: \"%s\"", file);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * vfork(), not posix_spawn(): the child puts itself in its own process group and sets the limits
+ * before exec, nothing it starts can escape them. It shares our memory until then: syscalls only,
+ * everything is prepared here.
+ * 'out_fd': the child's stdout and stderr,
+ * 'limits': CFG_CHLD_NICE, cpu_s, mem_mb, and cgroup of a one-shot command, NULL: none.
+ * 'failed_pid': a child that exited before exec, not waited for here: chld_reap() may get it
+ * first, see: _chld_failed_add(). -1: none.
+ */
+static pid_t
+_chld_exec(const Chld *c, const char file[], char *const argv[], int stdin_fd, int out_fd,
+	   const ChldParam *limits, pid_t *failed_pid)
+{
+	*failed_pid = -1;
+
+	ChldLimits l;
+	if (_chld_limits_init(&l, limits) < 0)
+		return -1;
+
+	/* set by the child: it writes to our memory */
+	volatile int err = 0;
+	const char *volatile err_ctx = NULL;
+
+	const pid_t pid = vfork();
+	if (pid == 0) {
+		const char *const ctx = _chld_exec_child(c, &l, stdin_fd, out_fd);
+		if (ctx == NULL) {
+			execve(file, argv, c->envp);
+			err_ctx = "execve";
+		} else {
+			err_ctx = ctx;
+		}
+
+		err = errno;
+		_exit(127);
+	}
+
+	if (pid < 0) {
+		LOG_ERRP("chld", "vfork: \"%s\"", file);
+		return -1;
+	}
+
+	if (err_ctx == NULL)
+		return pid;
+
+	LOG_ERRN("chld", "%s: \"%s\": %s", err_ctx, file, strerror(err));
+	*failed_pid = pid;
+	return -1;
+}
+
+
+/* 'p': NULL: none */
+static int
+_chld_limits_init(ChldLimits *l, const ChldParam *p)
+{
+	l->nice = 0;
+	l->cpu = (struct rlimit) { 0 };
+	l->mem = (struct rlimit) { 0 };
+	l->cgroup_procs[0] = '\0';
+	if (p == NULL)
+		return 0;
+
+	l->nice = CFG_CHLD_NICE;
+
+	/* SIGXCPU at the soft limit, SIGKILL at the hard one */
+	if (p->cpu_s > 0)
+		l->cpu = (struct rlimit) { .rlim_cur = (rlim_t)p->cpu_s, .rlim_max = (rlim_t)p->cpu_s + 1 };
+
+	if (p->mem_mb > 0)
+		l->mem = (struct rlimit) { .rlim_cur = (rlim_t)p->mem_mb << 20, .rlim_max = (rlim_t)p->mem_mb << 20 };
+
+	if (cstr_is_empty(p->cgroup))
+		return 0;
+
+	const int ret = snprintf(l->cgroup_procs, LEN(l->cgroup_procs), "%s/cgroup.procs", p->cgroup);
+	if ((ret < 0) || ((size_t)ret >= LEN(l->cgroup_procs))) {
+		LOG_ERRN("chld", "cgroup: '%s': path is too long", p->cgroup);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * The vfork()ed child, before exec: no locks, no malloc, no logging.
+ * Fails closed: a limit that can't be set is not skipped. ret: NULL: success, the failed step.
+ * The cgroup is set up by the admin (cpu.max, memory.max, ...), it's only joined here.
+ */
+static const char *
+_chld_exec_child(const Chld *c, const ChldLimits *l, int stdin_fd, int out_fd)
+{
+	/* a timeout kills the whole group: kill(-pid, ...) */
+	if (setpgid(0, 0) < 0)
+		return "setpgid";
+
+	/* the calling thread's, the only one here */
+	if ((l->nice != 0) && (setpriority(PRIO_PROCESS, 0, l->nice) < 0))
+		return "setpriority";
+
+	if ((l->cpu.rlim_cur > 0) && (setrlimit(RLIMIT_CPU, &l->cpu) < 0))
+		return "setrlimit: RLIMIT_CPU";
+
+	if ((l->mem.rlim_cur > 0) && (setrlimit(RLIMIT_AS, &l->mem) < 0))
+		return "setrlimit: RLIMIT_AS";
+
+	if (l->cgroup_procs[0] != '\0') {
+		const int fd = open(l->cgroup_procs, O_WRONLY | O_CLOEXEC);
+		if (fd < 0)
+			return "cgroup: open";
+
+		/* "0": the writer itself */
+		const ssize_t ret = write(fd, "0", 1);
+		close(fd);
+		if (ret < 0)
+			return "cgroup: write";
+	}
+
+	if ((stdin_fd >= 0) && (dup2(stdin_fd, STDIN_FILENO) < 0))
+		return "dup2: STDIN";
+
+	if ((dup2(out_fd, STDOUT_FILENO) < 0) || (dup2(out_fd, STDERR_FILENO) < 0))
+		return "dup2";
+
+	if (fchdir(c->dir_fd) < 0)
+		return "fchdir";
+
+	/* the signals handled by signalfd are blocked in the parent, not in the children */
+	sigset_t mask;
+	sigemptyset(&mask);
+	if (sigprocmask(SIG_SETMASK, &mask, NULL) < 0)
+		return "sigprocmask";
+
+	return NULL;
+}
+
+
+/*
+ * The caller holds the mutex. 'pid' < 0: the spawn failed, the slot is given back.
+ * chld_reap() may have got the child before this: it's in 'reaped_pids' then.
+ * 'out_fd': the read end of the child's stdout/stderr, owned from here.
+ */
+static void
+_chld_commit(Chld *c, unsigned slot, pid_t pid, int out_fd, const ChldParam *p)
+{
+	unsigned index = 0;
+	while (c->entries[index] != slot)
+		index++;
+
+	if (pid < 0) {
+		if (out_fd >= 0)
+			close(out_fd);
+
+		_chld_entry_del(c, index);
+		goto out0;
+	}
+
+	_chld_output_open(c, slot, pid, out_fd, p);
+
+	int status;
+	if (_chld_reaped_take(c, pid, c->spawn_gens[slot], &status) == 0) {
+		const int64_t elapsed_ms = time_now_ms() - c->started_ms[slot];
+		_chld_log_exit("child", pid, status, elapsed_ms);
+		_chld_output_done(c, slot, status, elapsed_ms);
+		_chld_entry_del(c, index);
+		goto out0;
+	}
+
+	/* not reaped yet, and it can't be while the mutex is held: the pid is still ours */
+	c->pids[slot] = pid;
+	LOG_DEBUG("chld", "spawn: \"%s\": %d: [%u:%u]", p->file, pid, slot, c->count);
+
+	c->deadline_ms[slot] = _chld_deadline_ms(p->timeout_s);
+	if ((cstr_is_empty(p->tag) == 0) && ((c->tags[slot] = strdup(p->tag)) == NULL))
+		LOG_ERRP("chld", "strdup: tag: %d", pid);
+
+out0:
+	_chld_pending_done(c);
+}
+
+
+/* the caller holds the mutex */
+static void
+_chld_entry_del(Chld *c, unsigned index)
+{
+	unsigned *const entries = c->entries;
+	const unsigned slot = entries[index];
+	const unsigned count = --c->count;
+	entries[index] = entries[count];
+	c->slots[count] = slot;
+
+	free(c->tags[slot]);
+	c->tags[slot] = NULL;
+}
+
+
+/*
+ * The caller holds the mutex. 'spawn_gen': the spawn's, taken before it forked: a pid stashed
+ * before that belonged to an older child, the kernel reused it. ret: 0: found and removed.
+ */
+static int
+_chld_reaped_take(Chld *c, pid_t pid, uint64_t spawn_gen, int *status)
+{
+	for (unsigned i = 0; i < c->reaped_len; i++) {
+		if ((c->reaped_pids[i] != pid) || (c->reaped_gens[i] < spawn_gen))
+			continue;
+
+		*status = c->reaped_status[i];
+
+		const unsigned last = --c->reaped_len;
+		c->reaped_pids[i] = c->reaped_pids[last];
+		c->reaped_status[i] = c->reaped_status[last];
+		c->reaped_gens[i] = c->reaped_gens[last];
+		return 0;
+	}
+
+	return -1;
+}
+
+
+/*
+ * The caller holds the mutex, before the commit: the spawn is still pending. 'pid': from
+ * _chld_exec(), -1: none. Reaped already: it's in the stash, dropped. Otherwise it can't be
+ * reaped while the mutex is held: chld_reap() collects it later, without calling it unknown.
+ */
+static void
+_chld_failed_add(Chld *c, pid_t pid, uint64_t spawn_gen)
+{
+	if (pid < 0)
+		return;
+
+	int status;
+	if (_chld_reaped_take(c, pid, spawn_gen, &status) == 0)
+		return;
+
+	if (c->failed_len >= CFG_CHLD_ITEMS_SIZE) {
+		LOG_ERRN("chld", "%d: failed: too many unreaped", pid);
+		return;
+	}
+
+	c->failed_pids[c->failed_len++] = pid;
+}
+
+
+/* the caller holds the mutex. ret: 0: found and removed */
+static int
+_chld_failed_take(Chld *c, pid_t pid)
+{
+	for (unsigned i = 0; i < c->failed_len; i++) {
+		if (c->failed_pids[i] != pid)
+			continue;
+
+		c->failed_pids[i] = c->failed_pids[--c->failed_len];
+		return 0;
+	}
+
+	return -1;
+}
+
+
+/* the caller holds the mutex: no spawn in progress, what is left in the stash is nobody's */
+static void
+_chld_pending_done(Chld *c)
+{
+	assert(c->pending > 0);
+	if (--c->pending > 0)
+		return;
+
+	for (unsigned i = 0; i < c->reaped_len; i++)
+		LOG_ERRN("chld", "reap: %d: unknown child process", c->reaped_pids[i]);
+
+	c->reaped_len = 0;
+}
+
+
+/* the caller holds the mutex */
+static void
+_chld_reap(Chld *c)
+{
+	while (1) {
+		int status;
+		const pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid <= 0)
+			break;
+
+		if (_chld_release(c, pid, status) == 0)
+			continue;
+
+		if (_chld_worker_release(c, pid, status) == 0)
+			continue;
+
+		/* logged by _chld_exec() */
+		if (_chld_failed_take(c, pid) == 0)
+			continue;
+
+		if ((c->pending > 0) && (c->reaped_len < CFG_CHLD_ITEMS_SIZE)) {
+			const unsigned len = c->reaped_len++;
+			c->reaped_pids[len] = pid;
+			c->reaped_status[len] = status;
+			c->reaped_gens[len] = c->spawn_gen;
+			continue;
+		}
+
+		LOG_ERRN("chld", "reap: %d: unknown child process", pid);
+	}
+}
+
+
+/* the caller holds the mutex */
+static void
+_chld_kill_expired(Chld *c, int64_t now)
+{
+	for (unsigned i = 0; i < c->count; i++) {
+		const unsigned slot = c->entries[i];
+		const pid_t pid = c->pids[slot];
+		if ((pid == 0) || (c->deadline_ms[slot] == 0) || (now < c->deadline_ms[slot]))
+			continue;
+
+		if (c->kill_ms[slot] == 0) {
+			c->timeout_count++;
+			c->kill_ms[slot] = now + CFG_CHLD_KILL_GRACE_MS;
+			LOG_INFO("chld", "%d: timed out: SIGTERM: %" PRIi64 " ms [%" PRIu64 "]", pid,
+				 now - c->started_ms[slot], c->timeout_count);
+			kill(-pid, SIGTERM);
+		} else if (now >= c->kill_ms[slot]) {
+			c->kill_count++;
+			c->kill_ms[slot] = INT64_MAX;
+			LOG_INFO("chld", "%d: timed out: SIGKILL: %" PRIi64 " ms [%" PRIu64 "]", pid,
+				 now - c->started_ms[slot], c->kill_count);
+			kill(-pid, SIGKILL);
+		}
+	}
+}
+
+
+static int
+_chld_can_run(const Chld *c, uint32_t key, int64_t chat_id)
+{
+	if (c->count >= CFG_CHLD_RUNNING_MAX)
+		return 0;
+
+	unsigned per_cmd = 0;
+	unsigned per_chat = 0;
+	for (unsigned i = 0; i < c->count; i++) {
+		const unsigned slot = c->entries[i];
+		if (c->keys[slot] == key)
+			per_cmd++;
+		if ((chat_id != 0) && (c->chat_ids[slot] == chat_id))
+			per_chat++;
+	}
+
+	return (per_cmd < CFG_CHLD_RUNNING_PER_CMD) && (per_chat < CFG_CHLD_RUNNING_PER_CHAT);
+}
+
+
+static uint32_t
+_chld_key(const char file[])
+{
+	const uint64_t hash = fnv1a_cstr(FNV1A_INIT, file, 0);
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+
+/* 'timeout_s': ChldParam's, ret: time_now_ms() based, 0: none */
+static int64_t
+_chld_deadline_ms(int timeout_s)
+{
+	if (timeout_s == 0)
+		timeout_s = CFG_CHLD_TIMEOUT_S;
+
+	return (timeout_s > 0)? (time_now_ms() + ((int64_t)timeout_s * 1000)) : 0;
+}
+
+
+static int
+_chld_queue_has_room(const Chld *c, const char file[], int64_t chat_id)
+{
+	if (c->queue_len == CFG_CHLD_QUEUE_SIZE) {
+		LOG_ERRN("chld", "queue full: \"%s\"", file);
+		return 0;
+	}
+
+	/* one busy chat can't take the whole queue */
+	if (chat_id != 0) {
+		unsigned per_chat = 0;
+		for (unsigned i = 0; i < c->queue_len; i++) {
+			if (c->queue[i].chat_id == chat_id)
+				per_chat++;
+		}
+
+		if (per_chat >= CFG_CHLD_QUEUE_PER_CHAT) {
+			LOG_ERRN("chld", "queue: chat: %" PRIi64 ": full: \"%s\"", chat_id, file);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+static int
+_chld_queue_add(Chld *c, const ChldParam *p, uint32_t key)
+{
+	if (_chld_queue_has_room(c, p->file, p->chat_id) == 0)
+		return -1;
+
+	const char *const cgroup = cstr_empty_if_null(p->cgroup);
+	const char *const tag = cstr_empty_if_null(p->tag);
+	size_t argc = 0;
+	size_t size = strlen(p->file) + 1 + strlen(cgroup) + 1 + strlen(tag) + 1;
+	for (; p->argv[argc] != NULL; argc++)
+		size += strlen(p->argv[argc]) + 1;
+
+	char **const argv = malloc(((argc + 1) * sizeof(char *)) + size);
+	if (argv == NULL) {
+		LOG_ERRP("chld", "malloc: \"%s\"", p->file);
+		return -1;
+	}
+
+	int stdin_fd = -1;
+	if ((p->stdin_fd >= 0) && ((stdin_fd = fcntl(p->stdin_fd, F_DUPFD_CLOEXEC, 0)) < 0)) {
+		LOG_ERRP("chld", "fcntl: F_DUPFD_CLOEXEC: \"%s\"", p->file);
+		free(argv);
+		return -1;
+	}
+
+	char *str = (char *)(argv + argc + 1);
+	for (size_t i = 0; i < argc; i++) {
+		const size_t len = strlen(p->argv[i]) + 1;
+		argv[i] = memcpy(str, p->argv[i], len);
+		str += len;
+	}
+
+	argv[argc] = NULL;
+	char *const file = strcpy(str, p->file);
+	char *const cgroup_str = strcpy(file + strlen(file) + 1, cgroup);
+	c->queue[c->queue_len++] = (ChldJob) {
+		.key = key,
+		.chat_id = p->chat_id,
+		.msg_id = p->msg_id,
+		.queued_ms = time_now_ms(),
+		.timeout_s = p->timeout_s,
+		.cpu_s = p->cpu_s,
+		.mem_mb = p->mem_mb,
+		.cgroup = cgroup_str,
+		.tag = strcpy(cgroup_str + strlen(cgroup_str) + 1, tag),
+		.file = file,
+		.name = (argc > 1)? argv[1] : file,
+		.argv = argv,
+		.stdin_fd = stdin_fd,
+		.log_fd = -1,
+	};
+
+	LOG_INFO("chld", "queued: \"%s\": [%u:%u]", p->file, c->count, c->queue_len);
+	return 0;
+}
+
+
+/* the caller holds the mutex: the worker's processes are all busy */
+static int
+_chld_queue_add_worker(Chld *c, const ChldParam *p, ChldWorker *w, const char req[], size_t len)
+{
+	if (_chld_queue_has_room(c, p->file, p->chat_id) == 0)
+		return -1;
+
+	const char *const cgroup = cstr_empty_if_null(p->cgroup);
+	char *const buf = malloc(len + 1 + strlen(cgroup) + 1);
+	if (buf == NULL) {
+		LOG_ERRP("chld", "malloc: \"%s\"", p->file);
+		return -1;
+	}
+
+	memcpy(buf, req, len);
+	buf[len] = '\0';
+	c->queue[c->queue_len++] = (ChldJob) {
+		.key = _chld_key(p->file),
+		.stdin_fd = -1,
+		.chat_id = p->chat_id,
+		.msg_id = p->msg_id,
+		.queued_ms = time_now_ms(),
+		.timeout_s = p->timeout_s,
+		.cpu_s = p->cpu_s,
+		.mem_mb = p->mem_mb,
+		.cgroup = strcpy(buf + len + 1, cgroup),
+		.file = w->file,
+		.name = w->name,
+		.worker = w,
+		.req = buf,
+		.req_len = len,
+		.log_fd = -1,
+	};
+
+	LOG_INFO("chld", "queued: worker: \"%s\": [%u]", w->name, c->queue_len);
+	return 0;
+}
+
+
+/* the caller holds the mutex: the timed out jobs go to 'dropped', for chld_dropped_take() */
+static void
+_chld_queue_expire(Chld *c, int64_t now)
+{
+	for (unsigned i = 0; i < c->queue_len;) {
+		const ChldJob *const job = &c->queue[i];
+		if ((now - job->queued_ms) < CFG_CHLD_QUEUE_TIMEOUT_MS) {
+			i++;
+			continue;
+		}
+
+		LOG_ERRN("chld", "queue: \"%s\": timed out", job->file);
+		if ((job->chat_id != 0) && (c->dropped_len < CFG_CHLD_QUEUE_SIZE)) {
+			ChldDropped *const d = &c->dropped[c->dropped_len++];
+			d->chat_id = job->chat_id;
+			d->msg_id = job->msg_id;
+			cstr_copy_n(d->name, LEN(d->name), job->name);
+		}
+
+		_chld_queue_del(c, i);
+	}
+}
+
+
+/* the caller holds the mutex: moves the jobs that fit out of the queue, into reserved slots */
+static unsigned
+_chld_queue_take(Chld *c, ChldJob jobs[], unsigned slots[], unsigned size)
+{
+	unsigned len = 0;
+	const int64_t now = time_now_ms();
+	_chld_queue_expire(c, now);
+	for (unsigned i = 0; (i < c->queue_len) && (len < size);) {
+		ChldJob *const job = &c->queue[i];
+		if (job->worker != NULL) {
+			/* 'slots': the worker's process */
+			const int index = _chld_worker_reserve(c, job->worker, job->timeout_s, &job->is_spawn,
+							       &job->log_fd);
+			if (index < 0) {
+				i++;
+				continue;
+			}
+
+			slots[len] = (unsigned)index;
+		} else {
+			if (_chld_can_run(c, job->key, job->chat_id) == 0) {
+				i++;
+				continue;
+			}
+
+			slots[len] = _chld_reserve(c, job->key, job->chat_id);
+		}
+
+		LOG_DEBUG("chld", "queue: \"%s\": waited: %" PRIi64 " ms", job->name, now - job->queued_ms);
+		jobs[len++] = *job;
+
+		/* owned by 'jobs' now */
+		job->stdin_fd = -1;
+		job->argv = NULL;
+		job->req = NULL;
+		_chld_queue_del(c, i);
+	}
+
+	return len;
+}
+
+
+/* without the mutex */
+static void
+_chld_queue_spawn(Chld *c, ChldJob jobs[], const unsigned slots[], unsigned len)
+{
+	if (len == 0)
+		return;
+
+	pid_t pids[CFG_CHLD_RUNNING_MAX];
+	pid_t failed_pids[CFG_CHLD_RUNNING_MAX];
+	int out_fds[CFG_CHLD_RUNNING_MAX];
+	for (unsigned i = 0; i < len; i++) {
+		int fds[2] = { -1, -1 };
+		pids[i] = -1;
+		failed_pids[i] = -1;
+		if (jobs[i].worker != NULL)
+			continue;
+
+		if (_chld_pipe(fds, jobs[i].file) == 0) {
+			const ChldParam param = _chld_job_param(&jobs[i]);
+			pids[i] = _chld_exec(c, param.file, param.argv, param.stdin_fd, fds[1], &param,
+					     &failed_pids[i]);
+			close(fds[1]);
+		}
+
+		out_fds[i] = fds[0];
+	}
+
+	mtx_lock(&c->mutex);
+	for (unsigned i = 0; i < len; i++) {
+		if (jobs[i].worker != NULL)
+			continue;
+
+		const ChldParam param = _chld_job_param(&jobs[i]);
+		_chld_failed_add(c, failed_pids[i], c->spawn_gens[slots[i]]);
+		_chld_commit(c, slots[i], pids[i], out_fds[i], &param);
+	}
+	mtx_unlock(&c->mutex);
+
+	for (unsigned i = 0; i < len; i++) {
+		ChldJob *const job = &jobs[i];
+		if (job->worker != NULL) {
+			const ChldParam param = _chld_job_param(job);
+			_chld_worker_dispatch(c, job->worker, slots[i], job->is_spawn, job->log_fd, &param,
+					      job->req, job->req_len);
+		}
+
+		if (job->stdin_fd >= 0)
+			close(job->stdin_fd);
+
+		free(job->argv);
+		free(job->req);
+	}
+}
+
+
+static ChldParam
+_chld_job_param(const ChldJob *job)
+{
+	return (ChldParam) {
+		.file = job->file,
+		.argv = job->argv,
+		.stdin_fd = job->stdin_fd,
+		.chat_id = job->chat_id,
+		.msg_id = job->msg_id,
+		.timeout_s = job->timeout_s,
+		.cpu_s = job->cpu_s,
+		.mem_mb = job->mem_mb,
+		.cgroup = job->cgroup,
+		.tag = job->tag,
+	};
+}
+
+
+static void
+_chld_queue_del(Chld *c, unsigned index)
+{
+	ChldJob *const job = &c->queue[index];
+	if (job->stdin_fd >= 0)
+		close(job->stdin_fd);
+
+	free(job->argv);
+	free(job->req);
+
+	c->queue_len--;
+	memmove(job, job + 1, (c->queue_len - index) * sizeof(ChldJob));
+}
+
+
+static int
+_chld_release(Chld *c, pid_t pid, int status)
+{
+	unsigned *const entries = c->entries;
+	for (unsigned i = 0; i < c->count; i++) {
+		const unsigned slot = entries[i];
+		if (c->pids[slot] != pid)
+			continue;
+
+		_chld_entry_del(c, i);
+
+		const int64_t elapsed_ms = time_now_ms() - c->started_ms[slot];
+		LOG_DEBUG("chld", "reap: %d: [%u:%u]", pid, slot, c->count);
+		_chld_log_exit("child", pid, status, elapsed_ms);
+		_chld_output_done(c, slot, status, elapsed_ms);
+		return 0;
+	}
+
+	return -1;
+}
+
+
+static void
+_chld_log_exit(const char name[], pid_t pid, int status, int64_t elapsed_ms)
+{
+	if (WIFSIGNALED(status)) {
+		LOG_INFO("chld", "%s: %d: killed by signal: %d: %" PRIi64 " ms", name, pid, WTERMSIG(status),
+			 elapsed_ms);
+	} else if (WEXITSTATUS(status) != 0) {
+		LOG_INFO("chld", "%s: %d: exit status: %d: %" PRIi64 " ms", name, pid, WEXITSTATUS(status),
+			 elapsed_ms);
+	} else {
+		LOG_DEBUG("chld", "%s: %d: exited: %" PRIi64 " ms", name, pid, elapsed_ms);
+	}
+}
+
+
+/* called by chld_output_flush() only */
+static void
+_chld_log_rotate(Chld *c)
+{
+	struct stat st;
+	if ((fstat(c->log_fd, &st) < 0) || (st.st_size < CFG_CHLD_LOG_SEGMENT_SIZE))
+		return;
+
+	char old_path[PATH_MAX];
+	char new_path[PATH_MAX];
+	for (unsigned i = CFG_CHLD_LOG_SEGMENTS; i > 1; i--) {
+		snprintf(old_path, LEN(old_path), "%s.%u", c->log_file, i - 1);
+		snprintf(new_path, LEN(new_path), "%s.%u", c->log_file, i);
+		if ((rename(old_path, new_path) < 0) && (errno != ENOENT))
+			LOG_ERRP("chld", "rename: '%s' -> '%s'", old_path, new_path);
+	}
+
+	snprintf(new_path, LEN(new_path), "%s.1", c->log_file);
+	if (rename(c->log_file, new_path) < 0) {
+		LOG_ERRP("chld", "rename: '%s' -> '%s'", c->log_file, new_path);
+		return;
+	}
+
+	const int fd = open(c->log_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		LOG_ERRP("chld", "open: '%s'", c->log_file);
+		return;
+	}
+
+	/* a worker spawn reads it under the mutex */
+	mtx_lock(&c->mutex);
+	const int old_fd = c->log_fd;
+	c->log_fd = fd;
+	mtx_unlock(&c->mutex);
+
+	close(old_fd);
+	LOG_INFO("chld", "log rotated: '%s'", new_path);
+}
+
+
+/* the caller holds the mutex */
+static void
+_chld_output_open(Chld *c, unsigned slot, pid_t pid, int fd, const ChldParam *p)
+{
+	ChldOutput *const o = &c->outputs[slot];
+	const char *const name = ((p->argv[0] != NULL) && (p->argv[1] != NULL))? p->argv[1] : p->file;
+
+	free(o->buf);
+	*o = (ChldOutput) {
+		.ctx = (EvCtx) {
+			.fd = fd,
+			.callback_fn = _chld_output_on_read,
+		},
+		.chat_id = p->chat_id,
+		.pid = pid,
+		.started = time(NULL),
+		/* NULL: the output is read and dropped */
+		.buf = malloc(CFG_CHLD_OUTPUT_SIZE),
+	};
+
+	cstr_copy_n(o->name, LEN(o->name), name);
+
+	const int ret = ev_ctx_add_in(&o->ctx);
+	if (ret < 0)
+		LOG_ERR(ret, "chld", "ev_ctx_add_in: \"%s\": %d", o->name, pid);
+}
+
+
+static void
+_chld_output_on_read(EvCtx *ctx)
+{
+	Chld *const c = _chld_instance;
+	ChldOutput *const o = FIELD_PARENT_PTR(ChldOutput, ctx, ctx);
+
+	mtx_lock(&c->mutex);
+
+	/* may be closed already: the events are taken before the callbacks run */
+	if (o->ctx.fd >= 0)
+		_chld_output_read(o);
+
+	mtx_unlock(&c->mutex);
+}
+
+
+/* the caller holds the mutex: reads until EAGAIN, closes on EOF */
+static void
+_chld_output_read(ChldOutput *o)
+{
+	char buffer[4096];
+	while (1) {
+		char *dest = buffer;
+		size_t size = sizeof(buffer);
+		if (o->buf != NULL) {
+			const size_t off = o->len % CFG_CHLD_OUTPUT_SIZE;
+			dest = o->buf + off;
+			size = CFG_CHLD_OUTPUT_SIZE - off;
+		}
+
+		const ssize_t rd = read(o->ctx.fd, dest, size);
+		if (rd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return;
+
+			LOG_ERRP("chld", "output: read: \"%s\": %d", o->name, o->pid);
+			break;
+		}
+
+		if (rd == 0)
+			break;
+
+		o->len += (size_t)rd;
+	}
+
+	_chld_output_close(o);
+}
+
+
+static void
+_chld_output_close(ChldOutput *o)
+{
+	if (o->ctx.fd < 0)
+		return;
+
+	ev_ctx_del(&o->ctx);
+	close(o->ctx.fd);
+	o->ctx.fd = -1;
+}
+
+
+/*
+ * The caller holds the mutex. Whatever is left in the pipe is read, then it's closed: output
+ * written after the child exited (e.g. by its own children) is lost.
+ */
+static void
+_chld_output_done(Chld *c, unsigned slot, int status, int64_t elapsed_ms)
+{
+	ChldOutput *const o = &c->outputs[slot];
+	if (o->ctx.fd >= 0)
+		_chld_output_read(o);
+
+	_chld_output_close(o);
+
+	char *text = NULL;
+	if (o->buf != NULL) {
+		const size_t size = CFG_CHLD_OUTPUT_SIZE;
+		const size_t kept = MIN(o->len, size);
+		text = malloc(kept + 1);
+		if (text != NULL) {
+			/* the oldest byte is at the write offset once the ring has wrapped */
+			const size_t head = (o->len > size)? (o->len % size) : 0;
+			memcpy(text, o->buf + head, kept - head);
+			memcpy(text + (kept - head), o->buf, head);
+			text[kept] = '\0';
+		}
+
+		free(o->buf);
+		o->buf = NULL;
+	}
+
+	ChldOutput *const h = &c->history[c->history_count % CFG_CHLD_OUTPUT_HISTORY];
+	free(h->buf);
+
+	*h = *o;
+	h->ctx.fd = -1;
+	h->status = status;
+	h->elapsed_ms = elapsed_ms;
+	h->buf = text;
+	c->history_count++;
+
+	/* queued for chld_output_flush(): the ring above may wrap before it runs */
+	Str *const str = &c->unflushed;
+	const size_t len = str->len;
+	if ((len < CFG_CHLD_LOG_QUEUE_MAX) && (_chld_output_fmt(h, str) == 0))
+		return;
+
+	/* counted, logged by chld_output_flush() */
+	str_pop(str, str->len - len);
+	c->unflushed_dropped++;
+}
+
+
+static int
+_chld_output_fmt(const ChldOutput *o, Str *str)
+{
+	char started[32];
+	struct tm tm;
+	if ((localtime_r(&o->started, &tm) == NULL) ||
+	    (strftime(started, LEN(started), "%Y-%m-%d %H:%M:%S", &tm) == 0))
+		cstr_copy_n(started, LEN(started), "-");
+
+	const char *const res_str = WIFSIGNALED(o->status)? "signal" : "status";
+	const int res = WIFSIGNALED(o->status)? WTERMSIG(o->status) : WEXITSTATUS(o->status);
+	const size_t kept = MIN(o->len, CFG_CHLD_OUTPUT_SIZE);
+	if (str_append_fmt(str, "--- [%s] \"%s\": chat: %" PRIi64 ": pid: %d: %s: %d: %" PRIi64 " ms: "
+			   "%zu bytes%s ---\n", started, o->name, o->chat_id, o->pid, res_str, res,
+			   o->elapsed_ms, o->len, (o->len > kept)? " (head dropped)" : "") == NULL) {
+		return -1;
+	}
+
+	if ((o->buf != NULL) && (kept > 0)) {
+		if (str_append_n(str, o->buf, kept) == NULL)
+			return -1;
+		if ((o->buf[kept - 1] != '\n') && (str_append_c(str, '\n') == NULL))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static ChldWorker *
+_chld_worker_get(Chld *c, const char file[], const char name[])
+{
+	for (unsigned i = 0; i < c->workers_len; i++) {
+		ChldWorker *const w = &c->workers[i];
+		if ((strcmp(w->name, name) == 0) && (strcmp(w->file, file) == 0))
+			return w;
+	}
+
+	if (c->workers_len == CFG_CHLD_WORKERS_SIZE) {
+		LOG_ERRN("chld", "%s", "worker: slot full");
+		return NULL;
+	}
+
+	ChldWorker *const w = &c->workers[c->workers_len];
+	w->name = strdup(name);
+	w->file = strdup(file);
+	if ((w->name == NULL) || (w->file == NULL)) {
+		free(w->name);
+		free(w->file);
+		return NULL;
+	}
+
+	unsigned i = 0;
+	for (; i < CFG_CHLD_WORKER_PROCS; i++) {
+		ChldWorkerProc *const proc = &w->procs[i];
+		if (mtx_init(&proc->write_mutex, mtx_plain) != thrd_success)
+			break;
+
+		proc->ctx = (EvCtx) { .fd = -1, .callback_fn = _chld_worker_on_read };
+		proc->pid = 0;
+		proc->is_spawning = 0;
+		proc->kill_ms = 0;
+		proc->inflight = 0;
+	}
+
+	if (i < CFG_CHLD_WORKER_PROCS) {
+		LOG_ERRN("chld", "worker: \"%s\": mtx_init: failed", name);
+		while (i-- > 0)
+			mtx_destroy(&w->procs[i].write_mutex);
+
+		free(w->name);
+		free(w->file);
+		return NULL;
+	}
+
+	w->next = 0;
+	c->workers_len++;
+	return w;
+}
+
+
+/*
+ * The caller holds the mutex. Takes one of the CFG_CHLD_WORKER_INFLIGHT places of a process,
+ * round-robin. 'is_spawn': it isn't running, the caller spawns it, with 'log_fd'.
+ * ret: the process, -1: all busy, or being started or killed.
+ */
+static int
+_chld_worker_reserve(Chld *c, ChldWorker *w, int timeout_s, int *is_spawn, int *log_fd)
+{
+	for (unsigned i = 0; i < CFG_CHLD_WORKER_PROCS; i++) {
+		const unsigned index = (w->next + i) % CFG_CHLD_WORKER_PROCS;
+		ChldWorkerProc *const proc = &w->procs[index];
+		if (proc->is_spawning || (proc->kill_ms != 0) || (proc->inflight == CFG_CHLD_WORKER_INFLIGHT))
+			continue;
+
+		*is_spawn = (proc->pid == 0);
+		*log_fd = -1;
+		if (*is_spawn) {
+			/* the log may be rotated in the meantime: the worker keeps this segment */
+			*log_fd = fcntl(c->log_fd, F_DUPFD_CLOEXEC, 0);
+			proc->is_spawning = 1;
+			proc->spawn_gen = ++c->spawn_gen;
+			c->pending++;
+		} else if (proc->ctx.fd < 0) {
+			/* EOF: exiting, chld_reap() gets it */
+			continue;
+		}
+
+		proc->deadlines[proc->inflight++] = _chld_deadline_ms(timeout_s);
+		w->next = (index + 1) % CFG_CHLD_WORKER_PROCS;
+		return (int)index;
+	}
+
+	return -1;
+}
+
+
+/*
+ * Without the mutex: a place was taken by _chld_worker_reserve(). A write that doesn't finish
+ * within CFG_CHLD_WORKER_WRITE_MS kills the process: a request may be half written, and with
+ * CFG_CHLD_WORKER_INFLIGHT requests at most in its socket, it's stuck, not busy.
+ */
+static int
+_chld_worker_dispatch(Chld *c, ChldWorker *w, unsigned index, int is_spawn, int log_fd,
+		      const ChldParam *p, const char req[], size_t len)
+{
+	ChldWorkerProc *const proc = &w->procs[index];
+	if (is_spawn)
+		_chld_worker_spawn(c, w, index, log_fd, p);
+
+	/* our own reference: chld_reap() may close the worker's one while we're writing */
+	mtx_lock(&c->mutex);
+	const pid_t pid = proc->pid;
+	const int fd = ((pid == 0) || (proc->ctx.fd < 0))? -1 : fcntl(proc->ctx.fd, F_DUPFD_CLOEXEC, 0);
+	if ((fd < 0) && (pid != 0) && (proc->inflight > 0))
+		proc->inflight--;
+
+	mtx_unlock(&c->mutex);
+
+	if (fd < 0) {
+		LOG_ERRN("chld", "worker: \"%s\": [%u]: not running", w->name, index);
+		return -1;
+	}
+
+	const int64_t deadline = time_now_ms() + deadline_remain_ms(CFG_CHLD_WORKER_WRITE_MS);
+	mtx_lock(&proc->write_mutex);
+	const int is_failed = (_chld_worker_write(fd, req, len, deadline) < 0) ||
+			      (_chld_worker_write(fd, "\n", 1, deadline) < 0);
+	mtx_unlock(&proc->write_mutex);
+	close(fd);
+
+	if (is_failed == 0)
+		return 0;
+
+	LOG_ERRN("chld", "worker: \"%s\": %d: stopped", w->name, pid);
+
+	/* chld_reap() gets it and closes the socket */
+	mtx_lock(&c->mutex);
+	if (proc->pid == pid)
+		kill(-pid, SIGKILL);
+
+	mtx_unlock(&c->mutex);
+	return -1;
+}
+
+
+static int
+_chld_worker_release(Chld *c, pid_t pid, int status)
+{
+	for (unsigned i = 0; i < c->workers_len; i++) {
+		ChldWorker *const w = &c->workers[i];
+		for (unsigned j = 0; j < CFG_CHLD_WORKER_PROCS; j++) {
+			ChldWorkerProc *const proc = &w->procs[j];
+			if (proc->pid != pid)
+				continue;
+
+			_chld_log_exit(w->name, pid, status, time_now_ms() - proc->started_ms);
+			if (proc->inflight > 0)
+				LOG_ERRN("chld", "worker: \"%s\": %d: %u request(s) lost", w->name, pid, proc->inflight);
+
+			_chld_worker_close(proc);
+			proc->pid = 0;
+			proc->kill_ms = 0;
+			proc->inflight = 0;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ * Called without the mutex: _chld_worker_reserve() has set 'is_spawning' and counted it in
+ * 'pending'. 'log_fd': the worker's stdout/stderr, a dup owned from here, -1: failed.
+ * The limits of 'p' but cpu_s: RLIMIT_CPU adds up over the worker's life, not per request.
+ */
+static void
+_chld_worker_spawn(Chld *c, ChldWorker *w, unsigned index, int log_fd, const ChldParam *p)
+{
+	pid_t pid = -1;
+	pid_t failed_pid = -1;
+
+	/* a socket, not a pipe: the acks come back on it, MSG_NOSIGNAL instead of SIGPIPE */
+	int fds[2] = { -1, -1 };
+	if (log_fd < 0) {
+		LOG_ERRP("chld", "fcntl: F_DUPFD_CLOEXEC: \"%s\"", w->file);
+		goto out0;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		LOG_ERRP("chld", "socketpair: \"%s\"", w->file);
+		goto out0;
+	}
+
+	ChldParam limits = *p;
+	limits.cpu_s = 0;
+
+	char *const argv[] = { w->file, w->name, "worker", NULL };
+	pid = _chld_exec(c, w->file, argv, fds[1], log_fd, &limits, &failed_pid);
+	close(fds[1]);
+	if (pid < 0)
+		goto out0;
+
+	if (fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK) < 0)
+		LOG_ERRP("chld", "fcntl: O_NONBLOCK: \"%s\"", w->file);
+
+	LOG_INFO("chld", "worker: \"%s\": %d: [%u]", w->name, pid, index);
+
+out0:
+	if (log_fd >= 0)
+		close(log_fd);
+
+	mtx_lock(&c->mutex);
+	_chld_failed_add(c, failed_pid, w->procs[index].spawn_gen);
+	_chld_worker_commit(c, w, index, pid, fds[0]);
+	mtx_unlock(&c->mutex);
+}
+
+
+/*
+ * The caller holds the mutex. 'pid' < 0: the spawn failed, 'fd' is closed.
+ * Like _chld_commit(): chld_reap() may have got the worker before this.
+ */
+static void
+_chld_worker_commit(Chld *c, ChldWorker *w, unsigned index, pid_t pid, int fd)
+{
+	ChldWorkerProc *const proc = &w->procs[index];
+	proc->is_spawning = 0;
+	if (pid < 0) {
+		if (fd >= 0)
+			close(fd);
+
+		goto out1;
+	}
+
+	int status;
+	if (_chld_reaped_take(c, pid, proc->spawn_gen, &status) == 0) {
+		_chld_log_exit(w->name, pid, status, 0);
+		close(fd);
+		goto out1;
+	}
+
+	proc->pid = pid;
+	proc->started_ms = time_now_ms();
+	proc->ctx.fd = fd;
+
+	const int ret = ev_ctx_add_in(&proc->ctx);
+	if (ret < 0)
+		LOG_ERR(ret, "chld", "ev_ctx_add_in: worker: \"%s\": %d", w->name, pid);
+
+	goto out0;
+
+out1:
+	/* the reserved places: nothing is sent to it */
+	proc->inflight = 0;
+out0:
+	_chld_pending_done(c);
+}
+
+
+/* the event loop: acknowledgements, they make room for the queued requests */
+static void
+_chld_worker_on_read(EvCtx *ctx)
+{
+	Chld *const c = _chld_instance;
+	ChldWorkerProc *const proc = FIELD_PARENT_PTR(ChldWorkerProc, ctx, ctx);
+	ChldJob jobs[CFG_CHLD_RUNNING_MAX];
+	unsigned slots[CFG_CHLD_RUNNING_MAX];
+
+	mtx_lock(&c->mutex);
+
+	/* may be closed already: the events are taken before the callbacks run */
+	if (proc->ctx.fd >= 0)
+		_chld_worker_read(proc);
+
+	const unsigned jobs_len = _chld_queue_take(c, jobs, slots, LEN(jobs));
+	mtx_unlock(&c->mutex);
+
+	_chld_queue_spawn(c, jobs, slots, jobs_len);
+}
+
+
+/* the caller holds the mutex: one line per finished request, reads until EAGAIN, closes on EOF */
+static void
+_chld_worker_read(ChldWorkerProc *proc)
+{
+	char buffer[256];
+	while (1) {
+		const ssize_t rd = read(proc->ctx.fd, buffer, sizeof(buffer));
+		if (rd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return;
+
+			LOG_ERRP("chld", "worker: read: %d", proc->pid);
+			break;
+		}
+
+		if (rd == 0)
+			break;
+
+		for (const char *p = buffer; (p = memchr(p, '\n', (size_t)(buffer + rd - p))) != NULL; p++) {
+			if (proc->inflight == 0)
+				continue;
+
+			proc->inflight--;
+			memmove(proc->deadlines, proc->deadlines + 1, proc->inflight * sizeof(int64_t));
+		}
+	}
+
+	/* it's exiting: chld_reap() gets it */
+	_chld_worker_close(proc);
+}
+
+
+static void
+_chld_worker_close(ChldWorkerProc *proc)
+{
+	if (proc->ctx.fd < 0)
+		return;
+
+	ev_ctx_del(&proc->ctx);
+	close(proc->ctx.fd);
+	proc->ctx.fd = -1;
+}
+
+
+/* the caller holds the mutex: the oldest request in flight decides, like _chld_kill_expired() */
+static void
+_chld_worker_kill_expired(Chld *c, int64_t now)
+{
+	for (unsigned i = 0; i < c->workers_len; i++) {
+		ChldWorker *const w = &c->workers[i];
+		for (unsigned j = 0; j < CFG_CHLD_WORKER_PROCS; j++) {
+			ChldWorkerProc *const proc = &w->procs[j];
+			const pid_t pid = proc->pid;
+			if (pid == 0)
+				continue;
+
+			if (proc->kill_ms == 0) {
+				if ((proc->inflight == 0) || (proc->deadlines[0] == 0) || (now < proc->deadlines[0]))
+					continue;
+
+				c->timeout_count++;
+				proc->kill_ms = now + CFG_CHLD_KILL_GRACE_MS;
+				LOG_INFO("chld", "worker: \"%s\": %d: timed out: SIGTERM [%" PRIu64 "]", w->name,
+					 pid, c->timeout_count);
+				kill(-pid, SIGTERM);
+			} else if (now >= proc->kill_ms) {
+				c->kill_count++;
+				proc->kill_ms = INT64_MAX;
+				LOG_INFO("chld", "worker: \"%s\": %d: timed out: SIGKILL [%" PRIu64 "]", w->name,
+					 pid, c->kill_count);
+				kill(-pid, SIGKILL);
+			}
+		}
+	}
+}
+
+
+/* the caller holds the mutex */
+static unsigned
+_chld_worker_running(const Chld *c)
+{
+	unsigned ret = 0;
+	for (unsigned i = 0; i < c->workers_len; i++) {
+		for (unsigned j = 0; j < CFG_CHLD_WORKER_PROCS; j++) {
+			if (c->workers[i].procs[j].pid != 0)
+				ret++;
+		}
+	}
+
+	return ret;
+}
+
+
+/* chld_deinit() only */
+static void
+_chld_worker_stop(ChldWorkerProc *proc)
+{
+	_chld_worker_close(proc);
+
+	const pid_t pid = proc->pid;
+	if (pid > 0) {
+		kill(-pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+
+	proc->pid = 0;
+}
+
+
+/* 'deadline': time_now_ms() based, for the whole request */
+static int
+_chld_worker_write(int fd, const char buf[], size_t len, int64_t deadline)
+{
+	while (len > 0) {
+		const ssize_t ret = send(fd, buf, len, MSG_NOSIGNAL);
+		if (ret >= 0) {
+			buf += ret;
+			len -= (size_t)ret;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN) {
+			LOG_ERRP("chld", "%s", "worker: send");
+			return -1;
+		}
+
+		struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+		const int64_t timeout = deadline - time_now_ms();
+		if ((timeout <= 0) || (poll(&pfd, 1, (int)timeout) <= 0)) {
+			LOG_ERRN("chld", "%s", "worker: send: timed out");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * misc
+ */
+int
+val_is_null_and_n(size_t count, ...)
+{
+	va_list va;
+	va_start(va, count);
+
+	int ret = 0;
+	for (size_t i = 0; i < count; i++) {
+		void *const curr = va_arg(va, void *);
+		if (curr != NULL)
+			goto out0;
+	}
+
+	ret = 1;
+
+out0:
+	va_end(va);
+	return ret;
+}
+
+
+int
+val_is_null_or_n(size_t count, ...)
+{
+	va_list va;
+	va_start(va, count);
+
+	int ret = 1;
+	for (size_t i = 0; i < count; i++) {
+		void *const curr = va_arg(va, void *);
+		if (curr == NULL)
+			goto out0;
+	}
+
+	ret = 0;
+
+out0:
+	va_end(va);
+	return ret;
+}
+
+
+int
+val_cmp_n2(const void *a, size_t a_len, const void *b, size_t b_len)
+{
 	if ((a == NULL) && (b == NULL))
 		return 1;
 
@@ -1363,6 +3343,46 @@ out0:
 }
 
 
+int
+file_memfd_sealed(const char name[], const char buffer[], size_t len)
+{
+	int ret;
+	const int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+
+	size_t total = 0;
+	while (total < len) {
+		const ssize_t wr = write(fd, buffer + total, len - total);
+		if (wr < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ret = -errno;
+			goto err0;
+		}
+
+		total += (size_t)wr;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+		ret = -errno;
+		goto err0;
+	}
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		ret = -errno;
+		goto err0;
+	}
+
+	return fd;
+
+err0:
+	close(fd);
+	return ret;
+}
+
+
 int
 is_index_valid(int val, size_t max_items)
 {
@@ -1394,6 +3414,42 @@ epoch_to_cstr_default(char buffer[], size_t size, time_t time)
 }
 
 
+int64_t
+time_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+/*
+ * Deadline
+ */
+static _Thread_local int64_t _deadline_ms = 0;
+
+
+void
+deadline_set(int64_t deadline_ms)
+{
+	_deadline_ms = deadline_ms;
+}
+
+
+int64_t
+deadline_remain_ms(int64_t def_ms)
+{
+	if (_deadline_ms == 0)
+		return def_ms;
+
+	const int64_t remain = _deadline_ms - time_now_ms();
+	if (remain <= 0)
+		return 0;
+
+	return MIN(remain, def_ms);
+}
+
+
 /*
  * Http
  */
@@ -1422,6 +3478,206 @@ _http_writer(void *ctx, size_t size, size_t nmemb, void *udata)
 }
 
 
+/* circuit breaker: per-host, driven by error rate and latency */
+enum {
+	_HTTP_BREAKER_STATE_CLOSED,
+	_HTTP_BREAKER_STATE_OPEN,
+	_HTTP_BREAKER_STATE_HALF_OPEN,
+};
+
+typedef struct http_breaker {
+	char     host[256];
+	int      state;
+	int      is_probing;
+	unsigned generation;	/* bumped on every state change */
+	unsigned req_count;
+	unsigned fail_count;
+	time_t   window_start;
+	time_t   opened_at;
+} HttpBreaker;
+
+static HttpBreaker _http_breakers[CFG_HTTP_BREAKER_SIZE];
+static unsigned    _http_breakers_len = 0;
+static mtx_t       _http_breaker_mutex;
+static atomic_int  _http_breaker_is_ready = 0;
+static once_flag   _http_breaker_once = ONCE_FLAG_INIT;
+
+
+static void
+_http_breaker_init(void)
+{
+	if (mtx_init(&_http_breaker_mutex, mtx_plain) != thrd_success) {
+		LOG_ERRN("http", "%s", "mtx_init: failed, circuit breaker disabled");
+		return;
+	}
+
+	atomic_store(&_http_breaker_is_ready, 1);
+}
+
+
+static const char *
+_http_breaker_host(char buffer[], size_t size, const char url[])
+{
+	const char *host = strstr(url, "://");
+	host = (host == NULL)? url : host + 3;
+
+	cstr_copy_n2(buffer, size, host, strcspn(host, ":/?#"));
+	return buffer;
+}
+
+
+/*
+ * ret:  >=0: breaker index, 'generation': the state it was acquired in
+ *        -1: not tracked (table full)
+ *        -2: open, fail fast
+ */
+static int
+_http_breaker_acquire(const char host[], unsigned *generation)
+{
+	call_once(&_http_breaker_once, _http_breaker_init);
+	if (atomic_load(&_http_breaker_is_ready) == 0)
+		return -1;
+
+	int ret = -1;
+	const time_t now = time(NULL);
+
+	mtx_lock(&_http_breaker_mutex);
+
+	unsigned index = 0;
+	HttpBreaker *breaker = NULL;
+	for (; index < _http_breakers_len; index++) {
+		if (strcmp(_http_breakers[index].host, host) == 0) {
+			breaker = &_http_breakers[index];
+			break;
+		}
+	}
+
+	if (breaker == NULL) {
+		if (_http_breakers_len == CFG_HTTP_BREAKER_SIZE)
+			goto out0;
+
+		breaker = &_http_breakers[_http_breakers_len++];
+		memset(breaker, 0, sizeof(*breaker));
+		cstr_copy_n(breaker->host, LEN(breaker->host), host);
+		breaker->window_start = now;
+	}
+
+	switch (breaker->state) {
+	case _HTTP_BREAKER_STATE_OPEN:
+		if ((now - breaker->opened_at) < CFG_HTTP_BREAKER_OPEN_S) {
+			ret = -2;
+			goto out0;
+		}
+
+		LOG_INFO("http", "breaker: \"%s\": half-open", host);
+		breaker->state = _HTTP_BREAKER_STATE_HALF_OPEN;
+		breaker->is_probing = 0;
+		breaker->generation++;
+		/* fallthrough */
+	case _HTTP_BREAKER_STATE_HALF_OPEN:
+		/* let exactly one request probe the host */
+		if (breaker->is_probing) {
+			ret = -2;
+			goto out0;
+		}
+
+		breaker->is_probing = 1;
+		break;
+	}
+
+	*generation = breaker->generation;
+	ret = (int)index;
+
+out0:
+	mtx_unlock(&_http_breaker_mutex);
+	return ret;
+}
+
+
+static void
+_http_breaker_release(int index, unsigned generation, int is_failed, int64_t elapsed_ms)
+{
+	if (index < 0)
+		return;
+
+	const time_t now = time(NULL);
+	if (elapsed_ms >= CFG_HTTP_BREAKER_SLOW_MS)
+		is_failed = 1;
+
+	mtx_lock(&_http_breaker_mutex);
+
+	HttpBreaker *const breaker = &_http_breakers[index];
+
+	/*
+	 * late response, acquired before the last state change: e.g. started while closed, but
+	 * arrived while half-open. Only the probe decides half-open.
+	 */
+	if (generation != breaker->generation)
+		goto out0;
+
+	if (breaker->state == _HTTP_BREAKER_STATE_HALF_OPEN) {
+		breaker->is_probing = 0;
+		breaker->generation++;
+		if (is_failed) {
+			LOG_ERRN("http", "breaker: \"%s\": probe failed, open", breaker->host);
+			breaker->state = _HTTP_BREAKER_STATE_OPEN;
+			breaker->opened_at = now;
+			goto out0;
+		}
+
+		LOG_INFO("http", "breaker: \"%s\": closed", breaker->host);
+		breaker->state = _HTTP_BREAKER_STATE_CLOSED;
+		breaker->req_count = 0;
+		breaker->fail_count = 0;
+		breaker->window_start = now;
+		goto out0;
+	}
+
+	if ((now - breaker->window_start) >= CFG_HTTP_BREAKER_WINDOW_S) {
+		breaker->req_count = 0;
+		breaker->fail_count = 0;
+		breaker->window_start = now;
+	}
+
+	breaker->req_count++;
+	if (is_failed)
+		breaker->fail_count++;
+
+	if (breaker->req_count < CFG_HTTP_BREAKER_MIN_REQUESTS)
+		goto out0;
+
+	if ((breaker->fail_count * 100) < (breaker->req_count * CFG_HTTP_BREAKER_FAIL_RATIO))
+		goto out0;
+
+	LOG_ERRN("http", "breaker: \"%s\": open: failed: %u/%u", breaker->host, breaker->fail_count,
+		 breaker->req_count);
+
+	breaker->state = _HTTP_BREAKER_STATE_OPEN;
+	breaker->opened_at = now;
+	breaker->generation++;
+
+out0:
+	mtx_unlock(&_http_breaker_mutex);
+}
+
+
+/* the request told nothing about the host: let another one probe it */
+static void
+_http_breaker_cancel(int index, unsigned generation)
+{
+	if (index < 0)
+		return;
+
+	mtx_lock(&_http_breaker_mutex);
+
+	HttpBreaker *const breaker = &_http_breakers[index];
+	if ((generation == breaker->generation) && (breaker->state == _HTTP_BREAKER_STATE_HALF_OPEN))
+		breaker->is_probing = 0;
+
+	mtx_unlock(&_http_breaker_mutex);
+}
+
+
 char *
 http_send_get(const char url[], const char content_type[])
 {
@@ -1432,6 +3688,13 @@ http_send_get(const char url[], const char content_type[])
 
 	LOG_DEBUG("http", "url: %s", url);
 
+	const int64_t def_timeout_ms = CFG_HTTP_REQUEST_TIMEOUT * 1000;
+	const int64_t timeout_ms = deadline_remain_ms(def_timeout_ms);
+	if (timeout_ms == 0) {
+		LOG_ERRN("http", "deadline exceeded: %s", url);
+		return NULL;
+	}
+
 	Str str;
 	if (str_init_alloc(&str, 1024, NULL) < 0) {
 		LOG_ERRP("http", "str_init_alloc: %s", url);
@@ -1451,7 +3714,7 @@ http_send_get(const char url[], const char content_type[])
 		goto out1;
 	if (curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, _http_writer) != CURLE_OK)
 		goto out1;
-	if (curl_easy_setopt(handle, CURLOPT_TIMEOUT, CFG_HTTP_REQUEST_TIMEOUT) != CURLE_OK)
+	if (curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, (long)timeout_ms) != CURLE_OK)
 		goto out1;
 
 	struct curl_slist *slist = NULL;
@@ -1470,7 +3733,31 @@ http_send_get(const char url[], const char content_type[])
 			goto out2;
 	}
 
+	char host[256];
+	_http_breaker_host(host, LEN(host), url);
+
+	unsigned generation = 0;
+	const int breaker = _http_breaker_acquire(host, &generation);
+	if (breaker == -2) {
+		LOG_ERRN("http", "breaker: \"%s\": open, fail fast", host);
+		goto out2;
+	}
+
+	const int64_t start_ms = time_now_ms();
 	const CURLcode res = curl_easy_perform(handle);
+
+	long status = 0;
+	if (res == CURLE_OK)
+		curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+
+	/* cut short by the caller's deadline, not by the host: not the host's failure */
+	if ((res == CURLE_OPERATION_TIMEDOUT) && (timeout_ms < def_timeout_ms)) {
+		_http_breaker_cancel(breaker, generation);
+	} else {
+		const int is_failed = (res != CURLE_OK) || (status >= 500);
+		_http_breaker_release(breaker, generation, is_failed, time_now_ms() - start_ms);
+	}
+
 	if (res != CURLE_OK) {
 		LOG_ERRN("http", "curl_easy_perform: %s", curl_easy_strerror(res));
 		goto out2;
@@ -1548,6 +3835,217 @@ dump_json_obj(const char ctx[], json_object *json)
 }
 
 
+/*
+ * JsonRaw
+ */
+static const char *
+_json_raw_skip_ws(const char *p, const char *end)
+{
+	while ((p < end) && isspace((unsigned char)*p))
+		p++;
+
+	return p;
+}
+
+
+/* 'p' must point to '"', ret: one past the closing '"', NULL: invalid */
+static const char *
+_json_raw_skip_str(const char *p, const char *end)
+{
+	for (p++; p < end; p++) {
+		if (*p == '\\') {
+			p++;
+			continue;
+		}
+
+		if (*p == '"')
+			return p + 1;
+	}
+
+	return NULL;
+}
+
+
+/* ret: one past the end of the value, NULL: invalid */
+static const char *
+_json_raw_skip_value(const char *p, const char *end)
+{
+	if (p >= end)
+		return NULL;
+
+	if (*p == '"')
+		return _json_raw_skip_str(p, end);
+
+	if ((*p == '{') || (*p == '[')) {
+		/* expected closing brackets */
+		char stack[JSON_RAW_DEPTH_MAX];
+		unsigned depth = 0;
+		while (p < end) {
+			switch (*p) {
+			case '"':
+				p = _json_raw_skip_str(p, end);
+				if (p == NULL)
+					return NULL;
+				continue;
+			case '{':
+			case '[':
+				if (depth == JSON_RAW_DEPTH_MAX)
+					return NULL;
+
+				stack[depth++] = (*p == '{')? '}' : ']';
+				break;
+			case '}':
+			case ']':
+				if (stack[--depth] != *p)
+					return NULL;
+				if (depth == 0)
+					return p + 1;
+				break;
+			}
+
+			p++;
+		}
+
+		return NULL;
+	}
+
+	/* number, true, false, null */
+	const char *const start = p;
+	while ((p < end) && (strchr(",}] \t\r\n", *p) == NULL))
+		p++;
+
+	return (p == start)? NULL : p;
+}
+
+
+void
+json_raw_iter_init(JsonRawIter *it, const char json[], size_t len)
+{
+	it->end = json + len;
+	it->p = _json_raw_skip_ws(json, it->end);
+	it->depth = 0;
+	it->is_first = 0;
+}
+
+
+int
+json_raw_iter_enter(JsonRawIter *it, char kind)
+{
+	if ((it->p == it->end) || (*it->p != kind) || (it->depth == JSON_RAW_DEPTH_MAX))
+		return -1;
+
+	it->stack[it->depth++] = (kind == '{')? '}' : ']';
+	it->p++;
+	it->is_first = 1;
+	return 0;
+}
+
+
+int
+json_raw_iter_next(JsonRawIter *it, JsonRaw *key)
+{
+	if (it->depth == 0)
+		return -1;
+
+	const char close = it->stack[it->depth - 1];
+	const char *p = _json_raw_skip_ws(it->p, it->end);
+	if (p == it->end)
+		return -1;
+
+	if (*p == close) {
+		it->p = p + 1;
+		it->depth--;
+		it->is_first = 0;
+		return 0;
+	}
+
+	if (it->is_first == 0) {
+		if (*p != ',')
+			return -1;
+
+		p = _json_raw_skip_ws(p + 1, it->end);
+	}
+
+	it->is_first = 0;
+	if (close == '}') {
+		if ((p == it->end) || (*p != '"'))
+			return -1;
+
+		const char *const kend = _json_raw_skip_str(p, it->end);
+		if (kend == NULL)
+			return -1;
+
+		if (key != NULL) {
+			key->value = p;
+			key->len = (size_t)(kend - p);
+		}
+
+		p = _json_raw_skip_ws(kend, it->end);
+		if ((p == it->end) || (*p != ':'))
+			return -1;
+
+		p = _json_raw_skip_ws(p + 1, it->end);
+	}
+
+	it->p = p;
+	return 1;
+}
+
+
+int
+json_raw_iter_value(JsonRawIter *it, JsonRaw *value)
+{
+	const char *const vend = _json_raw_skip_value(it->p, it->end);
+	if (vend == NULL)
+		return -1;
+
+	if (value != NULL) {
+		value->value = it->p;
+		value->len = (size_t)(vend - it->p);
+	}
+
+	it->p = vend;
+	return 0;
+}
+
+
+int
+json_raw_iter_leave(JsonRawIter *it)
+{
+	for (;;) {
+		const int ret = json_raw_iter_next(it, NULL);
+		if (ret <= 0)
+			return ret;
+
+		if (json_raw_iter_value(it, NULL) < 0)
+			return -1;
+	}
+}
+
+
+int
+json_raw_to_int64(const JsonRaw *j, int64_t *ret)
+{
+	if ((j->len == 0) || (j->len >= INT64_DIGITS_LEN))
+		return -1;
+
+	if ((isdigit((unsigned char)j->value[0]) == 0) && (j->value[0] != '-'))
+		return -1;
+
+	return cstr_to_int64_n(j->value, j->len, ret);
+}
+
+
+int
+json_raw_str_eq(const JsonRaw *j, const char cstr[])
+{
+	if ((j->len < 2) || (j->value[0] != '"'))
+		return 0;
+
+	return cstr_cmp_n2(j->value + 1, j->len - 2, cstr, strlen(cstr));
+}
+
+
 /*
  * Log
  */
@@ -8,6 +8,8 @@
 #include <stddef.h>
 #include <threads.h>
 
+#include <sys/types.h>
+
 #include "config.h"
 #include "picohttpparser.h"
 
@@ -161,6 +163,33 @@ char *str_dup(Str *s);
 }
 
 
+/*
+ * Arena: bump-pointer allocator, everything is released at once by arena_deinit()
+ */
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	size_t              size;
+	size_t              used;
+	max_align_t         data[];
+} ArenaChunk;
+
+typedef struct arena {
+	char       *buffer;	/* caller-provided first block, may be NULL */
+	size_t      size;
+	size_t      used;
+	size_t      chunk_size;
+	ArenaChunk *chunks;
+} Arena;
+
+void  arena_init(Arena *a, char buffer[], size_t size, size_t chunk_size);
+void  arena_deinit(Arena *a);
+void *arena_alloc(Arena *a, size_t size);
+void *arena_calloc(Arena *a, size_t nmemb, size_t size);
+char *arena_vfmt(Arena *a, const char fmt[], va_list args);
+char *arena_fmt(Arena *a, const char fmt[], ...);
+char *arena_cstr_escape(Arena *a, const char escape[], char c, const char src[]);
+
+
 /*
  * misc
  */
@@ -180,9 +209,43 @@ int64_is_bool(int64_t val)
 	return ((val == 0) || (val == 1));
 }
 
+/* FNV-1a, 64-bit: 'hash': FNV1A_INIT, or a previous result to chain the inputs */
+#define FNV1A_INIT (14695981039346656037u)
+
+static inline uint64_t
+fnv1a(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *const bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211u;
+	}
+
+	return hash;
+}
+
+/* 'is_nocase': ASCII letters are hashed as lowercase */
+static inline uint64_t
+fnv1a_cstr(uint64_t hash, const char cstr[], int is_nocase)
+{
+	for (; *cstr != '\0'; cstr++) {
+		uint8_t c = (uint8_t)*cstr;
+		if (is_nocase && (c >= 'A') && (c <= 'Z'))
+			c |= 0x20;
+
+		hash ^= c;
+		hash *= 1099511628211u;
+	}
+
+	return hash;
+}
+
 int file_read_all(const char path[], char buffer[], size_t *len);
 int file_write_all(const char path[], const char buffer[], size_t *len);
 
+/* ret: a read-only (sealed) memfd, at offset 0; <0: -errno */
+int file_memfd_sealed(const char name[], const char buffer[], size_t len);
+
 int is_index_valid(int val, size_t max_items);
 
 static inline const char *
@@ -194,6 +257,18 @@ bool_to_cstr(int cond)
 const char *epoch_to_cstr(char buffer[], size_t size, const char fmt[], time_t time);
 const char *epoch_to_cstr_default(char buffer[], size_t size, time_t time);
 
+/* monotonic clock */
+int64_t time_now_ms(void);
+
+
+/*
+ * Deadline: per-thread budget of the current job (e.g. an update)
+ */
+void    deadline_set(int64_t deadline_ms);	/* 0: no deadline */
+
+/* ret: 0: expired, >0: MIN(remaining, def_ms), or def_ms if there is no deadline */
+int64_t deadline_remain_ms(int64_t def_ms);
+
 
 /*
  * Chld
@@ -203,10 +278,47 @@ void chld_deinit(void);
 int  chld_add_env(const char key_value[]);
 int  chld_add_env_kv(const char key[], const char val[]);
 int  chld_add_env_kv_int64(const char key[], int64_t val);
-int  chld_spawn(const char file[], char *const argv[]);
-void chld_reap(void);
+
+typedef struct chld_param {
+	const char   *file;
+	char *const  *argv;
+	int           stdin_fd;	/* -1: inherited */
+	int64_t       chat_id;	/* per-chat limit, 0: none */
+	int64_t       msg_id;		/* replied to if it times out in the queue, see: chld_dropped_take() */
+	int           timeout_s;	/* wall-clock, 0: CFG_CHLD_TIMEOUT_S, <0: none */
+	int           cpu_s;		/* RLIMIT_CPU, 0: none */
+	int           mem_mb;		/* RLIMIT_AS, 0: none */
+	const char   *cgroup;		/* cgroup v2 directory, NULL/empty: none */
+	const char   *tag;		/* kept while it runs, see: chld_tag_get(), NULL/empty: none */
+} ChldParam;
+
+/* ret: 0: spawned or queued, -1: failed, the queue or the chat's share of it is full */
+int  chld_spawn(const ChldParam *p);
+/* 'p': file, chat_id, msg_id, and the limits, the rest is not used. ret: like chld_spawn() */
+int  chld_worker_send(const ChldParam *p, const char name[], const char req[], size_t len);
+/* ret: 1: the output log is filling up, call chld_output_flush() now, off the event loop */
+int  chld_reap(void);
+void chld_kill_expired(void);
 void chld_wait_all(void);
 
+/* appends the finished invocations to the log file, rotates it: off the event loop */
+void         chld_output_flush(void);
+
+/* ret: array of the last 'count' invocations, newest first, NULL: failed or not initialized */
+json_object *chld_output_get(unsigned count);
+
+typedef struct chld_dropped {
+	int64_t chat_id;
+	int64_t msg_id;
+	char    name[CFG_CHLD_OUTPUT_NAME_SIZE];
+} ChldDropped;
+
+/* ret: the queued jobs that timed out since the last call, up to 'size': the caller replies */
+unsigned     chld_dropped_take(ChldDropped list[], unsigned size);
+
+/* 'pgid': a running one-shot child's, it leads its process group. ret: 0: copied, -1: none */
+int          chld_tag_get(pid_t pgid, char buf[], size_t size);
+
 
 /*
  * Http
@@ -235,6 +347,46 @@ void dump_json_str(const char ctx[], const char json[]);
 void dump_json_obj(const char ctx[], json_object *json);
 
 
+/*
+ * JsonRaw: a forward-only cursor over a raw JSON buffer, no tree, no allocation. Each value is
+ * either entered or skipped, so every byte is scanned once.
+ */
+#define JSON_RAW_DEPTH_MAX (64)
+
+typedef struct json_raw {
+	const char *value;
+	size_t      len;
+} JsonRaw;
+
+typedef struct json_raw_iter {
+	const char *p;
+	const char *end;
+	unsigned    depth;
+	int         is_first;
+	char        stack[JSON_RAW_DEPTH_MAX];	/* expected closing brackets */
+} JsonRawIter;
+
+void json_raw_iter_init(JsonRawIter *it, const char json[], size_t len);
+
+/* 'kind': '{' or '[', the value at the cursor must be one. ret: 0: success, -1: invalid */
+int json_raw_iter_enter(JsonRawIter *it, char kind);
+
+/*
+ * ret: 1: the cursor is at the next value ('key' is the quoted member name, objects only),
+ *      0: the closing bracket was consumed, -1: invalid
+ */
+int json_raw_iter_next(JsonRawIter *it, JsonRaw *key);
+
+/* skips the value at the cursor, 'value': optional */
+int json_raw_iter_value(JsonRawIter *it, JsonRaw *value);
+
+/* skips the rest of the entered object or array */
+int json_raw_iter_leave(JsonRawIter *it);
+
+int json_raw_to_int64(const JsonRaw *j, int64_t *ret);
+int json_raw_str_eq(const JsonRaw *j, const char cstr[]);
+
+
 /*
  * Log
  */
@@ -7,7 +7,7 @@
 #include "util.h"
 
 
-#define ALLOWED_UPDATES "[\"message\",\"callback_query\",\"inline_query\"]"
+#define ALLOWED_UPDATES "[\"message\",\"callback_query\",\"inline_query\",\"chat_member\"]"
 
 
 static void _print_json(const char raw[]);